@@ -8,35 +8,312 @@
  */
 
 #include <linux/fb.h>
+#include <linux/anon_inodes.h>
+#include <linux/backlight.h>
+#include <linux/bitops.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/eventfd.h>
+#include <linux/file.h>
+#include <linux/gpio/driver.h>
+#include <linux/hrtimer.h>
 #include <linux/i2c.h>
-#include <linux/input-polldev.h>
+#include <linux/input.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/leds.h>
+#include <linux/math64.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/pm_runtime.h>
+#include <linux/poll.h>
+#include <linux/property.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
+#include <uapi/linux/sched/types.h>
 
-#define MATRIXORBITAL_POLL_KEY_PRESS	0x26
-#define MATRIXORBITAL_READ_MODULE_TYPE 0x37
-#define MATRIXORBITAL_AUTO_TX_KEY_PRESS_OFF 0x4F
-#define MATRIXORBITAL_GPO_OFF 0x56
-#define MATRIXORBITAL_GPO_ON 0x57
-#define MATRIXORBITAL_CLEAR_SCREEN 0x58
-#define MATRIXORBITAL_DRAW_BITMAP_DIRECTLY 0x64
-#define MATRIXORBITAL_TX_PROTOCOL_SELECT 0xA0
+#include "matrixorbital.h"
+#include "matrixorbital_pack.h"
+#include "matrixorbital_queue.h"
+#include "matrixorbital_simd.h"
+
+#define CREATE_TRACE_POINTS
+#include "matrixorbital_trace.h"
 
 #define MATRIXORBITAL_MAX_LEDS 6
+#define MATRIXORBITAL_GPOS 6
+
+#define MATRIXORBITAL_KEY_POLL_MS 500
+
+/* First presence probe after the panel went away, doubling from there */
+#define MATRIXORBITAL_PRESENCE_MIN_MS 100
+
+#define MATRIXORBITAL_CAPTURE_SIZE (256 * 1024)
+
+/* Priority zones, damage in them becomes a region of its own */
+#define MATRIXORBITAL_MAX_ZONES 4
+
+/* Frames queued for presentation, and how early before its upload one is taken */
+#define MATRIXORBITAL_MAX_FRAMES 16
+#define MATRIXORBITAL_PRESENT_LEAD_US 2000
+#define MATRIXORBITAL_PRESENT_FEEDBACK 64
+
+/* Command ring entries, and how many are taken off the ring at once */
+#define MATRIXORBITAL_RING_ENTRIES 256
+#define MATRIXORBITAL_RING_BATCH 32
+
+/* Latency histograms use log2 buckets in microseconds: [0], [1], [2..3], ... */
+#define MATRIXORBITAL_HIST_BUCKETS 20
+
+/* Bus time is accounted over a sliding window made of equal slots */
+#define MATRIXORBITAL_BUS_SLOTS 10
+#define MATRIXORBITAL_BUS_SLOT_MS 100
+#define MATRIXORBITAL_BUS_WINDOW_NS \
+	((u64)MATRIXORBITAL_BUS_SLOTS * MATRIXORBITAL_BUS_SLOT_MS * NSEC_PER_MSEC)
 
 static u_int refreshrate = 5;
 module_param(refreshrate, uint, 0);
 
+static u_int bus_budget = 70;
+module_param(bus_budget, uint, 0644);
+MODULE_PARM_DESC(bus_budget, "Share of the bus time display updates may use, in percent (default 70)");
+
+static u_int bus_freq = 100000;
+module_param(bus_freq, uint, 0444);
+MODULE_PARM_DESC(bus_freq, "I2C clock in Hz if the adapter doesn't describe it (default 100000)");
+
+static u_int xfer_retries;
+module_param(xfer_retries, uint, 0644);
+MODULE_PARM_DESC(xfer_retries, "Times an I2C write the panel didn't acknowledge at all is resent right away (default 0)");
+
+static u_int retry_ms = 100;
+module_param(retry_ms, uint, 0644);
+MODULE_PARM_DESC(retry_ms, "Delay before a failed display update is retried, 0 waits for new damage (default 100)");
+
+static u_int worker_rt = 1;
+module_param(worker_rt, uint, 0444);
+MODULE_PARM_DESC(worker_rt, "Scheduling of the I/O thread: 0 normal, 1 lowest fifo priority, 2 middle fifo priority (default 1)");
+
+static int worker_cpu = -1;
+module_param(worker_cpu, int, 0444);
+MODULE_PARM_DESC(worker_cpu, "CPU the I/O thread is bound to, -1 for any (default -1)");
+
+static u_int max_hold_us = 20000;
+module_param(max_hold_us, uint, 0444);
+MODULE_PARM_DESC(max_hold_us, "Initial longest time one transfer may hold the adapter, 0 for no limit (default 20000)");
+
+static u_int deadline_ms = 200;
+module_param(deadline_ms, uint, 0444);
+MODULE_PARM_DESC(deadline_ms, "Initial deadline of damage without one of its own (default 200)");
+
+static bool atomic_flush = true;
+module_param(atomic_flush, bool, 0644);
+MODULE_PARM_DESC(atomic_flush, "Upload the screen with atomic transfers during oopses and panics (default on)");
+
+static char *pack_kernel;
+module_param(pack_kernel, charp, 0444);
+MODULE_PARM_DESC(pack_kernel, "Packing and diff implementation to use instead of the fastest one");
+
+static unsigned int absent_nacks = 5;
+module_param(absent_nacks, uint, 0644);
+MODULE_PARM_DESC(absent_nacks, "Consecutive NACKs after which the panel is taken for absent, 0 never (default 5)");
+
+static unsigned int presence_max_ms = 30000;
+module_param(presence_max_ms, uint, 0644);
+MODULE_PARM_DESC(presence_max_ms, "Longest interval between presence probes of an absent panel (default 30000)");
+
+static unsigned int fade_ms = 250;
+module_param(fade_ms, uint, 0444);
+MODULE_PARM_DESC(fade_ms, "Initial time a backlight change is faded over, 0 to jump (default 250)");
+
+static unsigned int fade_rate = 50;
+module_param(fade_rate, uint, 0444);
+MODULE_PARM_DESC(fade_rate, "Initial backlight fade steps per second (default 50)");
+
+static char *wall;
+module_param(wall, charp, 0444);
+MODULE_PARM_DESC(wall, "Panels tiled into one framebuffer by I2C device, ',' between columns and ';' between rows, e.g. \"0-0028,1-0028\"");
+
+static struct dentry *matrixorbital_debugfs_root;
+static struct matrixorbital_pack_impl *matrixorbital_pack_impl;
+
+struct matrixorbital_par;
+
+/* Damage waiting for upload, the most urgent region goes first */
+/* Pacing search in progress, the I/O thread sends one test frame at a time */
+struct matrixorbital_calibration {
+	u8 *data;
+	u32 len;
+	u32 size_idx;
+	u32 gap_idx;
+	u32 run;
+	u64 total_ns;
+	u32 old_size;
+	u32 old_gap;
+	u32 best_size;
+	u32 best_gap;
+	u64 best_rate;
+};
+
+/*
+ * Driver side of a command ring, the mapping lives as long as its file and
+ * any batch the I/O thread is working through
+ */
+struct matrixorbital_ring_ctx {
+	struct kref ref;
+	struct matrixorbital_par *par;
+	struct matrixorbital_ring *ring;
+	u32 size;
+	u32 tail;
+	u32 invalid;
+
+	/* Doorbell */
+	struct eventfd_ctx *doorbell;
+	wait_queue_entry_t wait;
+	poll_table pt;
+	wait_queue_head_t space_wait;
+
+	struct matrixorbital_ring_entry batch[MATRIXORBITAL_RING_BATCH];
+	u8 cmds[MATRIXORBITAL_RING_BATCH * 9];
+};
+
+/*
+ * Guards par->ring and ctx->par against each other. The I/O thread only
+ * takes it to pin the ring, not across transfers.
+ */
+static DEFINE_MUTEX(matrixorbital_ring_lock);
+
+/* Part of the screen whose damage is due sooner than the default */
+struct matrixorbital_zone {
+	struct matrixorbital_rect rect;
+	u32 deadline_ms;
+};
+
+/* Pulse on a GPO when a key is pressed, the LEDs light up with their GPO off */
+struct matrixorbital_key_action {
+	u8 gpo;
+	bool led;
+	u16 ms;
+};
+
 struct matrixorbital_led {
 	struct led_classdev	cdev;
 	u8 gpio_number;
-	u8 brightness;
-	struct work_struct work;
-	struct i2c_client *client;
+	struct matrixorbital_par *par;
+};
+
+/*
+ * Transfer time model ns = header_ns + len * byte_ps / 1000, fitted by
+ * least squares over exponentially decaying sums of measured transfers.
+ * Samples carry a weight of 1 << COST_WEIGHT_SHIFT so the decay stays
+ * accurate in integer arithmetic.
+ */
+#define MATRIXORBITAL_COST_DECAY_SHIFT 5
+#define MATRIXORBITAL_COST_WEIGHT_SHIFT 10
+#define MATRIXORBITAL_COST_MIN_SAMPLES 16
+
+struct matrixorbital_cost {
+	spinlock_t lock;
+	u64 n;
+	u64 sx;
+	u64 sy;
+	u64 sxx;
+	u64 sxy;
+	u64 samples;
+	u64 header_ns;
+	u64 byte_ps;
+	bool valid;
+};
+
+enum matrixorbital_hist_id {
+	MATRIXORBITAL_HIST_FLUSH,
+	MATRIXORBITAL_HIST_DAMAGE,
+	MATRIXORBITAL_HIST_KEY_POLL,
+	MATRIXORBITAL_HIST_BUS_HOLD,
+	MATRIXORBITAL_HIST_BUS_WAIT,
+	MATRIXORBITAL_NR_HISTS
+};
+
+static const char *matrixorbital_hist_names[MATRIXORBITAL_NR_HISTS] = {
+	[MATRIXORBITAL_HIST_FLUSH]	= "flush",
+	[MATRIXORBITAL_HIST_DAMAGE]	= "damage_to_glass",
+	[MATRIXORBITAL_HIST_KEY_POLL]	= "key_poll",
+	[MATRIXORBITAL_HIST_BUS_HOLD]	= "bus_hold",
+	[MATRIXORBITAL_HIST_BUS_WAIT]	= "bus_wait",
+};
+
+struct matrixorbital_hist {
+	u64 buckets[MATRIXORBITAL_HIST_BUCKETS];
+	u64 count;
+	u64 sum_us;
+	u64 max_us;
+};
+
+enum matrixorbital_bus_class {
+	MATRIXORBITAL_BUS_DISPLAY,
+	MATRIXORBITAL_BUS_CONTROL,
+	MATRIXORBITAL_BUS_NR_CLASSES
+};
+
+/* Bus time accounting shared by all displays on the same adapter */
+struct matrixorbital_bus {
+	struct list_head node;
+	struct i2c_adapter *adapter;
+	unsigned int users;
+	u32 freq;
+
+	spinlock_t lock;
+	u64 slot;
+	u64 slot_ns[MATRIXORBITAL_BUS_SLOTS][MATRIXORBITAL_BUS_NR_CLASSES];
+	u64 total_ns[MATRIXORBITAL_BUS_NR_CLASSES];
+};
+
+static LIST_HEAD(matrixorbital_buses);
+static DEFINE_MUTEX(matrixorbital_buses_lock);
+
+struct matrixorbital_stats {
+	spinlock_t lock;
+	u64 frames_flushed;
+	u64 frames_skipped;
+	u64 frames_throttled;
+	u64 rects_flushed;
+	u64 rects_unaligned;
+	u64 xfers;
+	u64 xfer_errors;
+	u64 xfer_retries;
+	u64 flush_retries;
+	u64 deadline_misses;
+	u64 frames_presented;
+	u64 frames_dropped;
+	u64 frames_late;
+	u64 ring_entries;
+	u64 ring_batches;
+	u64 ring_commands;
+	u64 gpo_writes;
+	u64 gpo_skipped;
+	u64 backlight_writes;
+	u64 absent_events;
+	u64 presence_probes;
+	u64 deadline_late_max_ns;
+	u64 hold_max_ns;
+	u64 wait_max_ns;
+	u64 bytes_rx;
+	u64 cmd_count[256];
+	u64 cmd_bytes[256];
+	struct matrixorbital_hist hist[MATRIXORBITAL_NR_HISTS];
 };
 
 static const char* matrixorbital_leds[] = {
@@ -49,8 +326,138 @@ struct matrixorbital_par {
 	u32 width;
 	u32 height;
 	struct fb_info *info;
-	struct input_polled_dev	*idev;
+	struct input_dev *idev;
+	struct kthread_delayed_work key_work;
 	struct matrixorbital_led *led[MATRIXORBITAL_MAX_LEDS];
+
+	/*
+	 * GPO levels asked for, under gpo_lock, and the levels last written by
+	 * gpo_work, which only it touches. Bit n is GPO n + 1, set for on.
+	 */
+	struct gpio_chip gpio;
+	spinlock_t gpo_lock;
+	unsigned long gpo_mask;
+	unsigned long gpo_bits;
+	unsigned long gpo_state;
+	unsigned long gpo_known;
+	struct kthread_work gpo_work;
+
+	/* Key feedback pulses override the levels above until they end */
+	struct matrixorbital_key_action key_actions[ARRAY_SIZE(matrixorbital_keymap)];
+	unsigned long pulse_mask;
+	unsigned long pulse_bits;
+	ktime_t pulse_end[MATRIXORBITAL_GPOS];
+	struct kthread_delayed_work pulse_work;
+
+	/*
+	 * Backlight fade from fade_from to fade_target, under fade_lock. The
+	 * timer samples the level due every 1/fade_rate s into bl_next and
+	 * bl_work sends it unless the controller has it already.
+	 */
+	struct backlight_device *bl;
+	spinlock_t fade_lock;
+	int fade_from;
+	int fade_target;
+	ktime_t fade_start;
+	u32 fade_ms;
+	u32 fade_rate;
+	struct hrtimer fade_timer;
+	int bl_next;
+	int bl_level;
+	u32 contrast;
+	u32 contrast_sent;
+	struct kthread_work bl_work;
+	bool blanked;
+	bool suspended;
+
+	/* Serializes frame uploads and protects the shadow copy */
+	struct mutex lock;
+	u8 *shadow;
+	bool shadow_valid;
+
+	/* Damage not uploaded yet and how urgent it is, protected by damage_lock */
+	spinlock_t damage_lock;
+	/* Tiles are marked without the lock, see matrixorbitalfb_damage */
+	struct matrixorbital_pending pending;
+	/* A full region is pending, the shadow is only right outside of it */
+	bool shadow_partial;
+	u32 deadline_ms;
+
+	atomic_t damage_seq;
+	u32 flushed_seq;
+	atomic_t kick_pending;
+
+	seqlock_t zones_lock;
+	struct matrixorbital_zone zones[MATRIXORBITAL_MAX_ZONES];
+	u32 nr_zones;
+
+	struct matrixorbital_bus *bus;
+	struct matrixorbital_cost cost;
+	bool throttled;
+
+	/* Consecutive NACKs, and the presence probe while the panel is absent */
+	u32 nacks;
+	bool absent;
+	u32 presence_ms;
+	struct kthread_delayed_work presence_work;
+
+	/* Pacing of long commands, see matrixorbital_write_array */
+	u32 chunk_size;
+	u32 chunk_gap_us;
+	u32 max_hold_us;
+	bool sync_check;
+	u64 sync_errors;
+	/* Filler the controller still needs to finish a broken command */
+	u32 drain_owed;
+	atomic_t shadow_stale;
+	int module_type;
+	struct kthread_work calibrate_work;
+	struct matrixorbital_calibration cal;
+	atomic_t calibrating;
+	int calibrate_result;
+	u32 calibrate_rate;
+	struct kthread_delayed_work flush_work;
+	wait_queue_head_t flush_wait;
+
+	/* Presentation queue sorted by target, and feedback, under present_lock */
+	spinlock_t present_lock;
+	struct list_head frames;
+	u32 nr_frames;
+	struct hrtimer present_timer;
+	struct kthread_work present_work;
+	struct kfifo present_done;
+	wait_queue_head_t present_wait;
+
+	/* Command ring, and the drawing color the controller is set to or -1 */
+	struct matrixorbital_ring_ctx *ring;
+	struct kthread_work ring_work;
+	int draw_color;
+
+	/*
+	 * All controller I/O after probe runs on this thread. worker_closed
+	 * is set under worker_lock once removal starts, nothing is queued after.
+	 */
+	struct kthread_worker *worker;
+	spinlock_t worker_lock;
+	bool worker_closed;
+
+	/* Uploads without the thread when it may never run again */
+	struct notifier_block panic_nb;
+	u8 *panic_buf;
+	atomic_t atomic_busy;
+	u64 atomic_flushes;
+
+	struct matrixorbital_stats stats;
+	struct dentry *debugfs;
+
+	/* Capture log, recording while the capture file is open */
+	atomic_t capture_open;
+	spinlock_t capture_lock;
+	bool capturing;
+	struct kfifo capture;
+	u32 capture_mask;
+	u64 capture_dropped;
+	wait_queue_head_t capture_wait;
 };
 
 static const struct fb_fix_screeninfo matrixorbitalfb_fix = {
@@ -67,252 +474,3872 @@ static const struct fb_var_screeninfo matrixorbitalfb_var = {
 	.bits_per_pixel	= 1,
 };
 
-static int matrixorbital_write_array(struct i2c_client *client, u8 *buf, u32 len)
+/* Queue on the I/O thread unless the device is going away */
+static bool matrixorbital_queue_work(struct matrixorbital_par *par, struct kthread_work *work)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&par->worker_lock, flags);
+	if (par->worker && !par->worker_closed)
+		ret = kthread_queue_work(par->worker, work);
+	spin_unlock_irqrestore(&par->worker_lock, flags);
+
+	return ret;
+}
+
+static bool matrixorbital_queue_delayed_work(struct matrixorbital_par *par,
+					     struct kthread_delayed_work *dwork,
+					     unsigned long delay)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&par->worker_lock, flags);
+	if (par->worker && !par->worker_closed)
+		ret = kthread_queue_delayed_work(par->worker, dwork, delay);
+	spin_unlock_irqrestore(&par->worker_lock, flags);
+
+	return ret;
+}
+
+static bool matrixorbital_mod_delayed_work(struct matrixorbital_par *par,
+					   struct kthread_delayed_work *dwork,
+					   unsigned long delay)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&par->worker_lock, flags);
+	if (par->worker && !par->worker_closed)
+		ret = kthread_mod_delayed_work(par->worker, dwork, delay);
+	spin_unlock_irqrestore(&par->worker_lock, flags);
+
+	return ret;
+}
+
+/* Refuse any further work, the queue helpers check under the same lock */
+static void matrixorbital_worker_close(struct matrixorbital_par *par)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->worker_lock, flags);
+	par->worker_closed = true;
+	spin_unlock_irqrestore(&par->worker_lock, flags);
+}
+
+static void matrixorbital_worker_stop(struct matrixorbital_par *par)
+{
+	matrixorbital_worker_close(par);
+	if (!par->worker)
+		return;
+
+	/* A presence probe can kick a flush, so it is stopped first */
+	kthread_cancel_delayed_work_sync(&par->presence_work);
+	kthread_cancel_delayed_work_sync(&par->flush_work);
+	kthread_cancel_delayed_work_sync(&par->key_work);
+	kthread_cancel_delayed_work_sync(&par->pulse_work);
+	kthread_flush_worker(par->worker);
+	kthread_destroy_worker(par->worker);
+	par->worker = NULL;
+}
+
+static void matrixorbital_hist_add(struct matrixorbital_par *par,
+				   enum matrixorbital_hist_id id, ktime_t start)
+{
+	struct matrixorbital_hist *hist = &par->stats.hist[id];
+	u64 us = ktime_us_delta(ktime_get(), start);
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	hist->buckets[min_t(int, fls64(us), MATRIXORBITAL_HIST_BUCKETS - 1)]++;
+	hist->count++;
+	hist->sum_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+}
+
+static void matrixorbital_stats_xfer(struct matrixorbital_par *par, u32 rx_len, bool ok)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.xfers++;
+	if (!ok)
+		par->stats.xfer_errors++;
+	par->stats.bytes_rx += rx_len;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+}
+
+static void matrixorbital_stats_cmd(struct matrixorbital_par *par, const u8 *buf, u32 len)
+{
+	unsigned long flags;
+
+	if (len < 2 || buf[0] != 0xFE)
+		return;
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.cmd_count[buf[1]]++;
+	par->stats.cmd_bytes[buf[1]] += len;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+}
+
+static struct matrixorbital_bus *matrixorbital_bus_get(struct i2c_adapter *adapter)
+{
+	struct matrixorbital_bus *bus;
+
+	mutex_lock(&matrixorbital_buses_lock);
+	list_for_each_entry(bus, &matrixorbital_buses, node) {
+		if (bus->adapter == adapter) {
+			bus->users++;
+			goto out;
+		}
+	}
+
+	bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+	if (!bus)
+		goto out;
+
+	bus->adapter = adapter;
+	bus->users = 1;
+	spin_lock_init(&bus->lock);
+	if (!adapter->dev.parent ||
+	    device_property_read_u32(adapter->dev.parent, "clock-frequency", &bus->freq) ||
+	    !bus->freq)
+		bus->freq = bus_freq ? bus_freq : 100000;
+	list_add_tail(&bus->node, &matrixorbital_buses);
+out:
+	mutex_unlock(&matrixorbital_buses_lock);
+	return bus;
+}
+
+static void matrixorbital_bus_put(struct matrixorbital_bus *bus)
 {
+	mutex_lock(&matrixorbital_buses_lock);
+	if (!--bus->users) {
+		list_del(&bus->node);
+		kfree(bus);
+	}
+	mutex_unlock(&matrixorbital_buses_lock);
+}
+
+/*
+ * Estimated time on the wire: START, address byte and payload bytes
+ * with their ACK bits, STOP.
+ */
+static u64 matrixorbital_bus_cost_ns(struct matrixorbital_bus *bus, u32 len)
+{
+	return div_u64((2 + 9 * (1 + (u64)len)) * NSEC_PER_SEC, bus->freq);
+}
+
+/* Drop the slots that fell out of the window. Called with bus->lock held. */
+static void matrixorbital_bus_advance(struct matrixorbital_bus *bus)
+{
+	u64 slot = div_u64(ktime_get_ns(), MATRIXORBITAL_BUS_SLOT_MS * NSEC_PER_MSEC);
+	u64 i;
+
+	if (slot - bus->slot >= MATRIXORBITAL_BUS_SLOTS) {
+		memset(bus->slot_ns, 0, sizeof(bus->slot_ns));
+	} else {
+		for (i = bus->slot + 1; i <= slot; i++)
+			memset(bus->slot_ns[i % MATRIXORBITAL_BUS_SLOTS], 0,
+			       sizeof(bus->slot_ns[0]));
+	}
+	bus->slot = slot;
+}
+
+static void matrixorbital_bus_account(struct matrixorbital_bus *bus,
+				      enum matrixorbital_bus_class class, u64 ns)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bus->lock, flags);
+	matrixorbital_bus_advance(bus);
+	bus->slot_ns[bus->slot % MATRIXORBITAL_BUS_SLOTS][class] += ns;
+	bus->total_ns[class] += ns;
+	spin_unlock_irqrestore(&bus->lock, flags);
+}
+
+/* Bus time used by a traffic class over the last window, in nanoseconds */
+static u64 matrixorbital_bus_window_ns(struct matrixorbital_bus *bus,
+				       enum matrixorbital_bus_class class)
+{
+	unsigned long flags;
+	u64 ns = 0;
+	int i;
+
+	spin_lock_irqsave(&bus->lock, flags);
+	matrixorbital_bus_advance(bus);
+	for (i = 0; i < MATRIXORBITAL_BUS_SLOTS; i++)
+		ns += bus->slot_ns[i][class];
+	spin_unlock_irqrestore(&bus->lock, flags);
+
+	return ns;
+}
+
+static u32 matrixorbital_bus_utilization(struct matrixorbital_bus *bus,
+					 enum matrixorbital_bus_class class)
+{
+	return div64_u64(matrixorbital_bus_window_ns(bus, class) * 1000,
+			 MATRIXORBITAL_BUS_WINDOW_NS);
+}
+
+/* Fold a successful transfer of len bytes that took ns into the model */
+static void matrixorbital_cost_sample(struct matrixorbital_par *par, u32 len, u64 ns)
+{
+	struct matrixorbital_cost *cost = &par->cost;
+	s64 ex, ey, exx, exy, var, cov, slope;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cost->lock, flags);
+	cost->n -= cost->n >> MATRIXORBITAL_COST_DECAY_SHIFT;
+	cost->sx -= cost->sx >> MATRIXORBITAL_COST_DECAY_SHIFT;
+	cost->sy -= cost->sy >> MATRIXORBITAL_COST_DECAY_SHIFT;
+	cost->sxx -= cost->sxx >> MATRIXORBITAL_COST_DECAY_SHIFT;
+	cost->sxy -= cost->sxy >> MATRIXORBITAL_COST_DECAY_SHIFT;
+	cost->n += 1 << MATRIXORBITAL_COST_WEIGHT_SHIFT;
+	cost->sx += (u64)len << MATRIXORBITAL_COST_WEIGHT_SHIFT;
+	cost->sy += ns << MATRIXORBITAL_COST_WEIGHT_SHIFT;
+	cost->sxx += (u64)len * len << MATRIXORBITAL_COST_WEIGHT_SHIFT;
+	cost->sxy += (u64)len * ns << MATRIXORBITAL_COST_WEIGHT_SHIFT;
+	cost->samples++;
+
+	/* Means with x in 1/256 bytes, then slope in ps per byte */
+	ex = div64_u64(cost->sx << 8, cost->n);
+	ey = div64_u64(cost->sy, cost->n);
+	exx = div64_u64(cost->sxx << 8, cost->n);
+	exy = div64_u64(cost->sxy, cost->n) << 8;
+	var = exx - div_s64(ex * ex, 256);
+	cov = exy - ex * ey;
+
+	/* Lengths must vary before the two coefficients can be told apart */
+	if (cost->samples >= MATRIXORBITAL_COST_MIN_SAMPLES && var >= 256) {
+		slope = max_t(s64, div64_s64(cov * 1000, var), 0);
+		cost->byte_ps = slope;
+		cost->header_ns = max_t(s64, ey - div_s64(slope * ex, 256 * 1000), 0);
+		cost->valid = true;
+	}
+	spin_unlock_irqrestore(&cost->lock, flags);
+}
+
+static void matrixorbital_cost_reset(struct matrixorbital_par *par)
+{
+	struct matrixorbital_cost *cost = &par->cost;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cost->lock, flags);
+	memset(&cost->n, 0, sizeof(*cost) - offsetof(struct matrixorbital_cost, n));
+	spin_unlock_irqrestore(&cost->lock, flags);
+}
+
+/* Expected time of a transfer: learned once calibrated, from the bus clock until then */
+static u64 matrixorbital_cost_ns(struct matrixorbital_par *par, u32 len)
+{
+	struct matrixorbital_cost *cost = &par->cost;
+	unsigned long flags;
+	u64 ns;
+
+	spin_lock_irqsave(&cost->lock, flags);
+	if (cost->valid)
+		ns = cost->header_ns + div_u64((u64)len * cost->byte_ps, 1000);
+	else
+		ns = matrixorbital_bus_cost_ns(par->bus, len);
+	spin_unlock_irqrestore(&cost->lock, flags);
+
+	return ns;
+}
+
+/* Longest transfer expected to fit in ns */
+static u32 matrixorbital_cost_bytes(struct matrixorbital_par *par, u64 ns)
+{
+	struct matrixorbital_cost *cost = &par->cost;
+	unsigned long flags;
+	u64 len;
+
+	spin_lock_irqsave(&cost->lock, flags);
+	if (cost->valid)
+		len = cost->byte_ps && ns > cost->header_ns ?
+		      div64_u64((ns - cost->header_ns) * 1000, cost->byte_ps) : U32_MAX;
+	else
+		len = div_u64(div_u64(ns * par->bus->freq, NSEC_PER_SEC), 9);
+	spin_unlock_irqrestore(&cost->lock, flags);
+
+	return min_t(u64, len, U32_MAX);
+}
+
+/*
+ * Display updates may only use bus_budget percent of the window, the rest
+ * stays reserved for key polls and LED writes.
+ */
+static bool matrixorbital_bus_admit(struct matrixorbital_par *par, u32 len)
+{
+	u64 budget = div_u64(MATRIXORBITAL_BUS_WINDOW_NS * min(bus_budget, 100U), 100);
+
+	return matrixorbital_bus_window_ns(par->bus, MATRIXORBITAL_BUS_DISPLAY) +
+	       matrixorbital_cost_ns(par, len) <= budget;
+}
+
+static enum matrixorbital_bus_class matrixorbital_cmd_class(const u8 *buf, u32 len)
+{
+	if (len >= 2 && buf[0] == 0xFE &&
+	    (buf[1] == MATRIXORBITAL_DRAW_BITMAP_DIRECTLY ||
+	     buf[1] == MATRIXORBITAL_CLEAR_SCREEN))
+		return MATRIXORBITAL_BUS_DISPLAY;
+
+	return MATRIXORBITAL_BUS_CONTROL;
+}
+
+static void matrixorbital_capture(struct matrixorbital_par *par, u16 type, u16 op,
+				  const struct matrixorbital_rect *rect,
+				  const void *payload, u32 len)
+{
+	struct matrixorbital_capture_record rec = {
+		.type = type,
+		.op = op,
+		.len = len,
+	};
+	unsigned long flags;
+
+	if (!READ_ONCE(par->capturing) || !(READ_ONCE(par->capture_mask) & type))
+		return;
+
+	rec.time_ns = ktime_get_ns();
+	if (rect) {
+		rec.x = rect->x;
+		rec.y = rect->y;
+		rec.width = rect->width;
+		rec.height = rect->height;
+	}
+
+	spin_lock_irqsave(&par->capture_lock, flags);
+	if (par->capturing) {
+		if (kfifo_avail(&par->capture) < sizeof(rec) + len) {
+			par->capture_dropped++;
+		} else {
+			kfifo_in(&par->capture, &rec, sizeof(rec));
+			kfifo_in(&par->capture, payload, len);
+		}
+	}
+	spin_unlock_irqrestore(&par->capture_lock, flags);
+
+	wake_up_interruptible(&par->capture_wait);
+}
+
+/*
+ * After absent_nacks NACKs in a row the panel is taken for unplugged or
+ * powered off: controller traffic stops and the presence probe takes over.
+ */
+static void matrixorbital_presence_account(struct matrixorbital_par *par, int ret)
+{
+	u32 limit = READ_ONCE(absent_nacks);
+	unsigned long flags;
+
+	if (ret != -ENXIO && ret != -EREMOTEIO) {
+		if (ret >= 0)
+			par->nacks = 0;
+		return;
+	}
+	/* Past the I/O thread on removal, nothing probes anymore */
+	if (!limit || ++par->nacks < limit || par->absent || !par->worker)
+		return;
+
+	WRITE_ONCE(par->absent, true);
+	par->presence_ms = MATRIXORBITAL_PRESENCE_MIN_MS;
+	dev_warn(&par->client->dev, "Panel not answering, taking it for absent\n");
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.absent_events++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+	matrixorbital_mod_delayed_work(par, &par->presence_work,
+				       msecs_to_jiffies(par->presence_ms));
+}
+
+/*
+ * One message, with the adapter locked for just this transfer so other
+ * devices on the bus get their turn in between. Returns the length or an
+ * error and how long the adapter was held.
+ */
+static int matrixorbital_xfer(struct matrixorbital_par *par, u8 *buf, u32 len,
+			      bool read, u64 *held)
+{
+	struct i2c_client *client = par->client;
+	struct i2c_msg msg = {
+		.addr	= client->addr,
+		.flags	= (client->flags & I2C_M_TEN) | (read ? I2C_M_RD : 0),
+		.len	= len,
+		.buf	= buf,
+	};
+	ktime_t start = ktime_get(), locked;
+	unsigned long flags;
+	u64 wait;
+	int ret;
+
+	i2c_lock_bus(client->adapter, I2C_LOCK_SEGMENT);
+	locked = ktime_get();
+	ret = __i2c_transfer(client->adapter, &msg, 1);
+	*held = ktime_to_ns(ktime_sub(ktime_get(), locked));
+	i2c_unlock_bus(client->adapter, I2C_LOCK_SEGMENT);
+	matrixorbital_presence_account(par, ret);
+
+	wait = ktime_to_ns(ktime_sub(locked, start));
+	matrixorbital_hist_add(par, MATRIXORBITAL_HIST_BUS_WAIT, ktime_sub_ns(ktime_get(), wait));
+	matrixorbital_hist_add(par, MATRIXORBITAL_HIST_BUS_HOLD, ktime_sub_ns(ktime_get(), *held));
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.hold_max_ns = max(par->stats.hold_max_ns, *held);
+	par->stats.wait_max_ns = max(par->stats.wait_max_ns, wait);
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	if (ret == 1)
+		return len;
+	return ret < 0 ? ret : -EIO;
+}
+
+/*
+ * Send one piece of a command. Only a piece whose address wasn't
+ * acknowledged, which the controller never saw any of, is resent, up to
+ * xfer_retries times. Resending one it took part of would feed bytes into
+ * the middle of the command.
+ */
+static int matrixorbital_send_chunk(struct matrixorbital_par *par, u8 opcode,
+				    enum matrixorbital_bus_class class, const u8 *buf, u32 len,
+				    u64 *held)
+{
+	struct i2c_client *client = par->client;
+	u32 retries = READ_ONCE(xfer_retries);
+	unsigned long flags;
 	int ret;
 
-	ret = i2c_master_send(client, buf, len);
-	if (ret != len) {
-		dev_err(&client->dev, "Couldn't send I2C command 0x%x 0x%x (len=%d): %d\n", buf[1], buf[2], len, ret);
+	for (;;) {
+		trace_matrixorbital_cmd_submit(client, opcode, len, false);
+		ret = matrixorbital_xfer(par, (u8 *)buf, len, false, held);
+		trace_matrixorbital_cmd_complete(client, opcode, len, false, *held, ret);
+		matrixorbital_stats_xfer(par, 0, ret == len);
+		matrixorbital_bus_account(par->bus, class, *held);
+		if (ret == len) {
+			matrixorbital_cost_sample(par, len, *held);
+			return 0;
+		}
+		if (ret != -ENXIO || !retries--)
+			return ret < 0 ? ret : -EIO;
+
+		spin_lock_irqsave(&par->stats.lock, flags);
+		par->stats.xfer_retries++;
+		spin_unlock_irqrestore(&par->stats.lock, flags);
+	}
+}
+
+/*
+ * Clamp a chunk size, 0 for whole commands, to the longest write the
+ * adapter takes in one message
+ */
+static u32 matrixorbital_chunk_max(struct matrixorbital_par *par, u32 chunk)
+{
+	const struct i2c_adapter_quirks *quirks = par->client->adapter->quirks;
+	u32 max = quirks ? quirks->max_write_len : 0;
+
+	if (max && (!chunk || chunk > max))
+		return max;
+	return chunk;
+}
+
+/*
+ * Feed the controller the filler it still needs after a broken command,
+ * e.g. the rest of a bitmap, so it parses commands again. Left over filler
+ * may draw text, so the next upload is a full frame. Returns whether the
+ * controller is back in sync; what didn't go out stays owed.
+ */
+static bool matrixorbital_drain(struct matrixorbital_par *par)
+{
+	u32 gap = max(READ_ONCE(par->chunk_gap_us), 1000U);
+	u32 chunk = matrixorbital_chunk_max(par, READ_ONCE(par->chunk_size));
+	u32 delay = READ_ONCE(retry_ms);
+	u8 filler[32] = { };
+	u64 held;
+	u32 n;
+
+	chunk = min_t(u32, chunk ? chunk : sizeof(filler), sizeof(filler));
+	while (par->drain_owed) {
+		n = min(par->drain_owed, chunk);
+		if (matrixorbital_send_chunk(par, 0, MATRIXORBITAL_BUS_DISPLAY, filler, n, &held))
+			return false;
+		par->drain_owed -= n;
+		usleep_range(gap, gap + gap / 4);
+	}
+
+	atomic_set(&par->shadow_stale, 1);
+	if (delay)
+		matrixorbital_queue_delayed_work(par, &par->flush_work, msecs_to_jiffies(delay));
+
+	return true;
+}
+
+/*
+ * Commands longer than chunk_size, or than fits in max_hold_us, go out in
+ * pieces, so the controller can keep up with its input and other devices
+ * on the adapter aren't locked out for a whole frame. The controller
+ * parses the pieces as one continuous stream. Pieces are chunk_gap_us
+ * apart, and pieces cut for the hold time at least as far apart as keeps
+ * the display within bus_budget. A command that broke off after the
+ * controller may have taken some of it is finished with filler before
+ * anything else is sent.
+ */
+static int matrixorbital_write_array(struct matrixorbital_par *par, u8 *buf, u32 len)
+{
+	enum matrixorbital_bus_class class = matrixorbital_cmd_class(buf, len);
+	u32 chunk = matrixorbital_chunk_max(par, READ_ONCE(par->chunk_size));
+	u32 gap = READ_ONCE(par->chunk_gap_us);
+	u32 hold = READ_ONCE(par->max_hold_us);
+	u32 budget = clamp(READ_ONCE(bus_budget), 1U, 100U);
+	u32 off, n, fit, share_us;
+	bool shared = false;
+	u64 held = 0;
+	int ret = 0;
+
+	if (READ_ONCE(par->absent))
+		return -1;
+	if (par->drain_owed && !matrixorbital_drain(par))
+		return -1;
+
+	matrixorbital_capture(par, MATRIXORBITAL_CAPTURE_COMMAND, 0, NULL, buf, len);
+	matrixorbital_stats_cmd(par, buf, len);
+
+	if (!chunk)
+		chunk = len;
+	if (hold) {
+		fit = max(matrixorbital_cost_bytes(par, (u64)hold * NSEC_PER_USEC), 8U);
+		if (fit < chunk) {
+			chunk = fit;
+			shared = true;
+		}
+	}
+
+	for (off = 0; off < len; off += n) {
+		n = min(len - off, chunk);
+		if (off) {
+			share_us = shared ? div_u64(held * (100 - budget),
+						    budget * NSEC_PER_USEC) : 0;
+			if (max(gap, share_us))
+				usleep_range(max(gap, share_us), max(gap, share_us) * 5 / 4 + 1);
+		}
+		ret = matrixorbital_send_chunk(par, buf[1], class, buf + off, n, &held);
+		if (ret)
+			break;
+	}
+	if (ret) {
+		dev_err(&par->client->dev, "Couldn't send I2C command 0x%x 0x%x (len=%d, offset %u): %d\n",
+			buf[1], buf[2], len, off, ret);
+		if (off || ret != -ENXIO) {
+			par->drain_owed = len - off;
+			matrixorbital_drain(par);
+		}
 		return -1;
 	}
 
 	return 0;
 }
 
-static int matrixorbital_write_cmd(struct i2c_client *client, u8 cmd)
-{
-	u8 data[2];
-	data[0] = 0xFE;
-	data[1] = cmd;
-	return matrixorbital_write_array(client, data, sizeof(data));
-}
+static int matrixorbital_write_cmd(struct matrixorbital_par *par, u8 cmd)
+{
+	u8 data[2];
+	data[0] = 0xFE;
+	data[1] = cmd;
+	return matrixorbital_write_array(par, data, sizeof(data));
+}
+
+static int matrixorbital_write_param(struct matrixorbital_par *par, u8 cmd, u8 value)
+{
+	u8 data[3];
+	data[0] = 0xFE;
+	data[1] = cmd;
+	data[2] = value;
+	return matrixorbital_write_array(par, data, sizeof(data));
+}
+
+static int matrixorbital_read_param(struct matrixorbital_par *par, u8 cmd)
+{
+	struct i2c_client *client = par->client;
+	u64 ns;
+	u8 data;
+
+	int ret;
+
+	if (READ_ONCE(par->absent))
+		return -1;
+	matrixorbital_write_cmd(par, cmd);
+	msleep(5);
+	trace_matrixorbital_cmd_submit(client, cmd, sizeof(data), true);
+	ret = matrixorbital_xfer(par, &data, sizeof(data), true, &ns);
+	trace_matrixorbital_cmd_complete(client, cmd, sizeof(data), true, ns, ret);
+	matrixorbital_stats_xfer(par, ret == 1 ? 1 : 0, ret == 1);
+	matrixorbital_bus_account(par->bus, MATRIXORBITAL_BUS_CONTROL, ns);
+	if (ret == 1)
+		matrixorbital_cost_sample(par, sizeof(data), ns);
+	if (ret == 1)
+		return data;
+	else {
+		dev_err(&client->dev, "Couldn't recv 0x%x I2C command.\n", cmd);
+		return -1;
+	}
+}
+
+/*
+ * After an overrun the controller may have lost bytes and still be waiting
+ * for bitmap data, so it would swallow the next commands. Reading back the
+ * module type tells whether it is in sync again; feeding it as many
+ * filler bytes as the command had brings it back. The filler may draw
+ * text, the caller has to upload a full frame afterwards.
+ */
+static int matrixorbital_check_sync(struct matrixorbital_par *par, u32 len)
+{
+	if (par->module_type <= 0 ||
+	    matrixorbital_read_param(par, MATRIXORBITAL_READ_MODULE_TYPE) == par->module_type)
+		return 0;
+
+	par->sync_errors++;
+	dev_err(&par->client->dev, "Controller out of sync, resynchronizing\n");
+
+	par->drain_owed = max(par->drain_owed, len);
+	matrixorbital_drain(par);
+
+	return -EIO;
+}
+
+static const char *matrixorbital_damage_ops[] = {
+	[MATRIXORBITAL_DAMAGE_WRITE]		= "write",
+	[MATRIXORBITAL_DAMAGE_FILLRECT]		= "fillrect",
+	[MATRIXORBITAL_DAMAGE_COPYAREA]		= "copyarea",
+	[MATRIXORBITAL_DAMAGE_IMAGEBLIT]	= "imageblit",
+	[MATRIXORBITAL_DAMAGE_MMAP]		= "mmap",
+	[MATRIXORBITAL_DAMAGE_IOCTL]		= "ioctl",
+	[MATRIXORBITAL_DAMAGE_PRESENT]		= "present",
+	[MATRIXORBITAL_DAMAGE_RING]		= "ring",
+};
+
+/* Record the framebuffer lines covering the damage */
+static void matrixorbitalfb_capture_damage(struct matrixorbital_par *par, u16 op,
+					   const struct matrixorbital_rect *rect)
+{
+	u32 line_length = par->info->fix.line_length;
+	struct matrixorbital_rect clip = *rect;
+
+	matrixorbital_rect_clip(&clip, par->width, par->height);
+	if (matrixorbital_rect_empty(&clip))
+		return;
+
+	matrixorbital_capture(par, MATRIXORBITAL_CAPTURE_DAMAGE, op, &clip,
+			      par->info->screen_base + clip.y * line_length,
+			      clip.height * line_length);
+}
+
+/* Turn the dirty tiles into a region, see matrixorbital_tiles_collect */
+static void matrixorbitalfb_collect_tiles(struct matrixorbital_par *par)
+{
+	lockdep_assert_held(&par->damage_lock);
+	matrixorbital_tiles_collect(&par->pending, par->width, par->height, par->deadline_ms);
+}
+
+/*
+ * Remember what changed, when the oldest not yet uploaded change was made
+ * and when it's due. Damage with the default deadline, which is nearly all
+ * of it, only sets bits in the tiles and never takes a lock, so the drawing
+ * paths can report damage from any context without contending with each
+ * other or the I/O thread. Damage with a deadline of its own and the parts
+ * covering priority zones become regions under lock, damage_lock for the
+ * device's own pending damage.
+ */
+static void matrixorbitalfb_accumulate(struct matrixorbital_par *par,
+				       struct matrixorbital_pending *pending, spinlock_t *lock,
+				       const struct matrixorbital_rect *rect, u32 deadline_us)
+{
+	struct matrixorbital_zone zones[MATRIXORBITAL_MAX_ZONES];
+	ktime_t now = ktime_get(), deadline, due;
+	struct matrixorbital_rect part;
+	bool urgent = deadline_us;
+	unsigned long flags;
+	u32 i, n, seq;
+
+	do {
+		seq = read_seqbegin(&par->zones_lock);
+		n = par->nr_zones;
+		memcpy(zones, par->zones, n * sizeof(*zones));
+	} while (read_seqretry(&par->zones_lock, seq));
+
+	for (i = 0; i < n && !urgent; i++) {
+		part = *rect;
+		matrixorbital_rect_intersect(&part, &zones[i].rect);
+		urgent = !matrixorbital_rect_empty(&part);
+	}
+
+	if (!urgent) {
+		matrixorbital_tiles_time(pending, now);
+		matrixorbital_tiles_mark(pending, rect);
+		return;
+	}
+
+	deadline = ktime_add_us(now, deadline_us ?: (u64)par->deadline_ms * USEC_PER_MSEC);
+	spin_lock_irqsave(lock, flags);
+	for (i = 0; i < n; i++) {
+		part = *rect;
+		matrixorbital_rect_intersect(&part, &zones[i].rect);
+		due = ktime_add_ms(now, zones[i].deadline_ms);
+		matrixorbital_pending_add(pending, &part, now,
+					  ktime_before(due, deadline) ? due : deadline, false);
+	}
+	matrixorbital_pending_add(pending, rect, now, deadline, false);
+	spin_unlock_irqrestore(lock, flags);
+}
+
+/* Trace and capture damage the drawing paths report, then accumulate it */
+static void matrixorbitalfb_damage(struct matrixorbital_par *par, u16 op,
+				   u32 x, u32 y, u32 width, u32 height, u32 deadline_us)
+{
+	struct matrixorbital_rect rect = { x, y, width, height };
+
+	trace_matrixorbital_damage(par->client, matrixorbital_damage_ops[op],
+				   x, y, width, height);
+	matrixorbitalfb_capture_damage(par, op, &rect);
+	matrixorbital_rect_clip(&rect, par->width, par->height);
+	if (!matrixorbital_rect_empty(&rect))
+		matrixorbitalfb_accumulate(par, &par->pending, &par->damage_lock, &rect,
+					   deadline_us);
+
+	smp_mb__before_atomic();
+	atomic_inc(&par->damage_seq);
+}
+
+/* Put back damage that couldn't be uploaded */
+static void matrixorbitalfb_requeue(struct matrixorbital_par *par,
+				    const struct matrixorbital_region *region)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->damage_lock, flags);
+	matrixorbital_pending_add(&par->pending, &region->rect, region->time, region->deadline,
+				  region->full);
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+}
+
+/*
+ * Take the region due first. Without a valid shadow the whole screen goes
+ * out as a full region, due when the most urgent damage is. It's uploaded
+ * in bands like any other, so the shadow takes on video memory right away:
+ * regions getting in between then pack sane edges, and the full region
+ * covers whatever they trim.
+ */
+static void matrixorbitalfb_next_region(struct matrixorbital_par *par,
+					struct matrixorbital_region *region)
+{
+	struct matrixorbital_region *r;
+	u32 i;
+
+	lockdep_assert_held(&par->damage_lock);
+	memset(region, 0, sizeof(*region));
+	matrixorbitalfb_collect_tiles(par);
+
+	if (!par->shadow_valid) {
+		region->rect.width = par->width;
+		region->rect.height = par->height;
+		/* Due like default damage at the latest, so other damage can't starve it */
+		region->deadline = ktime_add_ms(ktime_get(), par->deadline_ms);
+		region->full = true;
+		for (i = 0; i < par->pending.nr_regions; i++) {
+			r = &par->pending.regions[i];
+			if (!region->time || ktime_before(r->time, region->time))
+				region->time = r->time;
+			if (ktime_before(r->deadline, region->deadline))
+				region->deadline = r->deadline;
+		}
+		par->pending.nr_regions = 0;
+		memcpy(par->shadow, par->info->screen_base,
+		       par->info->fix.line_length * par->height);
+		par->shadow_valid = true;
+		par->shadow_partial = true;
+		return;
+	}
+
+	matrixorbital_pending_take(&par->pending, region);
+}
+
+/* Count an upload that reached the panel after its deadline */
+static void matrixorbitalfb_check_deadline(struct matrixorbital_par *par,
+					   const struct matrixorbital_region *region)
+{
+	s64 late = ktime_to_ns(ktime_sub(ktime_get(), region->deadline));
+	unsigned long flags;
+
+	if (!region->deadline || region->deadline == KTIME_MAX || late <= 0)
+		return;
+
+	trace_matrixorbital_deadline_miss(par->client, region->rect.x, region->rect.y,
+					  region->rect.width, region->rect.height, late);
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.deadline_misses++;
+	par->stats.deadline_late_max_ns = max_t(u64, par->stats.deadline_late_max_ns, late);
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+}
+
+/* Lines of r that go out within one max_hold_us piece, all of them without a limit */
+static u32 matrixorbitalfb_band_lines(struct matrixorbital_par *par,
+				      const struct matrixorbital_rect *r, bool aligned)
+{
+	struct matrixorbital_rect line = { r->x, 0, r->width, 1 };
+	u32 hold = READ_ONCE(par->max_hold_us);
+	u32 fit, per_line;
+
+	if (!hold)
+		return r->height;
+	fit = matrixorbital_cost_bytes(par, (u64)hold * NSEC_PER_USEC);
+	per_line = aligned ? matrixorbital_rect_bytes_aligned(&line) : DIV_ROUND_UP(r->width, 8);
+
+	return clamp_t(u32, fit > 6 ? (fit - 6) / per_line : 1, 1, r->height);
+}
+
+/*
+ * Upload the most urgent damage, returns false if it had to be put back.
+ * Damage that takes longer than one max_hold_us piece goes out one band of
+ * lines per call, with the rest put back, so damage due sooner that came
+ * up meanwhile goes first instead of waiting for the whole upload.
+ */
+static bool matrixorbitalfb_update_display(struct matrixorbital_par *par)
+{
+	u8 *vmem = par->info->screen_base;
+	u32 line_length = par->info->fix.line_length;
+	struct matrixorbital_region region, rest;
+	struct matrixorbital_rect damage, rect;
+	ktime_t start = ktime_get();
+	unsigned long flags;
+	u32 y0, y1, seq, i;
+	bool aligned, more, ok = false;
+	int len;
+	u8 *data;
+
+	/* Damage stays pending until the panel is back */
+	if (READ_ONCE(par->absent))
+		return false;
+
+	mutex_lock(&par->lock);
+
+	/* Filler sent to resynchronize the controller may have drawn on it */
+	if (atomic_xchg(&par->shadow_stale, 0))
+		par->shadow_valid = false;
+
+	seq = atomic_read(&par->damage_seq);
+	spin_lock_irqsave(&par->damage_lock, flags);
+	matrixorbitalfb_next_region(par, &region);
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	damage = region.rect;
+	matrixorbital_rect_clip(&damage, par->width, par->height);
+
+	/* Trim the lines that didn't change */
+	y0 = damage.y;
+	y1 = damage.y + damage.height;
+	if (!region.full)
+		matrixorbital_pack_impl->trim(par->shadow, vmem, line_length, &y0, &y1);
+
+	if (y0 == y1) {
+		spin_lock_irqsave(&par->stats.lock, flags);
+		par->stats.frames_skipped++;
+		spin_unlock_irqrestore(&par->stats.lock, flags);
+		trace_matrixorbital_flush(par->client, 0, 0, true);
+		goto done;
+	}
+
+	/*
+	 * Ship the window bit by bit, or rounded out to whole bytes, which
+	 * packs faster and fills in the edges from the shadow, when that
+	 * takes no longer on the bus
+	 */
+	rect.x = damage.x;
+	rect.y = y0;
+	rect.width = damage.width;
+	rect.height = y1 - y0;
+	aligned = matrixorbital_cost_ns(par, 6 + matrixorbital_rect_bytes_aligned(&rect)) <=
+		  matrixorbital_cost_ns(par, 6 + matrixorbital_rect_bytes(&rect));
+
+	memset(&rest, 0, sizeof(rest));
+	rect.height = matrixorbitalfb_band_lines(par, &rect, aligned);
+	if (rect.height < y1 - y0) {
+		rest = region;
+		rest.rect.x = damage.x;
+		rest.rect.y = y0 + rect.height;
+		rest.rect.width = damage.width;
+		rest.rect.height = y1 - rest.rect.y;
+	}
+
+	if (aligned)
+		len = 6 + matrixorbital_rect_bytes_aligned(&rect);
+	else
+		len = 6 + matrixorbital_rect_bytes(&rect);
+
+	/* Over budget: keep the damage and retry once the window has moved on */
+	if (!matrixorbital_bus_admit(par, len)) {
+		matrixorbitalfb_requeue(par, &region);
+		par->throttled = true;
+		spin_lock_irqsave(&par->stats.lock, flags);
+		par->stats.frames_throttled++;
+		spin_unlock_irqrestore(&par->stats.lock, flags);
+		matrixorbital_queue_delayed_work(par, &par->flush_work,
+						 msecs_to_jiffies(MATRIXORBITAL_BUS_SLOT_MS));
+		goto unlock;
+	}
+	par->throttled = false;
+	if (!matrixorbital_rect_empty(&rest.rect))
+		matrixorbitalfb_requeue(par, &rest);
+
+	data = kzalloc(len, GFP_KERNEL);
+	if (!data) {
+		matrixorbitalfb_requeue(par, &region);
+		goto unlock;
+	}
+
+	matrixorbital_copy_rect(par->shadow, vmem, line_length, &rect);
+	matrixorbital_encode_bitmap(data, par->shadow, line_length, &rect, aligned,
+				    matrixorbital_pack_impl->pack);
+
+	trace_matrixorbital_flush(par->client, 1, len, false);
+	if (matrixorbital_write_array(par, data, len) ||
+	    (READ_ONCE(par->sync_check) && matrixorbital_check_sync(par, len))) {
+		/*
+		 * The controller may have taken part of the bitmap, force a full
+		 * upload and don't wait for new damage to make it
+		 */
+		par->shadow_valid = false;
+		matrixorbitalfb_requeue(par, &region);
+		kfree(data);
+		if (READ_ONCE(retry_ms) && !READ_ONCE(par->absent)) {
+			spin_lock_irqsave(&par->stats.lock, flags);
+			par->stats.flush_retries++;
+			spin_unlock_irqrestore(&par->stats.lock, flags);
+			matrixorbital_queue_delayed_work(par, &par->flush_work,
+							 msecs_to_jiffies(READ_ONCE(retry_ms)));
+		}
+		goto unlock;
+	}
+	kfree(data);
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.rects_flushed++;
+	if (!aligned)
+		par->stats.rects_unaligned++;
+	if (matrixorbital_rect_empty(&rest.rect))
+		par->stats.frames_flushed++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	matrixorbital_hist_add(par, MATRIXORBITAL_HIST_FLUSH, start);
+	if (matrixorbital_rect_empty(&rest.rect)) {
+		if (region.time)
+			matrixorbital_hist_add(par, MATRIXORBITAL_HIST_DAMAGE, region.time);
+		matrixorbitalfb_check_deadline(par, &region);
+	}
+done:
+	ok = true;
+	/* Everything is out only once no region and no dirty tile is left */
+	spin_lock_irqsave(&par->damage_lock, flags);
+	more = par->pending.nr_regions || matrixorbital_tiles_dirty(&par->pending);
+	par->shadow_partial = false;
+	for (i = 0; i < par->pending.nr_regions; i++)
+		par->shadow_partial |= par->pending.regions[i].full;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	if (more) {
+		matrixorbital_mod_delayed_work(par, &par->flush_work, 0);
+	} else {
+		WRITE_ONCE(par->flushed_seq, seq);
+		wake_up_all(&par->flush_wait);
+	}
+unlock:
+	mutex_unlock(&par->lock);
+
+	return ok;
+}
+
+static void matrixorbitalfb_flush_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par,
+						     flush_work.work);
+
+	/* Damage reported from here on has to kick again */
+	atomic_set(&par->kick_pending, 0);
+	smp_mb__after_atomic();
+	matrixorbitalfb_update_display(par);
+}
+
+/* One message through the adapter's atomic transfer, taking the bus lock if it's free */
+static int matrixorbital_xfer_atomic(struct matrixorbital_par *par, u8 *buf, u32 len,
+				     bool force)
+{
+	struct i2c_adapter *adapter = par->client->adapter;
+	struct i2c_msg msg = {
+		.addr	= par->client->addr,
+		.flags	= par->client->flags & I2C_M_TEN,
+		.len	= len,
+		.buf	= buf,
+	};
+	bool locked;
+	int ret;
+
+	locked = i2c_trylock_bus(adapter, I2C_LOCK_SEGMENT);
+	if (!locked && !force)
+		return -EBUSY;
+	ret = adapter->algo->master_xfer_atomic(adapter, &msg, 1);
+	if (locked)
+		i2c_unlock_bus(adapter, I2C_LOCK_SEGMENT);
+
+	if (ret == 1)
+		return 0;
+	return ret < 0 ? ret : -EIO;
+}
+
+/* Same pacing as matrixorbital_write_array, busy waiting */
+static int matrixorbital_send_atomic(struct matrixorbital_par *par, u8 *buf, u32 len,
+				     bool force)
+{
+	u32 chunk = matrixorbital_chunk_max(par, READ_ONCE(par->chunk_size)) ?: len;
+	u32 gap = READ_ONCE(par->chunk_gap_us);
+	u32 off, n;
+	int ret = 0;
+
+	for (off = 0; off < len && !ret; off += n) {
+		n = min(len - off, chunk);
+		if (off && gap) {
+			mdelay(gap / 1000);
+			udelay(gap % 1000);
+		}
+		ret = matrixorbital_xfer_atomic(par, buf + off, n, force);
+	}
+
+	return ret;
+}
+
+/*
+ * Upload what changed on screen without sleeping, for oopses and panics
+ * when the I/O thread may never run again. Only the lines and bytes that
+ * differ from the shadow go out. During an oops the upload holds the lock
+ * like any other, and is left to the I/O thread if that's busy or we can't
+ * take a mutex here. Only the panic, with the other CPUs stopped, goes
+ * ahead without it: an upload the panic cut short is flushed out of the
+ * controller with filler first and the whole frame sent.
+ * Returns false if the I/O thread should do it instead.
+ */
+static bool matrixorbital_flush_atomic(struct matrixorbital_par *par, bool panic)
+{
+	u32 line_length = par->info->fix.line_length;
+	const u8 *vmem = par->info->screen_base;
+	u32 size = line_length * par->height;
+	u32 y0 = par->height, y1 = 0, b0 = line_length, b1 = 0;
+	bool interrupted = false;
+	u8 *data = par->panic_buf;
+	struct matrixorbital_rect rect;
+	const u8 *a, *b;
+	u32 y, i, bw, len;
+
+	if (!READ_ONCE(atomic_flush) || !par->client->adapter->algo->master_xfer_atomic ||
+	    READ_ONCE(par->absent))
+		return false;
+	if (panic)
+		interrupted = mutex_is_locked(&par->lock) || READ_ONCE(par->drain_owed);
+	else if (READ_ONCE(par->drain_owed) || !in_task() || !mutex_trylock(&par->lock))
+		return false;
+	if (atomic_xchg(&par->atomic_busy, 1)) {
+		if (!panic)
+			mutex_unlock(&par->lock);
+		return true;
+	}
+
+	if (interrupted) {
+		memset(data, 0, 6 + size);
+		matrixorbital_send_atomic(par, data, 6 + size, panic);
+		par->shadow_valid = false;
+	}
+
+	if (!par->shadow_valid || READ_ONCE(par->shadow_partial)) {
+		y0 = 0;
+		y1 = par->height;
+		b0 = 0;
+		b1 = line_length;
+	} else {
+		for (y = 0; y < par->height; y++) {
+			a = vmem + y * line_length;
+			b = par->shadow + y * line_length;
+			if (!memcmp(a, b, line_length))
+				continue;
+			y0 = min(y0, y);
+			y1 = y + 1;
+			for (i = 0; a[i] == b[i]; i++)
+				;
+			b0 = min(b0, i);
+			for (i = line_length; a[i - 1] == b[i - 1]; i--)
+				;
+			b1 = max(b1, i);
+		}
+		if (y0 >= y1)
+			goto out;
+	}
+
+	bw = b1 - b0;
+	memcpy(par->shadow + y0 * line_length, vmem + y0 * line_length,
+	       (y1 - y0) * line_length);
+	rect.x = b0 * 8;
+	rect.y = y0;
+	rect.width = bw * 8;
+	rect.height = y1 - y0;
+	len = matrixorbital_encode_bitmap(data, par->shadow, line_length, &rect, true,
+					  matrixorbital_pack_bytes);
+	par->shadow_valid = !matrixorbital_send_atomic(par, data, len, panic);
+	par->atomic_flushes++;
+out:
+	atomic_set(&par->atomic_busy, 0);
+	if (!panic)
+		mutex_unlock(&par->lock);
+	return true;
+}
+
+static int matrixorbital_panic(struct notifier_block *nb, unsigned long event, void *unused)
+{
+	struct matrixorbital_par *par = container_of(nb, struct matrixorbital_par, panic_nb);
+
+	matrixorbital_flush_atomic(par, true);
+
+	return NOTIFY_DONE;
+}
+
+/* Have the I/O thread upload the damage now, or do it right here during an oops */
+static void matrixorbitalfb_kick(struct matrixorbital_par *par)
+{
+	if (unlikely(oops_in_progress) && matrixorbital_flush_atomic(par, false))
+		return;
+
+	/* A kick the I/O thread hasn't picked up yet covers this one too */
+	if (atomic_xchg(&par->kick_pending, 1))
+		return;
+	matrixorbital_mod_delayed_work(par, &par->flush_work, 0);
+}
+
+static const u32 matrixorbital_chunk_sizes[] = { 0, 1024, 512, 256, 128, 64, 32, 16 };
+static const u32 matrixorbital_chunk_gaps[] = { 0, 50, 100, 200, 500, 1000, 2000, 5000 };
+
+#define MATRIXORBITAL_CALIBRATE_RUNS 3
+
+/* Next candidate chunk size from idx on that the adapter takes as it is */
+static u32 matrixorbital_calibrate_size(struct matrixorbital_par *par, u32 idx)
+{
+	while (idx < ARRAY_SIZE(matrixorbital_chunk_sizes) &&
+	       matrixorbital_chunk_max(par, matrixorbital_chunk_sizes[idx]) !=
+	       matrixorbital_chunk_sizes[idx])
+		idx++;
+
+	return idx;
+}
+
+/* Upload a full frame with the current pacing, returns the time it took */
+static s64 matrixorbital_calibrate_run(struct matrixorbital_par *par, u8 *data, u32 len)
+{
+	ktime_t start = ktime_get();
+	s64 ns;
+
+	if (matrixorbital_write_array(par, data, len))
+		return -EIO;
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (matrixorbital_check_sync(par, len))
+		return -EIO;
+
+	return ns;
+}
+
+/*
+ * For every chunk size the adapter takes, largest first, find the shortest
+ * gap at which full frames repeatedly arrive intact and keep the pair with
+ * the best throughput. Needs a controller that answers the module type
+ * query.
+ *
+ * Every run sends one test frame, the shadow copy so the panel doesn't
+ * change, with the candidate pacing, then puts the old pacing back and
+ * queues itself again. Key polls, GPO writes and flushes that came up in
+ * the meantime get their turn in between, with pacing known to work.
+ */
+static void matrixorbital_calibrate_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par,
+						     calibrate_work);
+	struct matrixorbital_calibration *cal = &par->cal;
+	struct matrixorbital_rect rect;
+	u32 line_length = par->info->fix.line_length;
+	u64 rate;
+	s64 ns;
+
+	if (!cal->data) {
+		if (par->module_type <= 0 ||
+		    matrixorbital_calibrate_size(par, 0) == ARRAY_SIZE(matrixorbital_chunk_sizes)) {
+			par->calibrate_result = -EOPNOTSUPP;
+			atomic_set(&par->calibrating, 0);
+			return;
+		}
+		cal->len = 6 + line_length * par->height;
+		cal->data = kmalloc(cal->len, GFP_KERNEL);
+		if (!cal->data) {
+			par->calibrate_result = -ENOMEM;
+			atomic_set(&par->calibrating, 0);
+			return;
+		}
+		cal->size_idx = matrixorbital_calibrate_size(par, 0);
+		cal->gap_idx = 0;
+		cal->run = 0;
+		cal->total_ns = 0;
+		cal->old_size = READ_ONCE(par->chunk_size);
+		cal->old_gap = READ_ONCE(par->chunk_gap_us);
+		cal->best_size = cal->old_size;
+		cal->best_gap = cal->old_gap;
+		cal->best_rate = 0;
+	}
+
+	mutex_lock(&par->lock);
+	rect.x = 0;
+	rect.y = 0;
+	rect.width = par->width;
+	rect.height = par->height;
+	matrixorbital_bitmap_header(cal->data, &rect);
+	matrixorbital_pack_lines(cal->data + 6, par->shadow, line_length, par->height);
+
+	WRITE_ONCE(par->chunk_size, matrixorbital_chunk_sizes[cal->size_idx]);
+	WRITE_ONCE(par->chunk_gap_us, matrixorbital_chunk_gaps[cal->gap_idx]);
+	ns = matrixorbital_calibrate_run(par, cal->data, cal->len);
+	WRITE_ONCE(par->chunk_size, cal->old_size);
+	WRITE_ONCE(par->chunk_gap_us, cal->old_gap);
+	/* The test frame may have left garbage behind */
+	if (ns < 0)
+		par->shadow_valid = false;
+	mutex_unlock(&par->lock);
+
+	if (ns < 0) {
+		/* Too fast, try the next longer gap */
+		cal->gap_idx++;
+		cal->run = 0;
+		cal->total_ns = 0;
+		matrixorbitalfb_kick(par);
+	} else {
+		cal->total_ns += ns;
+		cal->run++;
+	}
+	if (cal->run == MATRIXORBITAL_CALIBRATE_RUNS) {
+		rate = div64_u64((u64)cal->len * MATRIXORBITAL_CALIBRATE_RUNS * NSEC_PER_SEC,
+				 max_t(u64, cal->total_ns, 1));
+		if (rate > cal->best_rate) {
+			cal->best_rate = rate;
+			cal->best_size = matrixorbital_chunk_sizes[cal->size_idx];
+			cal->best_gap = matrixorbital_chunk_gaps[cal->gap_idx];
+		}
+		/* Longer gaps at this size would only be slower */
+		cal->gap_idx = ARRAY_SIZE(matrixorbital_chunk_gaps);
+		cal->run = 0;
+		cal->total_ns = 0;
+	}
+	if (cal->gap_idx == ARRAY_SIZE(matrixorbital_chunk_gaps)) {
+		cal->gap_idx = 0;
+		cal->size_idx = matrixorbital_calibrate_size(par, cal->size_idx + 1);
+	}
+	if (cal->size_idx < ARRAY_SIZE(matrixorbital_chunk_sizes)) {
+		matrixorbital_queue_work(par, &par->calibrate_work);
+		return;
+	}
+
+	WRITE_ONCE(par->chunk_size, cal->best_size);
+	WRITE_ONCE(par->chunk_gap_us, cal->best_gap);
+	par->calibrate_rate = cal->best_rate;
+	par->calibrate_result = cal->best_rate ? 0 : -EIO;
+	kfree(cal->data);
+	cal->data = NULL;
+	atomic_set(&par->calibrating, 0);
+
+	dev_info(&par->client->dev, "pacing: chunk_size %u chunk_gap_us %u, %llu bytes/s\n",
+		 cal->best_size, cal->best_gap, cal->best_rate);
+}
+
+/* Wake up when the first queued frame has to be taken, lock held */
+static void matrixorbitalfb_present_arm(struct matrixorbital_par *par)
+{
+	struct matrixorbital_frame *f;
+
+	f = list_first_entry_or_null(&par->frames, struct matrixorbital_frame, node);
+	if (f)
+		hrtimer_start(&par->present_timer, f->start, HRTIMER_MODE_ABS);
+}
+
+static enum hrtimer_restart matrixorbitalfb_present_timer(struct hrtimer *timer)
+{
+	struct matrixorbital_par *par = container_of(timer, struct matrixorbital_par,
+						     present_timer);
+
+	matrixorbital_queue_work(par, &par->present_work);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Tell the client what became of a frame, dropping the oldest news if nobody reads it */
+static void matrixorbitalfb_present_report(struct matrixorbital_par *par,
+					   const struct matrixorbital_frame *f,
+					   u32 result, ktime_t presented)
+{
+	struct matrixorbital_present_feedback done = {
+		.flags		= result,
+		.cookie		= f->cookie,
+		.target_ns	= ktime_to_ns(f->target),
+		.presented_ns	= ktime_to_ns(presented),
+	}, old;
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->present_lock, flags);
+	if (kfifo_avail(&par->present_done) < sizeof(done))
+		kfifo_out(&par->present_done, &old, sizeof(old));
+	kfifo_in(&par->present_done, &done, sizeof(done));
+	spin_unlock_irqrestore(&par->present_lock, flags);
+	wake_up_interruptible(&par->present_wait);
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	if (result & MATRIXORBITAL_PRESENT_DROPPED)
+		par->stats.frames_dropped++;
+	else
+		par->stats.frames_presented++;
+	if (result & MATRIXORBITAL_PRESENT_LATE)
+		par->stats.frames_late++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+}
+
+/* Is any damage due by t still waiting? */
+static bool matrixorbitalfb_pending_by(struct matrixorbital_par *par, ktime_t t)
+{
+	unsigned long flags;
+	bool pending = false;
+	u32 i;
+
+	spin_lock_irqsave(&par->damage_lock, flags);
+	matrixorbitalfb_collect_tiles(par);
+	for (i = 0; i < par->pending.nr_regions; i++)
+		if (!ktime_after(par->pending.regions[i].deadline, t))
+			pending = true;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	return pending;
+}
+
+/*
+ * Put the frames whose upload has to start now into video memory, skipping
+ * those a frame with a later target covers, and upload them right away,
+ * along with any other damage due by then.
+ */
+static void matrixorbitalfb_present_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par,
+						     present_work);
+	u32 line_length = par->info->fix.line_length;
+	struct matrixorbital_frame *f, *tmp, *later;
+	struct matrixorbital_rect rect, cover;
+	ktime_t now = ktime_get(), by = 0, done;
+	unsigned long flags;
+	bool covered, ok = true;
+	LIST_HEAD(due);
+	int i;
+
+	spin_lock_irqsave(&par->present_lock, flags);
+	par->nr_frames -= matrixorbital_frame_take(&par->frames, now, &due);
+	matrixorbitalfb_present_arm(par);
+	spin_unlock_irqrestore(&par->present_lock, flags);
+
+	list_for_each_entry_safe(f, tmp, &due, node) {
+		covered = false;
+		later = f;
+		list_for_each_entry_continue(later, &due, node) {
+			cover = f->rect;
+			matrixorbital_rect_intersect(&cover, &later->rect);
+			if (!memcmp(&cover, &f->rect, sizeof(cover)))
+				covered = true;
+		}
+		if (covered) {
+			list_del(&f->node);
+			matrixorbitalfb_present_report(par, f, MATRIXORBITAL_PRESENT_DROPPED, 0);
+			kfree(f);
+			continue;
+		}
+
+		rect = f->rect;
+		rect.y = 0;
+		matrixorbital_copy_rect(par->info->screen_base + f->rect.y * line_length,
+					f->data, line_length, &rect);
+		matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_PRESENT, f->rect.x, f->rect.y,
+				       f->rect.width, f->rect.height,
+				       max_t(s64, ktime_us_delta(f->target, now), 1));
+		if (ktime_after(f->target, by))
+			by = f->target;
+	}
+	if (list_empty(&due))
+		return;
+
+	for (i = 0; i <= MATRIXORBITAL_MAX_REGIONS * par->height && ok &&
+		    matrixorbitalfb_pending_by(par, by); i++)
+		ok = matrixorbitalfb_update_display(par);
+	ok = !matrixorbitalfb_pending_by(par, by);
+	done = ktime_get();
+
+	list_for_each_entry_safe(f, tmp, &due, node) {
+		list_del(&f->node);
+		if (!ok)
+			matrixorbitalfb_present_report(par, f, MATRIXORBITAL_PRESENT_FAILED, 0);
+		else
+			matrixorbitalfb_present_report(par, f, ktime_after(done, f->target) ?
+						       MATRIXORBITAL_PRESENT_LATE : 0, done);
+		kfree(f);
+	}
+}
+
+/*
+ * Queue a frame, to be taken the predicted upload time plus some slack for
+ * waking up and packing before its target
+ */
+static int matrixorbitalfb_present(struct matrixorbital_par *par,
+				   const struct matrixorbital_present *req)
+{
+	u32 line_length = par->info->fix.line_length;
+	struct matrixorbital_rect rect = { req->x, req->y, req->width, req->height };
+	struct matrixorbital_frame *f;
+	unsigned long flags;
+	u64 cost;
+
+	if (req->x >= par->width || req->y >= par->height)
+		return -EINVAL;
+	matrixorbital_rect_clip(&rect, par->width, par->height);
+	if (matrixorbital_rect_empty(&rect))
+		return -EINVAL;
+
+	f = kmalloc(sizeof(*f) + rect.height * line_length, GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+	if (copy_from_user(f->data, u64_to_user_ptr(req->data), rect.height * line_length)) {
+		kfree(f);
+		return -EFAULT;
+	}
+
+	cost = matrixorbital_cost_ns(par, 6 + matrixorbital_rect_bytes_aligned(&rect));
+	f->rect = rect;
+	f->cookie = req->cookie;
+	f->target = ns_to_ktime(req->target_ns);
+	f->start = ktime_sub_ns(f->target, cost + MATRIXORBITAL_PRESENT_LEAD_US * NSEC_PER_USEC);
+
+	spin_lock_irqsave(&par->present_lock, flags);
+	if (par->nr_frames >= MATRIXORBITAL_MAX_FRAMES) {
+		spin_unlock_irqrestore(&par->present_lock, flags);
+		kfree(f);
+		return -EBUSY;
+	}
+	matrixorbital_frame_insert(&par->frames, f);
+	par->nr_frames++;
+	matrixorbitalfb_present_arm(par);
+	spin_unlock_irqrestore(&par->present_lock, flags);
+
+	return 0;
+}
+
+static int matrixorbitalfb_present_feedback(struct matrixorbital_par *par,
+					    struct matrixorbital_present_feedback *req)
+{
+	struct matrixorbital_present_feedback done;
+	unsigned long flags;
+	unsigned int got;
+	long ret;
+
+	if (req->timeout_ms) {
+		ret = wait_event_interruptible_timeout(par->present_wait,
+				!kfifo_is_empty(&par->present_done),
+				msecs_to_jiffies(req->timeout_ms));
+		if (ret < 0)
+			return ret;
+	}
+
+	spin_lock_irqsave(&par->present_lock, flags);
+	got = kfifo_out(&par->present_done, &done, sizeof(done));
+	spin_unlock_irqrestore(&par->present_lock, flags);
+	if (got != sizeof(done))
+		return -EAGAIN;
+
+	done.timeout_ms = req->timeout_ms;
+	*req = done;
+
+	return 0;
+}
+
+/*
+ * Empty the queue first so the work can't arm the timer again, then stop
+ * the work, then the timer, and the work the timer may have queued meanwhile
+ */
+static void matrixorbitalfb_present_stop(struct matrixorbital_par *par)
+{
+	struct matrixorbital_frame *f, *tmp;
+	unsigned long flags;
+	LIST_HEAD(frames);
+
+	spin_lock_irqsave(&par->present_lock, flags);
+	list_splice_init(&par->frames, &frames);
+	par->nr_frames = 0;
+	spin_unlock_irqrestore(&par->present_lock, flags);
+
+	kthread_cancel_work_sync(&par->present_work);
+	hrtimer_cancel(&par->present_timer);
+	kthread_cancel_work_sync(&par->present_work);
+
+	list_for_each_entry_safe(f, tmp, &frames, node) {
+		list_del(&f->node);
+		kfree(f);
+	}
+}
+
+static bool matrixorbital_ring_valid(struct matrixorbital_par *par,
+				     const struct matrixorbital_ring_entry *e)
+{
+	switch (e->op) {
+	case MATRIXORBITAL_RING_DAMAGE:
+		return e->x0 < par->width && e->y0 < par->height && e->x1 && e->y1;
+	case MATRIXORBITAL_RING_PIXEL:
+		return e->x0 < par->width && e->y0 < par->height;
+	case MATRIXORBITAL_RING_LINE:
+	case MATRIXORBITAL_RING_RECT:
+	case MATRIXORBITAL_RING_FILLED_RECT:
+		return e->x0 < par->width && e->y0 < par->height &&
+		       e->x1 < par->width && e->y1 < par->height;
+	default:
+		return false;
+	}
+}
+
+static void matrixorbital_ring_draw(struct matrixorbital_par *par, u8 *buf,
+				    const struct matrixorbital_ring_entry *e)
+{
+	u32 line_length = par->info->fix.line_length;
+	u8 color = !!e->color;
+
+	switch (e->op) {
+	case MATRIXORBITAL_RING_PIXEL:
+		matrixorbital_draw_pixel(buf, line_length, par->width, par->height,
+					 e->x0, e->y0, color);
+		break;
+	case MATRIXORBITAL_RING_LINE:
+		matrixorbital_draw_line(buf, line_length, par->width, par->height,
+					e->x0, e->y0, e->x1, e->y1, color);
+		break;
+	case MATRIXORBITAL_RING_RECT:
+	case MATRIXORBITAL_RING_FILLED_RECT:
+		matrixorbital_draw_rect(buf, line_length, par->width, par->height,
+					e->x0, e->y0, e->x1, e->y1, color,
+					e->op == MATRIXORBITAL_RING_FILLED_RECT);
+		break;
+	}
+}
+
+/* Controller command for a drawing entry, returns its length */
+static u32 matrixorbital_ring_encode(u8 *cmd, const struct matrixorbital_ring_entry *e,
+				     int *color)
+{
+	u8 c = !!e->color;
+	u32 len = 0;
+
+	if (e->op == MATRIXORBITAL_RING_PIXEL) {
+		if (*color != c) {
+			cmd[len++] = MATRIXORBITAL_CMD;
+			cmd[len++] = MATRIXORBITAL_SET_DRAWING_COLOR;
+			cmd[len++] = c;
+			*color = c;
+		}
+	}
+
+	cmd[len++] = MATRIXORBITAL_CMD;
+	switch (e->op) {
+	case MATRIXORBITAL_RING_PIXEL:
+		cmd[len++] = MATRIXORBITAL_DRAW_PIXEL;
+		break;
+	case MATRIXORBITAL_RING_RECT:
+		cmd[len++] = MATRIXORBITAL_DRAW_RECTANGLE;
+		cmd[len++] = c;
+		break;
+	case MATRIXORBITAL_RING_FILLED_RECT:
+		cmd[len++] = MATRIXORBITAL_DRAW_FILLED_RECTANGLE;
+		cmd[len++] = c;
+		break;
+	}
+	cmd[len++] = e->x0;
+	cmd[len++] = e->y0;
+	if (e->op != MATRIXORBITAL_RING_PIXEL) {
+		cmd[len++] = e->x1;
+		cmd[len++] = e->y1;
+	}
+
+	return len;
+}
+
+/*
+ * Apply a batch of entries. Drawing goes into video memory right away and,
+ * if the bus budget allows, to the controller as drawing commands in one
+ * transfer, mirrored into the shadow copy. Otherwise, or if the shadow is
+ * stale anyway, the drawn area becomes ordinary damage. Lines always do:
+ * nothing says the controller rasterizes them the way we do, and a shadow
+ * that silently differs from the panel would never be repaired.
+ */
+static void matrixorbital_ring_batch(struct matrixorbital_par *par,
+				     struct matrixorbital_ring_ctx *ctx, u32 n)
+{
+	struct matrixorbital_rect drawn = { }, r;
+	u8 *vmem = par->info->screen_base;
+	u32 i, len = 0, cmds = 0;
+	struct matrixorbital_ring_entry *e;
+	bool kick = false;
+	unsigned long flags;
+	int color;
+
+	for (i = 0; i < n; i++) {
+		e = &ctx->batch[i];
+		if (!matrixorbital_ring_valid(par, e)) {
+			ctx->invalid++;
+			e->op = 0;
+			continue;
+		}
+		if (e->op == MATRIXORBITAL_RING_DAMAGE) {
+			matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_RING, e->x0, e->y0,
+					       e->x1, e->y1, e->deadline_us);
+			kick = true;
+			e->op = 0;
+			continue;
+		}
+
+		matrixorbital_ring_draw(par, vmem, e);
+		if (e->op == MATRIXORBITAL_RING_LINE) {
+			matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_RING, min(e->x0, e->x1),
+					       min(e->y0, e->y1), abs(e->x1 - e->x0) + 1,
+					       abs(e->y1 - e->y0) + 1, 0);
+			kick = true;
+			e->op = 0;
+			continue;
+		}
+		if (e->op == MATRIXORBITAL_RING_PIXEL) {
+			r.x = e->x0;
+			r.y = e->y0;
+			r.width = 1;
+			r.height = 1;
+		} else {
+			r.x = min(e->x0, e->x1);
+			r.y = min(e->y0, e->y1);
+			r.width = abs(e->x1 - e->x0) + 1;
+			r.height = abs(e->y1 - e->y0) + 1;
+		}
+		matrixorbital_rect_union(&drawn, &r);
+	}
+	WRITE_ONCE(ctx->ring->invalid, ctx->invalid);
+
+	if (!matrixorbital_rect_empty(&drawn)) {
+		mutex_lock(&par->lock);
+		color = par->draw_color;
+		for (i = 0; i < n; i++) {
+			if (!ctx->batch[i].op)
+				continue;
+			len += matrixorbital_ring_encode(ctx->cmds + len, &ctx->batch[i], &color);
+			cmds++;
+		}
+
+		if (par->shadow_valid && matrixorbital_bus_admit(par, len)) {
+			for (i = 0; i < n; i++)
+				if (ctx->batch[i].op)
+					matrixorbital_ring_draw(par, par->shadow, &ctx->batch[i]);
+			if (matrixorbital_write_array(par, ctx->cmds, len)) {
+				par->shadow_valid = false;
+				par->draw_color = -1;
+				kick = true;
+			} else {
+				par->draw_color = color;
+				spin_lock_irqsave(&par->stats.lock, flags);
+				par->stats.ring_commands += cmds;
+				spin_unlock_irqrestore(&par->stats.lock, flags);
+			}
+		} else {
+			matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_RING, drawn.x, drawn.y,
+					       drawn.width, drawn.height, 0);
+			kick = true;
+		}
+		mutex_unlock(&par->lock);
+	}
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.ring_entries += n;
+	par->stats.ring_batches++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	if (kick)
+		matrixorbitalfb_kick(par);
+}
+
+/*
+ * Drain the ring. The driver keeps its own tail, the shared one is only
+ * published. need_wakeup is set before the last look at head so a client
+ * that publishes in between sees it and rings the doorbell.
+ */
+static void matrixorbital_ring_consume(struct matrixorbital_par *par,
+				       struct matrixorbital_ring_ctx *ctx)
+{
+	struct matrixorbital_ring *ring = ctx->ring;
+	u32 mask = MATRIXORBITAL_RING_ENTRIES - 1;
+	u32 head, n, i;
+
+	WRITE_ONCE(ring->need_wakeup, 0);
+	/* Stop early once the ring was closed */
+	while (READ_ONCE(ctx->par)) {
+		head = smp_load_acquire(&ring->head);
+		if (head == ctx->tail) {
+			WRITE_ONCE(ring->need_wakeup, 1);
+			smp_mb();
+			if (READ_ONCE(ring->head) == ctx->tail)
+				break;
+			WRITE_ONCE(ring->need_wakeup, 0);
+			continue;
+		}
+		if (head - ctx->tail > MATRIXORBITAL_RING_ENTRIES) {
+			/* The client lost track, skip what it claims to have written */
+			ctx->invalid++;
+			ctx->tail = head;
+			smp_store_release(&ring->tail, ctx->tail);
+			continue;
+		}
+
+		n = min_t(u32, head - ctx->tail, MATRIXORBITAL_RING_BATCH);
+		for (i = 0; i < n; i++)
+			ctx->batch[i] = ring->entry[(ctx->tail + i) & mask];
+		ctx->tail += n;
+		smp_store_release(&ring->tail, ctx->tail);
+		wake_up_interruptible(&ctx->space_wait);
+
+		matrixorbital_ring_batch(par, ctx, n);
+	}
+}
+
+static void matrixorbital_ring_free(struct kref *ref)
+{
+	struct matrixorbital_ring_ctx *ctx = container_of(ref, struct matrixorbital_ring_ctx, ref);
+
+	eventfd_ctx_put(ctx->doorbell);
+	vfree(ctx->ring);
+	kfree(ctx);
+}
+
+static void matrixorbital_ring_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par, ring_work);
+	struct matrixorbital_ring_ctx *ctx;
+
+	mutex_lock(&matrixorbital_ring_lock);
+	ctx = par->ring;
+	if (ctx)
+		kref_get(&ctx->ref);
+	mutex_unlock(&matrixorbital_ring_lock);
+	if (!ctx)
+		return;
+
+	matrixorbital_ring_consume(par, ctx);
+	kref_put(&ctx->ref, matrixorbital_ring_free);
+}
+
+/* The client wrote to the doorbell, called with the eventfd's wait queue locked */
+static int matrixorbital_ring_wakeup(wait_queue_entry_t *wait, unsigned int mode,
+				     int sync, void *key)
+{
+	struct matrixorbital_ring_ctx *ctx = container_of(wait, struct matrixorbital_ring_ctx,
+							  wait);
+
+	if (key_to_poll(key) & EPOLLIN)
+		matrixorbital_queue_work(ctx->par, &ctx->par->ring_work);
+
+	return 0;
+}
+
+static void matrixorbital_ring_queue_proc(struct file *file, wait_queue_head_t *wqh,
+					  poll_table *pt)
+{
+	struct matrixorbital_ring_ctx *ctx = container_of(pt, struct matrixorbital_ring_ctx, pt);
+
+	add_wait_queue(wqh, &ctx->wait);
+}
+
+/* Disconnect a ring from its device, ring lock held */
+static void matrixorbital_ring_detach(struct matrixorbital_ring_ctx *ctx)
+{
+	u64 cnt;
+
+	lockdep_assert_held(&matrixorbital_ring_lock);
+	if (!ctx->par)
+		return;
+
+	eventfd_ctx_remove_wait_queue(ctx->doorbell, &ctx->wait, &cnt);
+	ctx->par->ring = NULL;
+	ctx->par = NULL;
+	wake_up_interruptible(&ctx->space_wait);
+}
+
+static int matrixorbital_ring_release(struct inode *inode, struct file *file)
+{
+	struct matrixorbital_ring_ctx *ctx = file->private_data;
+
+	mutex_lock(&matrixorbital_ring_lock);
+	matrixorbital_ring_detach(ctx);
+	mutex_unlock(&matrixorbital_ring_lock);
+
+	kref_put(&ctx->ref, matrixorbital_ring_free);
+
+	return 0;
+}
+
+static int matrixorbital_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct matrixorbital_ring_ctx *ctx = file->private_data;
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+/* Writable while there are free entries, hung up once the device is gone */
+static __poll_t matrixorbital_ring_poll(struct file *file, poll_table *wait)
+{
+	struct matrixorbital_ring_ctx *ctx = file->private_data;
+	struct matrixorbital_ring *ring = ctx->ring;
+	__poll_t mask = 0;
+
+	poll_wait(file, &ctx->space_wait, wait);
+
+	if (!READ_ONCE(ctx->par))
+		return EPOLLHUP;
+	if (READ_ONCE(ring->head) - smp_load_acquire(&ring->tail) < MATRIXORBITAL_RING_ENTRIES)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static const struct file_operations matrixorbital_ring_fops = {
+	.owner		= THIS_MODULE,
+	.release	= matrixorbital_ring_release,
+	.mmap		= matrixorbital_ring_mmap,
+	.poll		= matrixorbital_ring_poll,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * Set up a ring and its file. The fd is reserved in req->fd but not
+ * installed, that's up to the caller once the client has been told.
+ */
+static struct file *matrixorbital_ring_create(struct matrixorbital_par *par,
+					      struct matrixorbital_ring_setup *req)
+{
+	struct matrixorbital_ring_ctx *ctx;
+	struct file *doorbell, *file;
+	__poll_t events;
+	int ret, fd;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return ERR_PTR(-ENOMEM);
+	kref_init(&ctx->ref);
+
+	ctx->size = PAGE_ALIGN(sizeof(*ctx->ring) + MATRIXORBITAL_RING_ENTRIES *
+			       sizeof(struct matrixorbital_ring_entry));
+	ctx->ring = vmalloc_user(ctx->size);
+	if (!ctx->ring) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	ctx->ring->entries = MATRIXORBITAL_RING_ENTRIES;
+	ctx->ring->need_wakeup = 1;
+
+	doorbell = eventfd_fget(req->eventfd);
+	if (IS_ERR(doorbell)) {
+		ret = PTR_ERR(doorbell);
+		goto err_free;
+	}
+	ctx->doorbell = eventfd_ctx_fileget(doorbell);
+	init_waitqueue_func_entry(&ctx->wait, matrixorbital_ring_wakeup);
+	init_poll_funcptr(&ctx->pt, matrixorbital_ring_queue_proc);
+	init_waitqueue_head(&ctx->space_wait);
+
+	fd = get_unused_fd_flags(O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		ret = fd;
+		goto err_doorbell;
+	}
+	req->fd = fd;
+	req->entries = MATRIXORBITAL_RING_ENTRIES;
+	req->size = ctx->size;
+
+	mutex_lock(&matrixorbital_ring_lock);
+	if (par->ring) {
+		ret = -EBUSY;
+		goto err_unlock;
+	}
+	file = anon_inode_getfile("[matrixorbital-ring]", &matrixorbital_ring_fops, ctx, O_RDWR);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		goto err_unlock;
+	}
+	ctx->par = par;
+	par->ring = ctx;
+	events = vfs_poll(doorbell, &ctx->pt);
+	if (events & EPOLLIN)
+		matrixorbital_queue_work(par, &par->ring_work);
+	mutex_unlock(&matrixorbital_ring_lock);
+	fput(doorbell);
+
+	return file;
+
+err_unlock:
+	mutex_unlock(&matrixorbital_ring_lock);
+	put_unused_fd(fd);
+err_doorbell:
+	eventfd_ctx_put(ctx->doorbell);
+	fput(doorbell);
+err_free:
+	vfree(ctx->ring);
+	kfree(ctx);
+	return ERR_PTR(ret);
+}
+
+static int matrixorbitalfb_wait_flush(struct matrixorbital_par *par,
+				      struct matrixorbital_flush_wait *req)
+{
+	u32 target = atomic_read(&par->damage_seq);
+	long ret = 1;
+
+	if (req->timeout_ms)
+		ret = wait_event_interruptible_timeout(par->flush_wait,
+				(s32)(READ_ONCE(par->flushed_seq) - target) >= 0,
+				msecs_to_jiffies(req->timeout_ms));
+	if (ret < 0)
+		return ret;
+
+	req->flags = 0;
+	if ((s32)(READ_ONCE(par->flushed_seq) - target) < 0)
+		req->flags |= MATRIXORBITAL_FLUSH_TIMEOUT;
+	if (READ_ONCE(par->throttled))
+		req->flags |= MATRIXORBITAL_FLUSH_THROTTLED;
+	req->utilization = matrixorbital_bus_utilization(par->bus,
+					MATRIXORBITAL_BUS_DISPLAY);
+	req->backoff_ms = (req->flags & MATRIXORBITAL_FLUSH_THROTTLED) ?
+			  MATRIXORBITAL_BUS_SLOT_MS : 0;
+
+	return 0;
+}
+
+static int matrixorbitalfb_ioctl(struct fb_info *info, unsigned int cmd,
+				 unsigned long arg)
+{
+	struct matrixorbital_par *par = info->par;
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case MATRIXORBITAL_IOCTL_WAIT_FLUSH: {
+		struct matrixorbital_flush_wait req;
+		int ret;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		ret = matrixorbitalfb_wait_flush(par, &req);
+		if (ret)
+			return ret;
+		if (copy_to_user(argp, &req, sizeof(req)))
+			return -EFAULT;
+		return 0;
+	}
+	case MATRIXORBITAL_IOCTL_DAMAGE: {
+		struct matrixorbital_damage req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		if (req.x >= par->width || req.y >= par->height)
+			return -EINVAL;
+		matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_IOCTL, req.x, req.y,
+				       req.width, req.height, 0);
+		matrixorbitalfb_kick(par);
+		return 0;
+	}
+	case MATRIXORBITAL_IOCTL_DAMAGE_QOS: {
+		struct matrixorbital_damage_qos req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		if (req.x >= par->width || req.y >= par->height || req.flags)
+			return -EINVAL;
+		matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_IOCTL, req.x, req.y,
+				       req.width, req.height, req.deadline_us);
+		matrixorbitalfb_kick(par);
+		return 0;
+	}
+	case MATRIXORBITAL_IOCTL_RING: {
+		struct matrixorbital_ring_setup req;
+		struct file *file;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		file = matrixorbital_ring_create(par, &req);
+		if (IS_ERR(file))
+			return PTR_ERR(file);
+		if (copy_to_user(argp, &req, sizeof(req))) {
+			fput(file);
+			put_unused_fd(req.fd);
+			return -EFAULT;
+		}
+		fd_install(req.fd, file);
+		return 0;
+	}
+	case MATRIXORBITAL_IOCTL_PRESENT: {
+		struct matrixorbital_present req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		return matrixorbitalfb_present(par, &req);
+	}
+	case MATRIXORBITAL_IOCTL_PRESENT_FEEDBACK: {
+		struct matrixorbital_present_feedback req;
+		int ret;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		ret = matrixorbitalfb_present_feedback(par, &req);
+		if (ret)
+			return ret;
+		if (copy_to_user(argp, &req, sizeof(req)))
+			return -EFAULT;
+		return 0;
+	}
+	default:
+		return -ENOTTY;
+	}
+}
+
+static ssize_t matrixorbitalfb_write(struct fb_info *info, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct matrixorbital_par *par = info->par;
+	unsigned long total_size;
+	unsigned long p = *ppos;
+	u8 __iomem *dst;
+
+	total_size = info->fix.smem_len;
+
+	if (p > total_size)
+		return -EINVAL;
+
+	if (count + p > total_size)
+		count = total_size - p;
+
+	if (!count)
+		return -EINVAL;
+
+	dst = (void __force *) (info->screen_base + p);
+
+	if (copy_from_user(dst, buf, count))
+		return -EFAULT;
+
+	matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_WRITE, 0,
+			       p / info->fix.line_length, info->var.xres,
+			       DIV_ROUND_UP(p + count, info->fix.line_length) -
+			       p / info->fix.line_length, 0);
+	matrixorbitalfb_kick(par);
+
+	*ppos += count;
+
+	return count;
+}
+
+/* Bring backlight and contrast to the last levels asked for, in one transfer */
+static void matrixorbital_bl_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par, bl_work);
+	int level = READ_ONCE(par->bl_next);
+	u32 contrast = READ_ONCE(par->contrast);
+	unsigned long flags;
+	u8 buf[9], *p = buf;
+
+	if (level != par->bl_level) {
+		*p++ = MATRIXORBITAL_CMD;
+		if (!level) {
+			*p++ = MATRIXORBITAL_BACKLIGHT_OFF;
+		} else {
+			if (par->bl_level <= 0) {
+				*p++ = MATRIXORBITAL_BACKLIGHT_ON;
+				*p++ = 0;
+				*p++ = MATRIXORBITAL_CMD;
+			}
+			*p++ = MATRIXORBITAL_SET_BRIGHTNESS;
+			*p++ = level;
+		}
+	}
+	if (contrast != par->contrast_sent) {
+		*p++ = MATRIXORBITAL_CMD;
+		*p++ = MATRIXORBITAL_SET_CONTRAST;
+		*p++ = contrast;
+	}
+	if (p == buf || matrixorbital_write_array(par, buf, p - buf))
+		return;
+
+	WRITE_ONCE(par->bl_level, level);
+	par->contrast_sent = contrast;
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.backlight_writes++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+}
+
+static void matrixorbital_bl_queue(struct matrixorbital_par *par)
+{
+	matrixorbital_queue_work(par, &par->bl_work);
+}
+
+/*
+ * Step the fade: the level due now goes out unless it's the one sent last,
+ * so a slow or short fade costs only the steps that change something.
+ */
+static enum hrtimer_restart matrixorbital_fade_timer(struct hrtimer *timer)
+{
+	struct matrixorbital_par *par = container_of(timer, struct matrixorbital_par, fade_timer);
+	u32 ms = READ_ONCE(par->fade_ms), rate = max(READ_ONCE(par->fade_rate), 1U);
+	unsigned long flags;
+	bool done;
+	s64 t;
+
+	spin_lock_irqsave(&par->fade_lock, flags);
+	t = ktime_ms_delta(ktime_get(), par->fade_start);
+	done = t >= ms;
+	if (done)
+		par->bl_next = par->fade_target;
+	else
+		par->bl_next = par->fade_from +
+			       div_s64((s64)(par->fade_target - par->fade_from) * t, ms);
+	spin_unlock_irqrestore(&par->fade_lock, flags);
+
+	if (READ_ONCE(par->bl_next) != READ_ONCE(par->bl_level))
+		matrixorbital_bl_queue(par);
+	if (done)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime(NSEC_PER_SEC / rate));
+	return HRTIMER_RESTART;
+}
+
+/* Fade from wherever the backlight is heading now, or jump if that's unknown */
+static void matrixorbital_fade_to(struct matrixorbital_par *par, int target)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->fade_lock, flags);
+	par->fade_from = READ_ONCE(par->bl_level) < 0 ? target : par->bl_next;
+	par->fade_target = target;
+	par->fade_start = ktime_get();
+	spin_unlock_irqrestore(&par->fade_lock, flags);
+
+	hrtimer_start(&par->fade_timer, 0, HRTIMER_MODE_REL);
+}
+
+static int matrixorbital_bl_update_status(struct backlight_device *bl)
+{
+	struct matrixorbital_par *par = bl_get_data(bl);
+	int level = bl->props.brightness;
+
+	if (par->blanked || par->suspended || bl->props.power != FB_BLANK_UNBLANK ||
+	    bl->props.state & (BL_CORE_SUSPENDED | BL_CORE_FBBLANK))
+		level = 0;
+	matrixorbital_fade_to(par, level);
+
+	return 0;
+}
+
+/* Where a fade in progress has got to */
+static int matrixorbital_bl_get_brightness(struct backlight_device *bl)
+{
+	struct matrixorbital_par *par = bl_get_data(bl);
+
+	return max(READ_ONCE(par->bl_level), 0);
+}
+
+static int matrixorbital_bl_check_fb(struct backlight_device *bl, struct fb_info *info)
+{
+	struct matrixorbital_par *par = bl_get_data(bl);
+
+	return info == par->info;
+}
+
+static const struct backlight_ops matrixorbital_bl_ops = {
+	.update_status	= matrixorbital_bl_update_status,
+	.get_brightness	= matrixorbital_bl_get_brightness,
+	.check_fb	= matrixorbital_bl_check_fb,
+};
+
+/*
+ * Blanking fades the backlight out and drops the runtime PM reference the
+ * panel holds while it shows something, so it suspends once the fade is
+ * over. Unblanking resumes it and fades back in.
+ */
+static int matrixorbitalfb_blank(int blank_mode, struct fb_info *info)
+{
+	struct matrixorbital_par *par = info->par;
+	struct device *dev = &par->client->dev;
+	bool blank = blank_mode != FB_BLANK_UNBLANK;
+
+	if (blank == par->blanked)
+		return 0;
+
+	par->blanked = blank;
+	if (blank) {
+		backlight_update_status(par->bl);
+		pm_runtime_mark_last_busy(dev);
+		pm_runtime_put_autosuspend(dev);
+	} else {
+		pm_runtime_get_sync(dev);
+		backlight_update_status(par->bl);
+	}
+
+	return 0;
+}
+
+static void matrixorbitalfb_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+{
+	struct matrixorbital_par *par = info->par;
+	sys_fillrect(info, rect);
+	matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_FILLRECT, rect->dx, rect->dy,
+			       rect->width, rect->height, 0);
+	matrixorbitalfb_kick(par);
+}
+
+static void matrixorbitalfb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+	struct matrixorbital_par *par = info->par;
+	sys_copyarea(info, area);
+	matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_COPYAREA, area->dx, area->dy,
+			       area->width, area->height, 0);
+	matrixorbitalfb_kick(par);
+}
+
+static void matrixorbitalfb_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+	struct matrixorbital_par *par = info->par;
+	sys_imageblit(info, image);
+	matrixorbitalfb_damage(par, MATRIXORBITAL_DAMAGE_IMAGEBLIT, image->dx, image->dy,
+			       image->width, image->height, 0);
+	matrixorbitalfb_kick(par);
+}
+
+static struct fb_ops matrixorbitalfb_ops = {
+	.owner		= THIS_MODULE,
+	.fb_read	= fb_sys_read,
+	.fb_write	= matrixorbitalfb_write,
+	.fb_blank	= matrixorbitalfb_blank,
+	.fb_fillrect	= matrixorbitalfb_fillrect,
+	.fb_copyarea	= matrixorbitalfb_copyarea,
+	.fb_imageblit	= matrixorbitalfb_imageblit,
+	.fb_ioctl	= matrixorbitalfb_ioctl,
+};
+
+static void matrixorbitalfb_first_io(struct fb_info *info)
+{
+	struct matrixorbital_par *par = info->par;
+
+	matrixorbital_tiles_time(&par->pending, ktime_get());
+	atomic_inc(&par->damage_seq);
+}
+
+static void matrixorbitalfb_deferred_io(struct fb_info *info,
+				struct list_head *pagelist)
+{
+	u32 lines_per_page = PAGE_SIZE / info->fix.line_length;
+	struct page *page;
+
+	list_for_each_entry(page, pagelist, lru) {
+		u32 y = page->index * lines_per_page;
+
+		if (y >= info->var.yres)
+			continue;
+		matrixorbitalfb_damage(info->par, MATRIXORBITAL_DAMAGE_MMAP, 0, y, info->var.xres,
+				       min(lines_per_page, info->var.yres - y), 0);
+	}
+
+	matrixorbitalfb_kick(info->par);
+}
+
+static int matrixorbital_init(struct matrixorbital_par *par)
+{
+	int ret;
+
+	/* Use I2C for TX */
+	matrixorbital_write_param(par, MATRIXORBITAL_TX_PROTOCOL_SELECT, 0);
+
+	/* Read model */
+	ret = matrixorbital_read_param(par, MATRIXORBITAL_READ_MODULE_TYPE);
+	dev_dbg(&par->client->dev, "Module type 0x%02x\n", ret);
+	par->module_type = ret;
+
+	/* Enable keypad poll mode */
+	ret = matrixorbital_write_cmd(par, MATRIXORBITAL_AUTO_TX_KEY_PRESS_OFF);
+
+	/* Clear the screen */
+	ret = matrixorbital_write_cmd(par, MATRIXORBITAL_CLEAR_SCREEN);
+
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+static void matrixorbital_key_feedback(struct matrixorbital_par *par, int idx);
+
+static void matrixorbital_report_key(struct matrixorbital_par *par, unsigned matrixorbital_keycode)
+{
+	struct input_dev *input = par->idev;
+	u16 keycode = matrixorbital_map_key(matrixorbital_keycode);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_keymap); i++)
+		if (matrixorbital_keymap[i].raw == matrixorbital_keycode)
+			matrixorbital_key_feedback(par, i);
+
+	trace_matrixorbital_key(par->client, matrixorbital_keycode, keycode);
+
+	if (keycode == KEY_RESERVED) {
+		dev_err(&input->dev, "Unknown keycode 0x%x\n", matrixorbital_keycode);
+		return;
+	}
+
+	dev_err(&input->dev, "Report key %d [0x%x]\n", keycode, matrixorbital_keycode);
+
+	input_report_key(input, keycode, 1);
+	input_sync(input);
+
+	input_report_key(input, keycode, 0);
+	input_sync(input);
+}
+
+static void matrixorbital_keypad_poll(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par,
+						     key_work.work);
+	ktime_t start = ktime_get();
+	int ret;
+
+	do {
+		ret = matrixorbital_read_param(par, MATRIXORBITAL_POLL_KEY_PRESS);
+		if (ret <= 0)
+			break;
+
+		matrixorbital_report_key(par, ret & 0x7F);
+	} while (ret & 0x80);
+
+	matrixorbital_hist_add(par, MATRIXORBITAL_HIST_KEY_POLL, start);
+
+	matrixorbital_queue_delayed_work(par, &par->key_work,
+					 msecs_to_jiffies(MATRIXORBITAL_KEY_POLL_MS));
+}
+
+static int matrixorbital_keypad_open(struct input_dev *input)
+{
+	struct matrixorbital_par *par = input_get_drvdata(input);
+
+	matrixorbital_queue_delayed_work(par, &par->key_work, 0);
+
+	return 0;
+}
+
+static void matrixorbital_keypad_close(struct input_dev *input)
+{
+	struct matrixorbital_par *par = input_get_drvdata(input);
+
+	kthread_cancel_delayed_work_sync(&par->key_work);
+}
+
+/* Ask for the GPOs in mask to go to the levels in bits, from any context */
+static void matrixorbital_gpo_request(struct matrixorbital_par *par, unsigned long mask,
+				      unsigned long bits)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	par->gpo_mask |= mask;
+	par->gpo_bits = (par->gpo_bits & ~mask) | (bits & mask);
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+
+	matrixorbital_queue_work(par, &par->gpo_work);
+}
+
+/*
+ * Write all GPO changes asked for since the last run as one transfer of
+ * back to back commands, leaving out outputs already at their level. Runs
+ * on the I/O thread.
+ */
+static void matrixorbital_gpo_apply(struct matrixorbital_par *par)
+{
+	u8 buf[3 * MATRIXORBITAL_GPOS], *p = buf;
+	unsigned long mask, bits, change, flags;
+	int i;
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	mask = par->gpo_mask;
+	bits = (par->gpo_bits & ~par->pulse_mask) | (par->pulse_bits & par->pulse_mask);
+	par->gpo_mask = 0;
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+
+	change = mask & ((bits ^ par->gpo_state) | ~par->gpo_known);
+	for_each_set_bit(i, &change, MATRIXORBITAL_GPOS) {
+		*p++ = 0xFE;
+		*p++ = test_bit(i, &bits) ? MATRIXORBITAL_GPO_ON : MATRIXORBITAL_GPO_OFF;
+		*p++ = i + 1;
+	}
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.gpo_skipped += hweight_long(mask & ~change);
+	if (p != buf)
+		par->stats.gpo_writes++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	if (p == buf)
+		return;
+	if (matrixorbital_write_array(par, buf, p - buf)) {
+		/* Part of it may have landed, so write these again next time */
+		par->gpo_known &= ~change;
+		spin_lock_irqsave(&par->gpo_lock, flags);
+		par->gpo_mask |= change;
+		spin_unlock_irqrestore(&par->gpo_lock, flags);
+		return;
+	}
+	par->gpo_state = (par->gpo_state & ~change) | (bits & change);
+	par->gpo_known |= change;
+}
+
+static void matrixorbital_gpo_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par, gpo_work);
+
+	matrixorbital_gpo_apply(par);
+}
+
+/* End the pulses that are over and wait for the next one to end */
+static void matrixorbital_pulse_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par,
+						     pulse_work.work);
+	ktime_t now = ktime_get(), next = KTIME_MAX;
+	unsigned long active, ended = 0, flags;
+	int i;
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	active = par->pulse_mask;
+	for_each_set_bit(i, &active, MATRIXORBITAL_GPOS) {
+		if (!ktime_before(now, par->pulse_end[i]))
+			ended |= BIT(i);
+		else if (ktime_before(par->pulse_end[i], next))
+			next = par->pulse_end[i];
+	}
+	par->pulse_mask &= ~ended;
+	par->gpo_mask |= ended;
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+
+	matrixorbital_gpo_apply(par);
+	if (next != KTIME_MAX)
+		matrixorbital_mod_delayed_work(par, &par->pulse_work,
+					       nsecs_to_jiffies(ktime_to_ns(ktime_sub(next, now))) + 1);
+}
+
+/*
+ * Start the feedback configured for a key, written right after the key
+ * read instead of waiting for userspace to react to the input event
+ */
+static void matrixorbital_key_feedback(struct matrixorbital_par *par, int idx)
+{
+	ktime_t now = ktime_get(), next = KTIME_MAX;
+	struct matrixorbital_key_action act;
+	unsigned long bit, active, flags;
+	int i;
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	act = par->key_actions[idx];
+	if (act.gpo) {
+		bit = BIT(act.gpo - 1);
+		par->pulse_mask |= bit;
+		par->pulse_bits = act.led ? par->pulse_bits & ~bit : par->pulse_bits | bit;
+		par->pulse_end[act.gpo - 1] = ktime_add_ms(now, act.ms);
+		par->gpo_mask |= bit;
+	}
+	active = par->pulse_mask;
+	for_each_set_bit(i, &active, MATRIXORBITAL_GPOS)
+		if (ktime_before(par->pulse_end[i], next))
+			next = par->pulse_end[i];
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+	if (!act.gpo)
+		return;
+
+	matrixorbital_gpo_apply(par);
+	matrixorbital_mod_delayed_work(par, &par->pulse_work,
+				       nsecs_to_jiffies(ktime_to_ns(ktime_sub(next, now))) + 1);
+}
+
+static int matrixorbital_gpio_get_direction(struct gpio_chip *chip, unsigned int offset)
+{
+	return GPIO_LINE_DIRECTION_OUT;
+}
+
+static int matrixorbital_gpio_get(struct gpio_chip *chip, unsigned int offset)
+{
+	struct matrixorbital_par *par = gpiochip_get_data(chip);
+
+	return test_bit(offset, &par->gpo_bits);
+}
+
+/* Consumers see the outputs change before the call returns */
+static void matrixorbital_gpio_set_multiple(struct gpio_chip *chip, unsigned long *mask,
+					    unsigned long *bits)
+{
+	struct matrixorbital_par *par = gpiochip_get_data(chip);
+
+	matrixorbital_gpo_request(par, *mask, *bits);
+	kthread_flush_work(&par->gpo_work);
+}
+
+static void matrixorbital_gpio_set(struct gpio_chip *chip, unsigned int offset, int value)
+{
+	unsigned long mask = BIT(offset), bits = value ? BIT(offset) : 0;
+
+	matrixorbital_gpio_set_multiple(chip, &mask, &bits);
+}
+
+static int matrixorbital_gpio_direction_output(struct gpio_chip *chip, unsigned int offset,
+					       int value)
+{
+	matrixorbital_gpio_set(chip, offset, value);
+	return 0;
+}
+
+/* The LEDs are wired to light up while their GPO is off */
+static void matrixorbital_led_set(struct led_classdev *cdev,
+			      enum led_brightness value)
+{
+	struct matrixorbital_led *led = container_of(cdev, struct matrixorbital_led, cdev);
+	unsigned long bit = BIT(led->gpio_number - 1);
+
+	matrixorbital_gpo_request(led->par, bit, value != LED_OFF ? 0 : bit);
+}
+
+/*
+ * Probe an absent panel with a one byte read, backing off exponentially.
+ * Once it answers it is set up again, gets its outputs, backlight and
+ * contrast back, and a full frame.
+ */
+static void matrixorbital_presence_work(struct kthread_work *work)
+{
+	struct matrixorbital_par *par = container_of(work, struct matrixorbital_par,
+						     presence_work.work);
+	unsigned long flags;
+	u64 held;
+	u8 data;
+	int ret;
+
+	ret = matrixorbital_xfer(par, &data, sizeof(data), true, &held);
+	spin_lock_irqsave(&par->stats.lock, flags);
+	par->stats.presence_probes++;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	if (ret != sizeof(data)) {
+		par->presence_ms = min(par->presence_ms * 2,
+				       max(READ_ONCE(presence_max_ms), MATRIXORBITAL_PRESENCE_MIN_MS));
+		matrixorbital_mod_delayed_work(par, &par->presence_work,
+					       msecs_to_jiffies(par->presence_ms));
+		return;
+	}
+
+	dev_info(&par->client->dev, "Panel is back\n");
+	par->nacks = 0;
+	WRITE_ONCE(par->absent, false);
+	if (matrixorbital_init(par) && READ_ONCE(par->absent))
+		return;
+
+	mutex_lock(&par->lock);
+	par->shadow_valid = false;
+	mutex_unlock(&par->lock);
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	par->gpo_known = 0;
+	par->gpo_mask = GENMASK(MATRIXORBITAL_GPOS - 1, 0);
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+	matrixorbital_gpo_apply(par);
+
+	WRITE_ONCE(par->bl_level, -1);
+	par->contrast_sent = U32_MAX;
+	matrixorbital_bl_queue(par);
+
+	matrixorbitalfb_kick(par);
+}
+
+/* Works of every kind waiting on the I/O thread, and delayed ones not due yet */
+static void matrixorbital_worker_depth(struct kthread_worker *worker, u32 *queued, u32 *delayed)
+{
+	struct list_head *pos;
+	unsigned long flags;
+
+	*queued = 0;
+	*delayed = 0;
+	raw_spin_lock_irqsave(&worker->lock, flags);
+	list_for_each(pos, &worker->work_list)
+		(*queued)++;
+	list_for_each(pos, &worker->delayed_work_list)
+		(*delayed)++;
+	raw_spin_unlock_irqrestore(&worker->lock, flags);
+}
+
+static int matrixorbital_stats_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_par *par = s->private;
+	struct matrixorbital_stats *st = &par->stats;
+	unsigned long flags;
+	u32 queued, delayed;
+	int i;
+
+	matrixorbital_worker_depth(par->worker, &queued, &delayed);
+	seq_puts(s, "now:\n");
+	seq_printf(s, "queue_depth: %u\n", queued);
+	seq_printf(s, "queue_delayed: %u\n", delayed);
+
+	seq_puts(s, "since reset, totals and maxima:\n");
+	spin_lock_irqsave(&st->lock, flags);
+	seq_printf(s, "frames_flushed: %llu\n", st->frames_flushed);
+	seq_printf(s, "frames_skipped: %llu\n", st->frames_skipped);
+	seq_printf(s, "frames_throttled: %llu\n", st->frames_throttled);
+	seq_printf(s, "rects_flushed: %llu\n", st->rects_flushed);
+	seq_printf(s, "rects_unaligned: %llu\n", st->rects_unaligned);
+	seq_printf(s, "xfers: %llu\n", st->xfers);
+	seq_printf(s, "xfer_errors: %llu\n", st->xfer_errors);
+	seq_printf(s, "xfer_retries: %llu\n", st->xfer_retries);
+	seq_printf(s, "flush_retries: %llu\n", st->flush_retries);
+	seq_printf(s, "deadline_misses: %llu\n", st->deadline_misses);
+	seq_printf(s, "frames_presented: %llu\n", st->frames_presented);
+	seq_printf(s, "frames_dropped: %llu\n", st->frames_dropped);
+	seq_printf(s, "frames_late: %llu\n", st->frames_late);
+	seq_printf(s, "ring_entries: %llu\n", st->ring_entries);
+	seq_printf(s, "ring_batches: %llu\n", st->ring_batches);
+	seq_printf(s, "ring_commands: %llu\n", st->ring_commands);
+	seq_printf(s, "gpo_writes: %llu\n", st->gpo_writes);
+	seq_printf(s, "gpo_skipped: %llu\n", st->gpo_skipped);
+	seq_printf(s, "backlight_writes: %llu\n", st->backlight_writes);
+	seq_printf(s, "absent_events: %llu\n", st->absent_events);
+	seq_printf(s, "presence_probes: %llu\n", st->presence_probes);
+	seq_printf(s, "deadline_late_max_us: %llu\n",
+		   div_u64(st->deadline_late_max_ns, NSEC_PER_USEC));
+	seq_printf(s, "hold_max_us: %llu\n", div_u64(st->hold_max_ns, NSEC_PER_USEC));
+	seq_printf(s, "wait_max_us: %llu\n", div_u64(st->wait_max_ns, NSEC_PER_USEC));
+	seq_printf(s, "bytes_rx: %llu\n", st->bytes_rx);
+	seq_printf(s, "atomic_flushes: %llu\n", READ_ONCE(par->atomic_flushes));
+	for (i = 0; i < ARRAY_SIZE(st->cmd_count); i++) {
+		if (!st->cmd_count[i])
+			continue;
+		seq_printf(s, "cmd_0x%02x: %llu xfers %llu bytes\n", i,
+			   st->cmd_count[i], st->cmd_bytes[i]);
+	}
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_stats);
+
+static int matrixorbital_histograms_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_par *par = s->private;
+	struct matrixorbital_stats *st = &par->stats;
+	unsigned long flags;
+	int i, b;
+
+	spin_lock_irqsave(&st->lock, flags);
+	for (i = 0; i < MATRIXORBITAL_NR_HISTS; i++) {
+		struct matrixorbital_hist *hist = &st->hist[i];
+
+		seq_printf(s, "%s: count %llu avg_us %llu max_us %llu\n",
+			   matrixorbital_hist_names[i], hist->count,
+			   hist->count ? div64_u64(hist->sum_us, hist->count) : 0,
+			   hist->max_us);
+		for (b = 0; b < MATRIXORBITAL_HIST_BUCKETS; b++) {
+			if (!hist->buckets[b])
+				continue;
+			seq_printf(s, "  < %8lu us: %llu\n", 1UL << b, hist->buckets[b]);
+		}
+	}
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_histograms);
+
+static ssize_t matrixorbital_reset_write(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct matrixorbital_par *par = file->private_data;
+	struct matrixorbital_stats *st = &par->stats;
+	unsigned long flags;
+
+	spin_lock_irqsave(&st->lock, flags);
+	memset(&st->frames_flushed, 0,
+	       sizeof(*st) - offsetof(struct matrixorbital_stats, frames_flushed));
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	return count;
+}
+
+static const struct file_operations matrixorbital_reset_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= matrixorbital_reset_write,
+	.llseek	= noop_llseek,
+};
+
+/* What the driver believes is on the panel, in framebuffer layout */
+static ssize_t matrixorbital_shadow_read(struct file *file, char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct matrixorbital_par *par = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&par->lock);
+	ret = simple_read_from_buffer(buf, count, ppos, par->shadow,
+				      par->info->fix.smem_len);
+	mutex_unlock(&par->lock);
+
+	return ret;
+}
+
+static const struct file_operations matrixorbital_shadow_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.read	= matrixorbital_shadow_read,
+	.llseek	= default_llseek,
+};
+
+/* Dump the fitted bus cost next to the nominal one from the bus clock */
+static int matrixorbital_cost_model_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_par *par = s->private;
+	struct matrixorbital_cost *cost = &par->cost;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cost->lock, flags);
+	seq_printf(s, "samples: %llu\n", cost->samples);
+	seq_printf(s, "calibrated: %d\n", cost->valid);
+	seq_printf(s, "header_ns: %llu\n", cost->header_ns);
+	seq_printf(s, "byte_ps: %llu\n", cost->byte_ps);
+	spin_unlock_irqrestore(&cost->lock, flags);
+	seq_printf(s, "nominal_header_ns: %llu\n", matrixorbital_bus_cost_ns(par->bus, 0));
+	seq_printf(s, "nominal_byte_ps: %llu\n",
+		   div_u64(9ULL * NSEC_PER_SEC * 1000, par->bus->freq));
+
+	return 0;
+}
+
+/* Writing anything starts the fit over */
+static ssize_t matrixorbital_cost_model_write(struct file *file, const char __user *buf,
+					      size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+
+	matrixorbital_cost_reset(s->private);
+
+	return count;
+}
+
+static int matrixorbital_cost_model_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, matrixorbital_cost_model_show, inode->i_private);
+}
+
+static const struct file_operations matrixorbital_cost_model_fops = {
+	.owner		= THIS_MODULE,
+	.open		= matrixorbital_cost_model_open,
+	.read		= seq_read,
+	.write		= matrixorbital_cost_model_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Time the packing path on the current frame */
+static int matrixorbital_pack_bench_show(struct seq_file *s, void *unused)
+{
+	static const struct matrixorbital_rect rects[] = {
+		{ 0, 0, 192, 64 },
+		{ 3, 5, 37, 20 },
+		{ 150, 0, 40, 8 },
+		{ 17, 30, 100, 1 },
+		{ 91, 12, 2, 40 },
+	};
+	struct matrixorbital_par *par = s->private;
+	u32 line_length = par->info->fix.line_length;
+	const int loops = 1000;
+	ktime_t start;
+	u64 ns;
+	u8 *buf;
+	int i, j;
+
+	buf = kmalloc(par->info->fix.smem_len, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++)
+		matrixorbital_pack_lines(buf, par->info->screen_base, line_length,
+					 par->height);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	seq_printf(s, "pack_lines: %llu ns/frame\n", div_u64(ns, loops));
+
+	/* Bit exact windows against windows rounded out to whole bytes */
+	for (j = 0; j < ARRAY_SIZE(rects); j++) {
+		const struct matrixorbital_rect *r = &rects[j];
+		u32 bx = r->x / 8;
+		u32 bw = DIV_ROUND_UP(r->x + r->width, 8) - bx;
+		u64 ns_aligned;
+
+		if (r->x + r->width > par->width || r->y + r->height > par->height)
+			continue;
+
+		start = ktime_get();
+		for (i = 0; i < loops; i++)
+			matrixorbital_pack_rect(buf, par->info->screen_base, line_length, r);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		start = ktime_get();
+		for (i = 0; i < loops; i++)
+			matrixorbital_pack_bytes(buf, par->info->screen_base + r->y * line_length,
+						 line_length, bx, bw, r->height);
+		ns_aligned = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		seq_printf(s, "%ux%u+%u+%u: pack_rect %u bytes %llu ns, pack_bytes %u bytes %llu ns\n",
+			   r->width, r->height, r->x, r->y,
+			   matrixorbital_rect_bytes(r), div_u64(ns, loops),
+			   matrixorbital_rect_bytes_aligned(r), div_u64(ns_aligned, loops));
+	}
+	kfree(buf);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_pack_bench);
+
+#define MATRIXORBITAL_DAMAGE_BENCH_OPS 100000
+
+struct matrixorbital_damage_bench {
+	struct matrixorbital_par *par;
+	/* Scratch accumulator, the device's damage is left alone */
+	struct matrixorbital_pending *pending;
+	spinlock_t *lock;
+	struct completion *go;
+	struct completion done;
+	u32 deadline_us;
+	u32 seed;
+	u64 ns;
+};
+
+/* Report small random rectangles of damage as fast as possible */
+static int matrixorbital_damage_bench_thread(void *data)
+{
+	struct matrixorbital_damage_bench *b = data;
+	struct matrixorbital_par *par = b->par;
+	struct matrixorbital_rect rect;
+	ktime_t start;
+	u32 i, r;
+
+	wait_for_completion(b->go);
+	start = ktime_get();
+	for (i = 0; i < MATRIXORBITAL_DAMAGE_BENCH_OPS; i++) {
+		b->seed ^= b->seed << 13;
+		b->seed ^= b->seed >> 17;
+		b->seed ^= b->seed << 5;
+		r = b->seed;
+		rect.x = r % par->width;
+		rect.y = (r >> 8) % par->height;
+		rect.width = 1 + (r >> 16) % 16;
+		rect.height = 1 + (r >> 24) % 8;
+		matrixorbital_rect_clip(&rect, par->width, par->height);
+		matrixorbitalfb_accumulate(par, b->pending, b->lock, &rect, b->deadline_us);
+	}
+	b->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+	kthread_complete_and_exit(&b->done, 0);
+#else
+	complete_and_exit(&b->done, 0);
+#endif
+}
+
+/* Average ns per damage report of n threads reporting at once */
+static s64 matrixorbital_damage_bench_run(struct matrixorbital_par *par,
+					  struct matrixorbital_damage_bench *b,
+					  int n, u32 deadline_us)
+{
+	struct matrixorbital_pending *pending;
+	struct task_struct *task;
+	struct completion go;
+	spinlock_t lock;
+	u64 ns = 0;
+	int i, started;
+
+	pending = kzalloc(sizeof(*pending), GFP_KERNEL);
+	if (!pending)
+		return -ENOMEM;
+	spin_lock_init(&lock);
+
+	init_completion(&go);
+	for (started = 0; started < n; started++) {
+		b[started].par = par;
+		b[started].pending = pending;
+		b[started].lock = &lock;
+		b[started].go = &go;
+		b[started].deadline_us = deadline_us;
+		b[started].seed = 2463534242U + started;
+		init_completion(&b[started].done);
+		task = kthread_run(matrixorbital_damage_bench_thread, &b[started],
+				   "matrixorbital-bench/%d", started);
+		if (IS_ERR(task))
+			break;
+	}
+
+	complete_all(&go);
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&b[i].done);
+		ns += b[i].ns;
+	}
+	kfree(pending);
+	if (started < n)
+		return -ENOMEM;
+
+	return div_u64(ns, n * MATRIXORBITAL_DAMAGE_BENCH_OPS);
+}
+
+/*
+ * Contention of the damage accumulator: 1, 2, 4 ... threads, one per CPU at
+ * most, reporting damage with the default deadline through the lock free
+ * tiles and with a deadline of their own through the lock. They fill a
+ * scratch accumulator with the device's zones, so nothing is traced,
+ * captured or uploaded.
+ */
+static int matrixorbital_damage_bench_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_par *par = s->private;
+	int cpus = num_online_cpus(), n;
+	struct matrixorbital_damage_bench *b;
+	s64 tiles, locked;
+
+	b = kcalloc(cpus, sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	seq_puts(s, "threads  tiles ns/op  locked ns/op\n");
+	for (n = 1; n <= cpus; n = n < cpus && n * 2 > cpus ? cpus : n * 2) {
+		tiles = matrixorbital_damage_bench_run(par, b, n, 0);
+		locked = matrixorbital_damage_bench_run(par, b, n,
+							par->deadline_ms * USEC_PER_MSEC);
+		if (tiles < 0 || locked < 0)
+			break;
+		seq_printf(s, "%7d %12lld %13lld\n", n, tiles, locked);
+		if (n == cpus)
+			break;
+	}
+	kfree(b);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_damage_bench);
+
+static int matrixorbital_capture_open(struct inode *inode, struct file *file)
+{
+	struct matrixorbital_par *par = inode->i_private;
+	unsigned long flags;
+	int ret;
+
+	if (atomic_cmpxchg(&par->capture_open, 0, 1))
+		return -EBUSY;
+
+	ret = kfifo_alloc(&par->capture, MATRIXORBITAL_CAPTURE_SIZE, GFP_KERNEL);
+	if (ret) {
+		atomic_set(&par->capture_open, 0);
+		return ret;
+	}
+
+	spin_lock_irqsave(&par->capture_lock, flags);
+	par->capture_dropped = 0;
+	par->capturing = true;
+	spin_unlock_irqrestore(&par->capture_lock, flags);
+
+	file->private_data = par;
+
+	return nonseekable_open(inode, file);
+}
+
+static int matrixorbital_capture_release(struct inode *inode, struct file *file)
+{
+	struct matrixorbital_par *par = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&par->capture_lock, flags);
+	par->capturing = false;
+	spin_unlock_irqrestore(&par->capture_lock, flags);
+
+	if (par->capture_dropped)
+		dev_warn(&par->client->dev, "capture dropped %llu records\n",
+			 par->capture_dropped);
+
+	kfifo_free(&par->capture);
+	atomic_set(&par->capture_open, 0);
+
+	return 0;
+}
+
+static ssize_t matrixorbital_capture_read(struct file *file, char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	struct matrixorbital_par *par = file->private_data;
+	unsigned int copied;
+	int ret;
+
+	if (kfifo_is_empty(&par->capture)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(par->capture_wait,
+					       !kfifo_is_empty(&par->capture));
+		if (ret)
+			return ret;
+	}
+
+	ret = kfifo_to_user(&par->capture, buf, count, &copied);
+
+	return ret ? ret : copied;
+}
+
+static const struct file_operations matrixorbital_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= matrixorbital_capture_open,
+	.release	= matrixorbital_capture_release,
+	.read		= matrixorbital_capture_read,
+	.llseek		= no_llseek,
+};
+
+static int matrixorbital_bus_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_par *par = s->private;
+	struct matrixorbital_bus *bus = par->bus;
+
+	seq_printf(s, "adapter: %s\n", bus->adapter->name);
+	seq_printf(s, "freq_hz: %u\n", bus->freq);
+	seq_printf(s, "budget_percent: %u\n", bus_budget);
+	seq_printf(s, "window_ms: %u\n", MATRIXORBITAL_BUS_SLOTS * MATRIXORBITAL_BUS_SLOT_MS);
+	seq_printf(s, "display_permille: %u\n",
+		   matrixorbital_bus_utilization(bus, MATRIXORBITAL_BUS_DISPLAY));
+	seq_printf(s, "control_permille: %u\n",
+		   matrixorbital_bus_utilization(bus, MATRIXORBITAL_BUS_CONTROL));
+	seq_printf(s, "display_total_us: %llu\n",
+		   div_u64(bus->total_ns[MATRIXORBITAL_BUS_DISPLAY], NSEC_PER_USEC));
+	seq_printf(s, "control_total_us: %llu\n",
+		   div_u64(bus->total_ns[MATRIXORBITAL_BUS_CONTROL], NSEC_PER_USEC));
+	seq_printf(s, "throttled: %d\n", par->throttled);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_bus);
+
+static void matrixorbital_debugfs_init(struct matrixorbital_par *par)
+{
+	par->debugfs = debugfs_create_dir(dev_name(&par->client->dev),
+					  matrixorbital_debugfs_root);
+
+	debugfs_create_file("stats", 0444, par->debugfs, par,
+			    &matrixorbital_stats_fops);
+	debugfs_create_file("histograms", 0444, par->debugfs, par,
+			    &matrixorbital_histograms_fops);
+	debugfs_create_file("reset", 0200, par->debugfs, par,
+			    &matrixorbital_reset_fops);
+	debugfs_create_file("bus", 0444, par->debugfs, par,
+			    &matrixorbital_bus_fops);
+	debugfs_create_file("cost_model", 0644, par->debugfs, par,
+			    &matrixorbital_cost_model_fops);
+	debugfs_create_file("shadow", 0444, par->debugfs, par,
+			    &matrixorbital_shadow_fops);
+	debugfs_create_file("pack_bench", 0444, par->debugfs, par,
+			    &matrixorbital_pack_bench_fops);
+	debugfs_create_file("damage_bench", 0444, par->debugfs, par,
+			    &matrixorbital_damage_bench_fops);
+	debugfs_create_file("capture", 0400, par->debugfs, par,
+			    &matrixorbital_capture_fops);
+	debugfs_create_x32("capture_mask", 0600, par->debugfs, &par->capture_mask);
+}
+
+static struct matrixorbital_par *matrixorbital_dev_par(struct device *dev)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+
+	return info->par;
+}
+
+static ssize_t chunk_size_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->chunk_size));
+}
+
+static ssize_t chunk_size_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->chunk_size, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(chunk_size);
+
+static ssize_t chunk_gap_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->chunk_gap_us));
+}
+
+static ssize_t chunk_gap_us_store(struct device *dev, struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->chunk_gap_us, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(chunk_gap_us);
+
+static ssize_t max_hold_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->max_hold_us));
+}
+
+static ssize_t max_hold_us_store(struct device *dev, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->max_hold_us, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(max_hold_us);
+
+/* Longest the adapter was held by one transfer since the statistics were reset */
+static ssize_t worst_hold_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	unsigned long flags;
+	u64 ns;
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	ns = par->stats.hold_max_ns;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	return sprintf(buf, "%llu\n", div_u64(ns, NSEC_PER_USEC));
+}
+static DEVICE_ATTR_RO(worst_hold_us);
+
+static ssize_t deadline_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->deadline_ms));
+}
+
+static ssize_t deadline_ms_store(struct device *dev, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (!val)
+		return -EINVAL;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->deadline_ms, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(deadline_ms);
+
+/* One "x y width height deadline_ms" line per zone */
+static ssize_t qos_zones_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	struct matrixorbital_zone zones[MATRIXORBITAL_MAX_ZONES];
+	ssize_t len = 0;
+	u32 i, n, seq;
+
+	do {
+		seq = read_seqbegin(&par->zones_lock);
+		n = par->nr_zones;
+		memcpy(zones, par->zones, sizeof(zones));
+	} while (read_seqretry(&par->zones_lock, seq));
+
+	for (i = 0; i < n; i++)
+		len += sprintf(buf + len, "%u %u %u %u %u\n", zones[i].rect.x, zones[i].rect.y,
+			       zones[i].rect.width, zones[i].rect.height, zones[i].deadline_ms);
+
+	return len;
+}
+
+static ssize_t qos_zones_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	struct matrixorbital_zone zones[MATRIXORBITAL_MAX_ZONES], *z;
+	const char *p = skip_spaces(buf);
+	unsigned long flags;
+	u32 n = 0;
+	int len;
+
+	for (; *p; p = skip_spaces(p + len), n++) {
+		if (n == MATRIXORBITAL_MAX_ZONES)
+			return -ENOSPC;
+		z = &zones[n];
+		if (sscanf(p, "%u %u %u %u %u%n", &z->rect.x, &z->rect.y, &z->rect.width,
+			   &z->rect.height, &z->deadline_ms, &len) != 5)
+			return -EINVAL;
+		matrixorbital_rect_clip(&z->rect, par->width, par->height);
+	}
+
+	write_seqlock_irqsave(&par->zones_lock, flags);
+	memcpy(par->zones, zones, n * sizeof(*zones));
+	par->nr_zones = n;
+	write_sequnlock_irqrestore(&par->zones_lock, flags);
+
+	return count;
+}
+static DEVICE_ATTR_RW(qos_zones);
+
+static ssize_t deadline_misses_show(struct device *dev, struct device_attribute *attr,
+				    char *buf)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	unsigned long flags;
+	u64 misses;
+
+	spin_lock_irqsave(&par->stats.lock, flags);
+	misses = par->stats.deadline_misses;
+	spin_unlock_irqrestore(&par->stats.lock, flags);
+
+	return sprintf(buf, "%llu\n", misses);
+}
+static DEVICE_ATTR_RO(deadline_misses);
+
+static ssize_t present_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", !READ_ONCE(matrixorbital_dev_par(dev)->absent));
+}
+static DEVICE_ATTR_RO(present);
+
+static ssize_t sync_check_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", READ_ONCE(matrixorbital_dev_par(dev)->sync_check));
+}
+
+static ssize_t sync_check_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->sync_check, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(sync_check);
+
+static ssize_t sync_errors_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n", READ_ONCE(matrixorbital_dev_par(dev)->sync_errors));
+}
+static DEVICE_ATTR_RO(sync_errors);
+
+/* Reads the outcome of the last search, writing 1 starts a new one */
+static ssize_t calibrate_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+
+	if (atomic_read(&par->calibrating))
+		return sprintf(buf, "running\n");
+	if (par->calibrate_result == -ENODATA)
+		return sprintf(buf, "not run\n");
+	if (par->calibrate_result)
+		return sprintf(buf, "failed %d\n", par->calibrate_result);
+	return sprintf(buf, "chunk_size %u chunk_gap_us %u rate %u\n", par->chunk_size,
+		       par->chunk_gap_us, par->calibrate_rate);
+}
+
+static ssize_t calibrate_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+	if (!val)
+		return count;
+	if (atomic_xchg(&par->calibrating, 1))
+		return -EBUSY;
+
+	matrixorbital_queue_work(par, &par->calibrate_work);
+
+	return count;
+}
+static DEVICE_ATTR_RW(calibrate);
+
+static ssize_t fade_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->fade_ms));
+}
+
+static ssize_t fade_ms_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->fade_ms, val);
+	pm_runtime_set_autosuspend_delay(dev, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(fade_ms);
+
+static ssize_t fade_rate_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->fade_rate));
+}
+
+static ssize_t fade_rate_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (!val || val > 1000)
+		return -EINVAL;
+	WRITE_ONCE(matrixorbital_dev_par(dev)->fade_rate, val);
+
+	return count;
+}
+static DEVICE_ATTR_RW(fade_rate);
+
+static ssize_t contrast_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(matrixorbital_dev_par(dev)->contrast));
+}
+
+static ssize_t contrast_store(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	u8 val;
+	int ret;
+
+	ret = kstrtou8(buf, 0, &val);
+	if (ret)
+		return ret;
+	WRITE_ONCE(par->contrast, val);
+	matrixorbital_bl_queue(par);
+	kthread_flush_work(&par->bl_work);
+
+	return par->contrast_sent == val ? count : -EIO;
+}
+static DEVICE_ATTR_RW(contrast);
+
+static ssize_t key_actions_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	struct matrixorbital_key_action actions[ARRAY_SIZE(matrixorbital_keymap)];
+	unsigned long flags;
+	ssize_t len = 0;
+	int i;
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	memcpy(actions, par->key_actions, sizeof(actions));
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+
+	for (i = 0; i < ARRAY_SIZE(actions); i++)
+		if (actions[i].gpo)
+			len += sprintf(buf + len, "%s %s %u %u\n", matrixorbital_keymap[i].name,
+				       actions[i].led ? "led" : "gpo", actions[i].gpo,
+				       actions[i].ms);
+
+	return len;
+}
+
+/* One "key gpo|led n ms" line per key, replacing all actions */
+static ssize_t key_actions_store(struct device *dev, struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	struct matrixorbital_key_action actions[ARRAY_SIZE(matrixorbital_keymap)] = { };
+	const char *p = skip_spaces(buf);
+	char key[16], kind[4];
+	unsigned long flags;
+	u32 n, ms;
+	int i, len;
+
+	for (; *p; p = skip_spaces(p + len)) {
+		if (sscanf(p, "%15s %3s %u %u%n", key, kind, &n, &ms, &len) != 4)
+			return -EINVAL;
+		for (i = 0; i < ARRAY_SIZE(matrixorbital_keymap); i++)
+			if (!strcmp(key, matrixorbital_keymap[i].name))
+				break;
+		if (i == ARRAY_SIZE(matrixorbital_keymap) || !n || n > MATRIXORBITAL_GPOS ||
+		    !ms || ms > 10000 || (strcmp(kind, "gpo") && strcmp(kind, "led")))
+			return -EINVAL;
+		actions[i].gpo = n;
+		actions[i].led = !strcmp(kind, "led");
+		actions[i].ms = ms;
+	}
+
+	spin_lock_irqsave(&par->gpo_lock, flags);
+	memcpy(par->key_actions, actions, sizeof(actions));
+	spin_unlock_irqrestore(&par->gpo_lock, flags);
+
+	return count;
+}
+static DEVICE_ATTR_RW(key_actions);
+
+static struct attribute *matrixorbital_attrs[] = {
+	&dev_attr_chunk_size.attr,
+	&dev_attr_chunk_gap_us.attr,
+	&dev_attr_max_hold_us.attr,
+	&dev_attr_worst_hold_us.attr,
+	&dev_attr_deadline_ms.attr,
+	&dev_attr_qos_zones.attr,
+	&dev_attr_deadline_misses.attr,
+	&dev_attr_sync_check.attr,
+	&dev_attr_sync_errors.attr,
+	&dev_attr_calibrate.attr,
+	&dev_attr_fade_ms.attr,
+	&dev_attr_fade_rate.attr,
+	&dev_attr_contrast.attr,
+	&dev_attr_key_actions.attr,
+	&dev_attr_present.attr,
+	NULL
+};
 
-static int matrixorbital_write_param(struct i2c_client *client, u8 cmd, u8 value)
+ATTRIBUTE_GROUPS(matrixorbital);
+
+/* sched_setscheduler_nocheck() isn't exported to modules since 5.9 */
+static void matrixorbital_worker_sched(struct task_struct *task)
 {
-	u8 data[3];
-	data[0] = 0xFE;
-	data[1] = cmd;
-	data[2] = value;
-	return matrixorbital_write_array(client, data, sizeof(data));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	if (!worker_rt)
+		sched_set_normal(task, 0);
+	else if (worker_rt == 1)
+		sched_set_fifo_low(task);
+	else
+		sched_set_fifo(task);
+#else
+	struct sched_param param = { .sched_priority = 0 };
+
+	if (worker_rt)
+		param.sched_priority = worker_rt == 1 ? 1 : MAX_RT_PRIO / 2;
+	sched_setscheduler_nocheck(task, worker_rt ? SCHED_FIFO : SCHED_NORMAL, &param);
+#endif
 }
 
-static int matrixorbital_read_param(struct i2c_client *client, u8 cmd)
+static int matrixorbital_worker_init(struct matrixorbital_par *par)
 {
-	u8 data;
-
+	struct device *dev = &par->client->dev;
 	int ret;
-	matrixorbital_write_cmd(client, cmd);
-	msleep(5);
-	ret = i2c_master_recv(client, &data, sizeof(data));
-	if (ret == 1)
-		return data;
-	else {
-		dev_err(&client->dev, "Couldn't recv 0x%x I2C command.\n", cmd);
-		return -1;
+
+	par->worker = kthread_create_worker(0, "matrixorbital/%s", dev_name(dev));
+	if (IS_ERR(par->worker)) {
+		ret = PTR_ERR(par->worker);
+		par->worker = NULL;
+		return ret;
 	}
-}
 
-static unsigned char reverse_bits_in_byte(unsigned char b) {
-	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-	return b;
+	matrixorbital_worker_sched(par->worker->task);
+
+	if (worker_cpu >= 0) {
+		if (worker_cpu < nr_cpu_ids && cpu_possible(worker_cpu))
+			ret = set_cpus_allowed_ptr(par->worker->task, cpumask_of(worker_cpu));
+		else
+			ret = -EINVAL;
+		if (ret)
+			dev_err(dev, "Couldn't bind I/O thread to CPU %d: %d\n", worker_cpu, ret);
+	}
+
+	return 0;
 }
 
-static void matrixorbitalfb_update_display(struct matrixorbital_par *par)
+static int matrixorbital_pack_kernels_show(struct seq_file *s, void *unused)
 {
-	u8 *vmem = par->info->screen_base;
 	int i;
-	int len = 6 + par->width * par->height / 8;
 
-	u8 *data = kzalloc(len, GFP_KERNEL);
-	if (!data)
-		return;
-
-	data[0] = 0xFE;
-	data[1] = MATRIXORBITAL_DRAW_BITMAP_DIRECTLY;
-	data[2] = 0;
-	data[3] = 0;
-	data[4] = par->width;
-	data[5] = par->height;
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_pack_impls); i++) {
+		struct matrixorbital_pack_impl *impl = &matrixorbital_pack_impls[i];
 
-	for (i = 0; i < (par->height * par->width / 8); i++)
-		data[i+6] = reverse_bits_in_byte(*(vmem + i));
+		if (!impl->usable())
+			continue;
+		seq_printf(s, "%c %-8s pack %5u MB/s diff %5u MB/s\n",
+			   impl == matrixorbital_pack_impl ? '*' : ' ', impl->name,
+			   impl->pack_mbps, impl->trim_mbps);
+	}
 
-	matrixorbital_write_array(par->client, data, len);
-	kfree(data);
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_pack_kernels);
 
-static ssize_t matrixorbitalfb_write(struct fb_info *info, const char __user *buf,
-		size_t count, loff_t *ppos)
-{
-	struct matrixorbital_par *par = info->par;
-	unsigned long total_size;
-	unsigned long p = *ppos;
-	u8 __iomem *dst;
-
-	total_size = info->fix.smem_len;
+/*
+ * Panels tiled into one larger framebuffer. The wall has video memory of
+ * its own; what is drawn into it is copied into the video memory of the
+ * panels it covers and reported to them as damage, so every panel uploads
+ * its part on its own I/O thread and panels on different adapters flush in
+ * parallel.
+ */
+#define MATRIXORBITAL_WALL_MAX 16
 
-	if (p > total_size)
-		return -EINVAL;
+struct matrixorbital_wall {
+	struct fb_info *info;
+	u32 cols;
+	u32 rows;
+	u32 nr_panels;
+	char names[MATRIXORBITAL_WALL_MAX][32];
+	struct matrixorbital_par *panels[MATRIXORBITAL_WALL_MAX];
+};
 
-	if (count + p > total_size)
-		count = total_size - p;
+/* Panels join and leave the wall under matrixorbital_wall_lock */
+static DEFINE_MUTEX(matrixorbital_wall_lock);
+static struct matrixorbital_wall matrixorbital_wall;
 
-	if (!count)
-		return -EINVAL;
+static int matrixorbital_wall_parse(struct matrixorbital_wall *w, const char *layout)
+{
+	char *buf, *rows, *row, *name;
+	int ret = -EINVAL;
+	u32 cols;
 
-	dst = (void __force *) (info->screen_base + p);
+	buf = kstrdup(layout, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
 
-	if (copy_from_user(dst, buf, count))
-		return -EFAULT;
+	rows = buf;
+	while ((row = strsep(&rows, ";"))) {
+		row = strim(row);
+		if (!*row)
+			continue;
+		for (cols = 0; (name = strsep(&row, ",")); cols++) {
+			name = strim(name);
+			if (!*name || w->nr_panels == MATRIXORBITAL_WALL_MAX ||
+			    strscpy(w->names[w->nr_panels++], name, sizeof(w->names[0])) < 0)
+				goto out;
+		}
+		if (w->rows && cols != w->cols)
+			goto out;
+		w->cols = cols;
+		w->rows++;
+	}
+	ret = w->nr_panels ? 0 : -EINVAL;
+out:
+	kfree(buf);
+	if (ret)
+		memset(w, 0, sizeof(*w));
+	return ret;
+}
 
-	matrixorbitalfb_update_display(par);
+/* Copy a part of the wall into the panels it covers and have them upload it */
+static void matrixorbital_wall_damage(struct matrixorbital_wall *w, u16 op,
+				      u32 x, u32 y, u32 width, u32 height)
+{
+	struct fb_info *info = w->info;
+	u32 line_length = info->fix.line_length;
+	struct matrixorbital_rect rect = { x, y, width, height }, part;
+	struct matrixorbital_par *par;
+	u32 i, px, py;
 
-	*ppos += count;
+	matrixorbital_rect_clip(&rect, info->var.xres, info->var.yres);
+	for (i = 0; i < w->nr_panels; i++) {
+		par = w->panels[i];
+		px = i % w->cols * par->width;
+		py = i / w->cols * par->height;
+		part = (struct matrixorbital_rect){ px, py, par->width, par->height };
+		matrixorbital_rect_intersect(&part, &rect);
+		if (matrixorbital_rect_empty(&part))
+			continue;
 
-	return count;
+		part.x -= px;
+		part.y -= py;
+		matrixorbital_copy_rect_stride(par->info->screen_base, par->info->fix.line_length,
+					       info->screen_base + py * line_length + px / 8,
+					       line_length, &part);
+		matrixorbitalfb_damage(par, op, part.x, part.y, part.width, part.height, 0);
+		matrixorbitalfb_kick(par);
+	}
 }
 
-static int matrixorbitalfb_blank(int blank_mode, struct fb_info *info)
+static ssize_t matrixorbital_wall_write(struct fb_info *info, const char __user *buf,
+					size_t count, loff_t *ppos)
 {
-	return 0;
+	u32 line_length = info->fix.line_length;
+	ssize_t ret = fb_sys_write(info, buf, count, ppos);
+	u32 y0, y1;
+
+	if (ret <= 0)
+		return ret;
+
+	y0 = (*ppos - ret) / line_length;
+	y1 = DIV_ROUND_UP(*ppos, line_length);
+	matrixorbital_wall_damage(info->par, MATRIXORBITAL_DAMAGE_WRITE, 0, y0,
+				  info->var.xres, y1 - y0);
+	return ret;
 }
 
-static void matrixorbitalfb_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+static void matrixorbital_wall_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
 {
-	struct matrixorbital_par *par = info->par;
 	sys_fillrect(info, rect);
-	matrixorbitalfb_update_display(par);
+	matrixorbital_wall_damage(info->par, MATRIXORBITAL_DAMAGE_FILLRECT, rect->dx, rect->dy,
+				  rect->width, rect->height);
 }
 
-static void matrixorbitalfb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+static void matrixorbital_wall_copyarea(struct fb_info *info, const struct fb_copyarea *area)
 {
-	struct matrixorbital_par *par = info->par;
 	sys_copyarea(info, area);
-	matrixorbitalfb_update_display(par);
+	matrixorbital_wall_damage(info->par, MATRIXORBITAL_DAMAGE_COPYAREA, area->dx, area->dy,
+				  area->width, area->height);
 }
 
-static void matrixorbitalfb_imageblit(struct fb_info *info, const struct fb_image *image)
+static void matrixorbital_wall_imageblit(struct fb_info *info, const struct fb_image *image)
 {
-	struct matrixorbital_par *par = info->par;
 	sys_imageblit(info, image);
-	matrixorbitalfb_update_display(par);
+	matrixorbital_wall_damage(info->par, MATRIXORBITAL_DAMAGE_IMAGEBLIT, image->dx,
+				  image->dy, image->width, image->height);
 }
 
-static struct fb_ops matrixorbitalfb_ops = {
-	.owner		= THIS_MODULE,
-	.fb_read	= fb_sys_read,
-	.fb_write	= matrixorbitalfb_write,
-	.fb_blank	= matrixorbitalfb_blank,
-	.fb_fillrect	= matrixorbitalfb_fillrect,
-	.fb_copyarea	= matrixorbitalfb_copyarea,
-	.fb_imageblit	= matrixorbitalfb_imageblit,
-};
-
-static void matrixorbitalfb_deferred_io(struct fb_info *info,
-				struct list_head *pagelist)
+/* The wall is flushed once all of its panels are, within one timeout */
+static int matrixorbital_wall_wait_flush(struct matrixorbital_wall *w,
+					 struct matrixorbital_flush_wait *req)
 {
-	matrixorbitalfb_update_display(info->par);
+	unsigned long end = jiffies + msecs_to_jiffies(req->timeout_ms);
+	struct matrixorbital_flush_wait part;
+	int ret;
+	u32 i;
+
+	req->flags = 0;
+	req->utilization = 0;
+	req->backoff_ms = 0;
+	for (i = 0; i < w->nr_panels; i++) {
+		part.timeout_ms = req->timeout_ms && time_before(jiffies, end) ?
+				  jiffies_to_msecs(end - jiffies) : 0;
+		ret = matrixorbitalfb_wait_flush(w->panels[i], &part);
+		if (ret)
+			return ret;
+		req->flags |= part.flags;
+		req->utilization = max(req->utilization, part.utilization);
+		req->backoff_ms = max(req->backoff_ms, part.backoff_ms);
+	}
+
+	return 0;
 }
 
-static int matrixorbital_init(struct matrixorbital_par *par)
+static int matrixorbital_wall_ioctl(struct fb_info *info, unsigned int cmd,
+				    unsigned long arg)
 {
-	int ret;
+	struct matrixorbital_wall *w = info->par;
+	void __user *argp = (void __user *)arg;
 
-	/* Use I2C for TX */
-	matrixorbital_write_param(par->client, MATRIXORBITAL_TX_PROTOCOL_SELECT, 0);
+	switch (cmd) {
+	case MATRIXORBITAL_IOCTL_WAIT_FLUSH: {
+		struct matrixorbital_flush_wait req;
+		int ret;
 
-	/* Read model */
-	ret = matrixorbital_read_param(par->client, MATRIXORBITAL_READ_MODULE_TYPE);
-	dev_err(&par->client->dev, "Module type 0x%02x\n", ret);
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		ret = matrixorbital_wall_wait_flush(w, &req);
+		if (ret)
+			return ret;
+		if (copy_to_user(argp, &req, sizeof(req)))
+			return -EFAULT;
+		return 0;
+	}
+	case MATRIXORBITAL_IOCTL_DAMAGE: {
+		struct matrixorbital_damage req;
 
-	/* Enable keypad poll mode */
-	ret = matrixorbital_write_cmd(par->client, MATRIXORBITAL_AUTO_TX_KEY_PRESS_OFF);
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		if (req.x >= info->var.xres || req.y >= info->var.yres)
+			return -EINVAL;
+		matrixorbital_wall_damage(w, MATRIXORBITAL_DAMAGE_IOCTL, req.x, req.y,
+					  req.width, req.height);
+		return 0;
+	}
+	default:
+		return -ENOTTY;
+	}
+}
 
-	/* Clear the screen */
-	ret = matrixorbital_write_cmd(par->client, MATRIXORBITAL_CLEAR_SCREEN);
+static int matrixorbital_wall_blank(int blank_mode, struct fb_info *info)
+{
+	struct matrixorbital_wall *w = info->par;
+	u32 i;
 
-	if (ret < 0)
-		return ret;
+	for (i = 0; i < w->nr_panels; i++)
+		matrixorbitalfb_blank(blank_mode, w->panels[i]->info);
 
 	return 0;
 }
 
-static void matrixorbital_report_key(struct input_dev *input, unsigned matrixorbital_keycode)
-{
-	u8 keycode = 0;
-
-	switch(matrixorbital_keycode)
-	{
-		case 0x41:
-			keycode = KEY_ESC;
-			break;
-		case 0x42:
-			keycode = KEY_UP;
-			break;
-		case 0x43:
-			keycode = KEY_RIGHT;
-			break;
-		case 0x44:
-			keycode = KEY_LEFT;
-			break;
-		case 0x45:
-			keycode = KEY_ENTER;
-			break;
-		case 0x47:
-			keycode = KEY_BACKSPACE;
-			break;
-		case 0x48:
-			keycode = KEY_DOWN;
-			break;
-		default:
-			dev_err(&input->dev, "Unknown keycode 0x%x\n", matrixorbital_keycode);
-			break;
-	}
+static struct fb_ops matrixorbital_wall_ops = {
+	.owner		= THIS_MODULE,
+	.fb_read	= fb_sys_read,
+	.fb_write	= matrixorbital_wall_write,
+	.fb_blank	= matrixorbital_wall_blank,
+	.fb_fillrect	= matrixorbital_wall_fillrect,
+	.fb_copyarea	= matrixorbital_wall_copyarea,
+	.fb_imageblit	= matrixorbital_wall_imageblit,
+	.fb_ioctl	= matrixorbital_wall_ioctl,
+};
 
-	dev_err(&input->dev, "Report key %d [0x%x]\n", keycode, matrixorbital_keycode);
+static void matrixorbital_wall_deferred_io(struct fb_info *info, struct list_head *pagelist)
+{
+	u32 lines_per_page = PAGE_SIZE / info->fix.line_length;
+	struct page *page;
 
-	input_report_key(input, keycode, 1);
-	input_sync(input);
+	list_for_each_entry(page, pagelist, lru) {
+		u32 y = page->index * lines_per_page;
 
-	input_report_key(input, keycode, 0);
-	input_sync(input);
+		if (y >= info->var.yres)
+			continue;
+		matrixorbital_wall_damage(info->par, MATRIXORBITAL_DAMAGE_MMAP, 0, y,
+					  info->var.xres, min(lines_per_page, info->var.yres - y));
+	}
 }
 
-static void matrixorbital_keypad_poll(struct input_polled_dev *ipdev)
+static struct fb_deferred_io matrixorbital_wall_defio = {
+	.deferred_io	= matrixorbital_wall_deferred_io,
+};
+
+static int matrixorbital_wall_register(struct matrixorbital_wall *w)
 {
-	struct matrixorbital_par *par = ipdev->private;
+	struct matrixorbital_par *first = w->panels[0];
+	struct fb_info *info;
+	u32 vmem_size;
+	u8 *vmem;
 	int ret;
 
-	do {
-		ret = matrixorbital_read_param(par->client, MATRIXORBITAL_POLL_KEY_PRESS);
-		if (ret < 0)
-			return;
+	info = framebuffer_alloc(0, &first->client->dev);
+	if (!info)
+		return -ENOMEM;
 
-		if (!ret)
-			return;
+	info->par = w;
+	info->fbops = &matrixorbital_wall_ops;
+	info->var = matrixorbitalfb_var;
+	info->var.xres = w->cols * first->width;
+	info->var.xres_virtual = info->var.xres;
+	info->var.yres = w->rows * first->height;
+	info->var.yres_virtual = info->var.yres;
+	info->var.red.length = 1;
+	info->var.green.length = 1;
+	info->var.blue.length = 1;
+	info->fix = matrixorbitalfb_fix;
+	info->fix.line_length = info->var.xres / 8;
 
-		matrixorbital_report_key(par->idev->input, ret & 0x7F);
-	} while (ret & 0x80);
+	vmem_size = info->fix.line_length * info->var.yres;
+	vmem = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, get_order(vmem_size));
+	if (!vmem) {
+		ret = -ENOMEM;
+		goto err_release;
+	}
+	info->screen_base = (u8 __force __iomem *)vmem;
+	info->fix.smem_start = __pa(vmem);
+	info->fix.smem_len = vmem_size;
+
+	matrixorbital_wall_defio.delay = HZ / refreshrate;
+	info->fbdefio = &matrixorbital_wall_defio;
+	fb_deferred_io_init(info);
+
+	w->info = info;
+	ret = register_framebuffer(info);
+	if (ret)
+		goto err_defio;
+
+	dev_info(&first->client->dev, "fb%d: %ux%u wall of %ux%u panels\n", info->node,
+		 info->var.xres, info->var.yres, w->cols, w->rows);
+	return 0;
+
+err_defio:
+	w->info = NULL;
+	fb_deferred_io_cleanup(info);
+	free_pages((unsigned long)vmem, get_order(vmem_size));
+err_release:
+	framebuffer_release(info);
+	return ret;
 }
 
-static void matrixorbital_led_set(struct led_classdev *cdev,
-			      enum led_brightness value)
+static void matrixorbital_wall_unregister(struct matrixorbital_wall *w)
 {
-	struct matrixorbital_led *led = container_of(cdev, struct matrixorbital_led, cdev);
+	struct fb_info *info = w->info;
+
+	unregister_framebuffer(info);
+	fb_deferred_io_cleanup(info);
+	free_pages((unsigned long)info->screen_base, get_order(info->fix.smem_len));
+	framebuffer_release(info);
+	w->info = NULL;
+}
 
-	led->brightness = value;
-	schedule_work(&led->work);
+/* Take the panel's place in the wall, and put the wall up once it's complete */
+static void matrixorbital_wall_join(struct matrixorbital_par *par)
+{
+	struct matrixorbital_wall *w = &matrixorbital_wall;
+	u32 i, n = 0;
+	int ret;
+
+	mutex_lock(&matrixorbital_wall_lock);
+	for (i = 0; i < w->nr_panels; i++) {
+		if (!strcmp(w->names[i], dev_name(&par->client->dev)))
+			w->panels[i] = par;
+		n += !!w->panels[i];
+	}
+
+	if (n && n == w->nr_panels && !w->info) {
+		ret = matrixorbital_wall_register(w);
+		if (ret)
+			dev_err(&par->client->dev, "Couldn't register the wall: %d\n", ret);
+	}
+	mutex_unlock(&matrixorbital_wall_lock);
 }
 
-static void matrixorbital_led_work(struct work_struct *work)
+/* The wall comes down with the first of its panels to go */
+static void matrixorbital_wall_leave(struct matrixorbital_par *par)
 {
-	struct matrixorbital_led *led = container_of(work, struct matrixorbital_led, work);
-	matrixorbital_write_param(led->client,
-		(led->brightness != LED_OFF) ? MATRIXORBITAL_GPO_OFF : MATRIXORBITAL_GPO_ON,
-		led->gpio_number);
+	struct matrixorbital_wall *w = &matrixorbital_wall;
+	u32 i;
+
+	mutex_lock(&matrixorbital_wall_lock);
+	for (i = 0; i < w->nr_panels; i++) {
+		if (w->panels[i] != par)
+			continue;
+		if (w->info)
+			matrixorbital_wall_unregister(w);
+		w->panels[i] = NULL;
+	}
+	mutex_unlock(&matrixorbital_wall_lock);
 }
 
 static int matrixorbital_probe(struct i2c_client *client, const struct i2c_device_id *id)
@@ -323,7 +4350,9 @@ static int matrixorbital_probe(struct i2c_client *client, const struct i2c_devic
 	struct matrixorbital_par *par;
 	u8 *vmem;
 	int ret;
-	struct input_polled_dev *keypad_dev;
+	struct input_dev *keypad_dev;
+	struct backlight_properties bl_props = { };
+	char bl_name[48];
 	int i;
 
 	info = framebuffer_alloc(sizeof(struct matrixorbital_par), &client->dev);
@@ -339,9 +4368,76 @@ static int matrixorbital_probe(struct i2c_client *client, const struct i2c_devic
 	par->info = info;
 	par->width = 192;
 	par->height = 64;
+	mutex_init(&par->lock);
+	spin_lock_init(&par->damage_lock);
+	spin_lock_init(&par->worker_lock);
+	seqlock_init(&par->zones_lock);
+	spin_lock_init(&par->stats.lock);
+	spin_lock_init(&par->cost.lock);
+	init_waitqueue_head(&par->flush_wait);
+	spin_lock_init(&par->capture_lock);
+	init_waitqueue_head(&par->capture_wait);
+	par->capture_mask = MATRIXORBITAL_CAPTURE_DAMAGE | MATRIXORBITAL_CAPTURE_COMMAND;
+	kthread_init_delayed_work(&par->flush_work, matrixorbitalfb_flush_work);
+	kthread_init_delayed_work(&par->key_work, matrixorbital_keypad_poll);
+	kthread_init_work(&par->calibrate_work, matrixorbital_calibrate_work);
+	spin_lock_init(&par->present_lock);
+	INIT_LIST_HEAD(&par->frames);
+	hrtimer_init(&par->present_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	par->present_timer.function = matrixorbitalfb_present_timer;
+	kthread_init_work(&par->present_work, matrixorbitalfb_present_work);
+	init_waitqueue_head(&par->present_wait);
+	kthread_init_work(&par->ring_work, matrixorbital_ring_work);
+	spin_lock_init(&par->gpo_lock);
+	kthread_init_work(&par->gpo_work, matrixorbital_gpo_work);
+	kthread_init_delayed_work(&par->pulse_work, matrixorbital_pulse_work);
+	kthread_init_delayed_work(&par->presence_work, matrixorbital_presence_work);
+	spin_lock_init(&par->fade_lock);
+	hrtimer_init(&par->fade_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	par->fade_timer.function = matrixorbital_fade_timer;
+	kthread_init_work(&par->bl_work, matrixorbital_bl_work);
+	par->fade_ms = fade_ms;
+	par->fade_rate = clamp(fade_rate, 1U, 1000U);
+	par->bl_level = -1;
+	par->contrast = 128;
+	par->contrast_sent = 128;
+	par->draw_color = -1;
+	par->calibrate_result = -ENODATA;
+	par->max_hold_us = max_hold_us;
+	par->deadline_ms = max(deadline_ms, 1U);
+
+	par->bus = matrixorbital_bus_get(client->adapter);
+	if (!par->bus) {
+		ret = -ENOMEM;
+		goto fb_alloc_error;
+	}
+
+	ret = matrixorbital_worker_init(par);
+	if (ret) {
+		dev_err(&client->dev, "Couldn't create the I/O thread.\n");
+		goto fb_alloc_error;
+	}
+
+	ret = kfifo_alloc(&par->present_done, MATRIXORBITAL_PRESENT_FEEDBACK *
+			  sizeof(struct matrixorbital_present_feedback), GFP_KERNEL);
+	if (ret)
+		goto fb_alloc_error;
 
 	vmem_size = par->width * par->height / 8;
 
+	par->shadow = devm_kzalloc(&client->dev, vmem_size, GFP_KERNEL);
+	if (!par->shadow) {
+		dev_err(&client->dev, "Couldn't allocate shadow memory.\n");
+		ret = -ENOMEM;
+		goto fb_alloc_error;
+	}
+
+	par->panic_buf = devm_kzalloc(&client->dev, 6 + vmem_size, GFP_KERNEL);
+	if (!par->panic_buf) {
+		ret = -ENOMEM;
+		goto fb_alloc_error;
+	}
+
 	vmem = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
 					get_order(vmem_size));
 	if (!vmem) {
@@ -355,11 +4451,12 @@ static int matrixorbital_probe(struct i2c_client *client, const struct i2c_devic
 	if (!matrixorbitalfb_defio) {
 		dev_err(&client->dev, "Couldn't allocate deferred io.\n");
 		ret = -ENOMEM;
-		goto fb_alloc_error;
+		goto vmem_error;
 	}
 
 	matrixorbitalfb_defio->delay = HZ / refreshrate;
 	matrixorbitalfb_defio->deferred_io = matrixorbitalfb_deferred_io;
+	matrixorbitalfb_defio->first_io = matrixorbitalfb_first_io;
 
 	info->fbops = &matrixorbitalfb_ops;
 	info->fix = matrixorbitalfb_fix;
@@ -391,43 +4488,82 @@ static int matrixorbital_probe(struct i2c_client *client, const struct i2c_devic
 	if (ret)
 		goto panel_init_error;
 
+	/* The panel was just cleared, which matches the zeroed video memory */
+	par->shadow_valid = true;
+
+	/* Backlight, and runtime PM held while the panel isn't blanked */
+	bl_props.type = BACKLIGHT_RAW;
+	bl_props.max_brightness = 255;
+	bl_props.brightness = 255;
+	snprintf(bl_name, sizeof(bl_name), "matrixorbital-%s", dev_name(&client->dev));
+	par->bl = backlight_device_register(bl_name, &client->dev, par, &matrixorbital_bl_ops,
+					    &bl_props);
+	if (IS_ERR(par->bl)) {
+		dev_err(&client->dev, "Couldn't register the backlight\n");
+		ret = PTR_ERR(par->bl);
+		goto panel_init_error;
+	}
+	backlight_update_status(par->bl);
+
+	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev, par->fade_ms);
+	pm_runtime_use_autosuspend(&client->dev);
+	pm_runtime_get_noresume(&client->dev);
+	pm_runtime_enable(&client->dev);
+
 	ret = register_framebuffer(info);
 	if (ret) {
 		dev_err(&client->dev, "Couldn't register the framebuffer\n");
-		goto panel_init_error;
+		goto bl_error;
 	}
 
 	/* Keypad */
-	keypad_dev = devm_input_allocate_polled_device(&client->dev);
+	keypad_dev = devm_input_allocate_device(&client->dev);
 	if (!keypad_dev) {
-		printk(KERN_ERR "Not enough memory\n");
-		return -ENOMEM;
+		dev_err(&client->dev, "Couldn't allocate the keypad\n");
+		ret = -ENOMEM;
+		goto err_free_dev;
 	}
 
-	keypad_dev->input->evbit[0] = BIT_MASK(EV_KEY);
-	keypad_dev->input->keybit[BIT_WORD(KEY_ESC)] |= BIT_MASK(KEY_ESC);
-	keypad_dev->input->keybit[BIT_WORD(KEY_BACKSPACE)] |= BIT_MASK(KEY_BACKSPACE);
-	keypad_dev->input->keybit[BIT_WORD(KEY_ENTER)] |= BIT_MASK(KEY_ENTER);
-	keypad_dev->input->keybit[BIT_WORD(KEY_UP)] |= BIT_MASK(KEY_UP);
-	keypad_dev->input->keybit[BIT_WORD(KEY_LEFT)] |= BIT_MASK(KEY_LEFT);
-	keypad_dev->input->keybit[BIT_WORD(KEY_RIGHT)] |= BIT_MASK(KEY_RIGHT);
-	keypad_dev->input->keybit[BIT_WORD(KEY_DOWN)] |= BIT_MASK(KEY_DOWN);
+	keypad_dev->evbit[0] = BIT_MASK(EV_KEY);
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_keymap); i++) {
+		u16 key = matrixorbital_keymap[i].keycode;
+
+		keypad_dev->keybit[BIT_WORD(key)] |= BIT_MASK(key);
+	}
 
-	keypad_dev->input->name = "matorb-keypad";
-	keypad_dev->input->id.bustype = BUS_I2C;
-	keypad_dev->poll = matrixorbital_keypad_poll;
-	keypad_dev->poll_interval = 500;
-	keypad_dev->poll_interval_max = 1000;
+	keypad_dev->name = "matorb-keypad";
+	keypad_dev->id.bustype = BUS_I2C;
+	keypad_dev->open = matrixorbital_keypad_open;
+	keypad_dev->close = matrixorbital_keypad_close;
 
-	keypad_dev->private	= par;
+	input_set_drvdata(keypad_dev, par);
 	par->idev = keypad_dev;
 
-	ret = input_register_polled_device(keypad_dev);
+	ret = input_register_device(keypad_dev);
 	if (ret) {
-		dev_err(&client->dev, "failed to register polled input device\n");
+		dev_err(&client->dev, "failed to register input device\n");
 		goto err_free_dev;
 	}
 
+	/* GPOs, with the LEDs on top */
+	par->gpio.label = "matrixorbital";
+	par->gpio.parent = &client->dev;
+	par->gpio.owner = THIS_MODULE;
+	par->gpio.base = -1;
+	par->gpio.ngpio = MATRIXORBITAL_GPOS;
+	par->gpio.can_sleep = true;
+	par->gpio.get_direction = matrixorbital_gpio_get_direction;
+	par->gpio.direction_output = matrixorbital_gpio_direction_output;
+	par->gpio.get = matrixorbital_gpio_get;
+	par->gpio.set = matrixorbital_gpio_set;
+	par->gpio.set_multiple = matrixorbital_gpio_set_multiple;
+	ret = gpiochip_add_data(&par->gpio, par);
+	if (ret) {
+		dev_err(&client->dev, "Couldn't register the GPOs\n");
+		goto err_input;
+	}
+
 	/* LEDs */
 	for (i = 0; i < ARRAY_SIZE(matrixorbital_leds); i++) {
 		struct matrixorbital_led *led;
@@ -439,9 +4575,8 @@ static int matrixorbital_probe(struct i2c_client *client, const struct i2c_devic
 		led->cdev.name = matrixorbital_leds[i];
 		led->cdev.brightness_set = matrixorbital_led_set;
 		led->cdev.default_trigger = "timer";
-		led->client = client;
+		led->par = par;
 		led->gpio_number = i + 1;
-		INIT_WORK(&(led->work), matrixorbital_led_work);
 
 		if (led_classdev_register(NULL, &led->cdev) < 0) {
 			kfree(led);
@@ -450,15 +4585,39 @@ static int matrixorbital_probe(struct i2c_client *client, const struct i2c_devic
 		par->led[i] = led;
 	}
 
+	matrixorbital_debugfs_init(par);
+
+	par->panic_nb.notifier_call = matrixorbital_panic;
+	atomic_notifier_chain_register(&panic_notifier_list, &par->panic_nb);
+
 	dev_info(&client->dev, "fb%d: %s framebuffer device registered, using %d bytes of video memory\n", info->node, info->fix.id, vmem_size);
 
+	matrixorbital_wall_join(par);
+
 	return 0;
 
+err_input:
+	input_unregister_device(par->idev);
 err_free_dev:
-	input_free_polled_device(keypad_dev);
+	unregister_framebuffer(info);
+	matrixorbitalfb_present_stop(par);
+bl_error:
+	pm_runtime_disable(&client->dev);
+	pm_runtime_put_noidle(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+	backlight_device_unregister(par->bl);
+	hrtimer_cancel(&par->fade_timer);
+	kthread_cancel_work_sync(&par->bl_work);
 panel_init_error:
 	fb_deferred_io_cleanup(info);
+	matrixorbital_worker_stop(par);
+vmem_error:
+	free_pages((unsigned long)vmem, get_order(vmem_size));
 fb_alloc_error:
+	matrixorbital_worker_stop(par);
+	kfifo_free(&par->present_done);
+	if (par->bus)
+		matrixorbital_bus_put(par->bus);
 	framebuffer_release(info);
 	return ret;
 }
@@ -469,27 +4628,89 @@ static int matrixorbital_remove(struct i2c_client *client)
 	struct matrixorbital_par *par = info->par;
 	int i;
 
+	matrixorbital_wall_leave(par);
+	atomic_notifier_chain_unregister(&panic_notifier_list, &par->panic_nb);
+	debugfs_remove_recursive(par->debugfs);
+	matrixorbital_worker_close(par);
+
 	for (i = 0; i < ARRAY_SIZE(matrixorbital_leds); i++) {
+		if (!par->led[i])
+			continue;
 		led_classdev_unregister(&par->led[i]->cdev);
-		cancel_work_sync(&(par->led[i]->work));
 		kfree(par->led[i]);
 		par->led[i] = NULL;
 	}
 
-	input_unregister_polled_device(par->idev);
-	input_free_polled_device(par->idev);
-
-	matrixorbital_write_cmd(par->client, MATRIXORBITAL_CLEAR_SCREEN);
+	/* Closing the input device stops key_work, the last to start pulses */
+	input_unregister_device(par->idev);
+	gpiochip_remove(&par->gpio);
+	kthread_cancel_delayed_work_sync(&par->pulse_work);
+	kthread_cancel_work_sync(&par->gpo_work);
 
 	unregister_framebuffer(info);
 
+	pm_runtime_disable(&client->dev);
+	if (!par->blanked)
+		pm_runtime_put_noidle(&client->dev);
+	pm_runtime_dont_use_autosuspend(&client->dev);
+	backlight_device_unregister(par->bl);
+	hrtimer_cancel(&par->fade_timer);
+	kthread_cancel_work_sync(&par->bl_work);
+
 	fb_deferred_io_cleanup(info);
+	matrixorbitalfb_present_stop(par);
+	mutex_lock(&matrixorbital_ring_lock);
+	if (par->ring)
+		matrixorbital_ring_detach(par->ring);
+	mutex_unlock(&matrixorbital_ring_lock);
+	kthread_cancel_work_sync(&par->ring_work);
+	kthread_cancel_work_sync(&par->calibrate_work);
+	matrixorbital_worker_stop(par);
+	kfree(par->cal.data);
+	kfifo_free(&par->present_done);
+
+	matrixorbital_write_cmd(par, MATRIXORBITAL_CLEAR_SCREEN);
+
+	matrixorbital_bus_put(par->bus);
 	__free_pages(__va(info->fix.smem_start), get_order(info->fix.smem_len));
 	framebuffer_release(info);
 
 	return 0;
 }
 
+/* Suspended, the backlight is off right away rather than faded out */
+static int matrixorbital_runtime_suspend(struct device *dev)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+	unsigned long flags;
+
+	par->suspended = true;
+	hrtimer_cancel(&par->fade_timer);
+	spin_lock_irqsave(&par->fade_lock, flags);
+	par->fade_target = 0;
+	par->bl_next = 0;
+	spin_unlock_irqrestore(&par->fade_lock, flags);
+	matrixorbital_bl_queue(par);
+	kthread_flush_work(&par->bl_work);
+
+	return 0;
+}
+
+static int matrixorbital_runtime_resume(struct device *dev)
+{
+	struct matrixorbital_par *par = matrixorbital_dev_par(dev);
+
+	par->suspended = false;
+	backlight_update_status(par->bl);
+
+	return 0;
+}
+
+static const struct dev_pm_ops matrixorbital_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(pm_runtime_force_suspend, pm_runtime_force_resume)
+	SET_RUNTIME_PM_OPS(matrixorbital_runtime_suspend, matrixorbital_runtime_resume, NULL)
+};
+
 static const struct i2c_device_id matrixorbital_i2c_id[] = {
 	{ "matrixorbital", 0 },
 	{ }
@@ -501,10 +4722,43 @@ static struct i2c_driver matrixorbital_driver = {
 	.id_table = matrixorbital_i2c_id,
 	.driver = {
 		.name = "matrixorbital",
+		.pm = &matrixorbital_pm_ops,
+		.dev_groups = matrixorbital_groups,
 	},
 };
 
-module_i2c_driver(matrixorbital_driver);
+static int __init matrixorbital_module_init(void)
+{
+	int ret;
+
+	matrixorbital_pack_impl = matrixorbital_simd_select(pack_kernel);
+
+	if (wall) {
+		ret = matrixorbital_wall_parse(&matrixorbital_wall, wall);
+		if (ret) {
+			pr_err("matrixorbital: bad wall layout \"%s\"\n", wall);
+			return ret;
+		}
+	}
+
+	matrixorbital_debugfs_root = debugfs_create_dir("matrixorbital", NULL);
+	debugfs_create_file("pack_kernels", 0444, matrixorbital_debugfs_root, NULL,
+			    &matrixorbital_pack_kernels_fops);
+
+	ret = i2c_add_driver(&matrixorbital_driver);
+	if (ret)
+		debugfs_remove_recursive(matrixorbital_debugfs_root);
+
+	return ret;
+}
+module_init(matrixorbital_module_init);
+
+static void __exit matrixorbital_module_exit(void)
+{
+	i2c_del_driver(&matrixorbital_driver);
+	debugfs_remove_recursive(matrixorbital_debugfs_root);
+}
+module_exit(matrixorbital_module_exit);
 
 MODULE_DESCRIPTION("FB driver for the Matrix Orbital GLK19264 LCD controller");
 MODULE_AUTHOR("Viktar Palstsiuk <viktar.palstsiuk@promwad.com>");
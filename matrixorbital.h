@@ -0,0 +1,217 @@
+/*
+ * Userspace interface of the Matrix Orbital GLK19264 LCD controller driver
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#ifndef _MATRIXORBITAL_H
+#define _MATRIXORBITAL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Controller command set, every command is prefixed by MATRIXORBITAL_CMD */
+#define MATRIXORBITAL_CMD			0xFE
+
+#define MATRIXORBITAL_POLL_KEY_PRESS		0x26
+#define MATRIXORBITAL_READ_MODULE_TYPE		0x37
+#define MATRIXORBITAL_BACKLIGHT_ON		0x42
+#define MATRIXORBITAL_BACKLIGHT_OFF		0x46
+#define MATRIXORBITAL_AUTO_TX_KEY_PRESS_OFF	0x4F
+#define MATRIXORBITAL_SET_CONTRAST		0x50
+#define MATRIXORBITAL_GPO_OFF			0x56
+#define MATRIXORBITAL_GPO_ON			0x57
+#define MATRIXORBITAL_CLEAR_SCREEN		0x58
+#define MATRIXORBITAL_DRAW_BITMAP_DIRECTLY	0x64
+#define MATRIXORBITAL_SET_BRIGHTNESS		0x99
+#define MATRIXORBITAL_TX_PROTOCOL_SELECT	0xA0
+
+/* Graphics and text commands understood by the controller */
+#define MATRIXORBITAL_SET_CURSOR_POSITION	0x47
+#define MATRIXORBITAL_GO_HOME			0x48
+#define MATRIXORBITAL_SET_DRAWING_COLOR		0x63
+#define MATRIXORBITAL_CONTINUE_LINE		0x65
+#define MATRIXORBITAL_DRAW_LINE			0x6C
+#define MATRIXORBITAL_DRAW_PIXEL		0x70
+#define MATRIXORBITAL_DRAW_RECTANGLE		0x72
+#define MATRIXORBITAL_DRAW_FILLED_RECTANGLE	0x78
+#define MATRIXORBITAL_SET_CURSOR_COORDINATE	0x79
+
+#define MATRIXORBITAL_IOCTL_BASE	'M'
+
+/* matrixorbital_flush_wait.flags */
+#define MATRIXORBITAL_FLUSH_THROTTLED	(1 << 0)
+#define MATRIXORBITAL_FLUSH_TIMEOUT	(1 << 1)
+
+/*
+ * Wait until all damage made so far has reached the panel. The driver
+ * reports whether display traffic is being throttled to stay within the
+ * bus budget and how long the client should back off before drawing again.
+ */
+struct matrixorbital_flush_wait {
+	__u32 timeout_ms;	/* in: 0 only samples the current state */
+	__u32 flags;		/* out: MATRIXORBITAL_FLUSH_* */
+	__u32 utilization;	/* out: display share of the bus, per mille */
+	__u32 backoff_ms;	/* out: suggested delay before the next update */
+};
+
+#define MATRIXORBITAL_IOCTL_WAIT_FLUSH \
+	_IOWR(MATRIXORBITAL_IOCTL_BASE, 0x01, struct matrixorbital_flush_wait)
+
+/*
+ * Report a rectangle changed through mmap and upload it right away instead
+ * of waiting for the deferred I/O tick.
+ */
+struct matrixorbital_damage {
+	__u32 x;
+	__u32 y;
+	__u32 width;
+	__u32 height;
+};
+
+#define MATRIXORBITAL_IOCTL_DAMAGE \
+	_IOW(MATRIXORBITAL_IOCTL_BASE, 0x02, struct matrixorbital_damage)
+
+/*
+ * Same, with a deadline by which the rectangle should be on the panel.
+ * Pending damage is uploaded earliest deadline first, so a short deadline
+ * lets urgent content overtake a large redraw.
+ */
+struct matrixorbital_damage_qos {
+	__u32 x;
+	__u32 y;
+	__u32 width;
+	__u32 height;
+	__u32 deadline_us;	/* from now, 0 for the device default */
+	__u32 flags;		/* must be 0 */
+};
+
+#define MATRIXORBITAL_IOCTL_DAMAGE_QOS \
+	_IOW(MATRIXORBITAL_IOCTL_BASE, 0x03, struct matrixorbital_damage_qos)
+
+/*
+ * Queue a frame to be on the panel at target_ns. data points to height
+ * framebuffer lines starting at line y; only the pixels inside the
+ * rectangle are used. The driver starts the upload early enough, judged by
+ * the measured bus speed, to finish by the target. A frame whose rectangle
+ * is covered by a later frame due at the same time is dropped.
+ */
+struct matrixorbital_present {
+	__u32 x;
+	__u32 y;
+	__u32 width;
+	__u32 height;
+	__u64 target_ns;	/* CLOCK_MONOTONIC */
+	__u64 data;		/* pointer to height * line_length bytes */
+	__u64 cookie;		/* handed back in the feedback */
+};
+
+#define MATRIXORBITAL_IOCTL_PRESENT \
+	_IOW(MATRIXORBITAL_IOCTL_BASE, 0x04, struct matrixorbital_present)
+
+/* matrixorbital_present_feedback.flags */
+#define MATRIXORBITAL_PRESENT_DROPPED	(1 << 0)	/* superseded, never shown */
+#define MATRIXORBITAL_PRESENT_LATE	(1 << 1)	/* shown after target_ns */
+#define MATRIXORBITAL_PRESENT_FAILED	(1 << 2)	/* upload deferred, time unknown */
+
+/*
+ * What became of a queued frame, oldest first. Fails with EAGAIN if
+ * nothing happened to any frame within timeout_ms.
+ */
+struct matrixorbital_present_feedback {
+	__u32 timeout_ms;	/* in: 0 doesn't wait */
+	__u32 flags;		/* out: MATRIXORBITAL_PRESENT_* */
+	__u64 cookie;		/* out */
+	__u64 target_ns;	/* out */
+	__u64 presented_ns;	/* out: when the upload finished, CLOCK_MONOTONIC */
+};
+
+#define MATRIXORBITAL_IOCTL_PRESENT_FEEDBACK \
+	_IOWR(MATRIXORBITAL_IOCTL_BASE, 0x05, struct matrixorbital_present_feedback)
+
+/*
+ * Command ring shared between one client and the driver. The ioctl
+ * returns a file to mmap the ring from, size bytes at offset 0, and to
+ * poll for free entries. The client fills entries at head and publishes
+ * them by advancing head with release semantics; the driver consumes them
+ * in batches and advances tail. While need_wakeup is set the driver is
+ * idle, and the client has to write to its eventfd after publishing. One
+ * ring per device.
+ */
+struct matrixorbital_ring_setup {
+	__s32 eventfd;		/* in: doorbell the client writes to */
+	__s32 fd;		/* out: ring file */
+	__u32 entries;		/* out: number of entries, a power of two */
+	__u32 size;		/* out: bytes to map */
+};
+
+#define MATRIXORBITAL_IOCTL_RING \
+	_IOWR(MATRIXORBITAL_IOCTL_BASE, 0x06, struct matrixorbital_ring_setup)
+
+/* matrixorbital_ring_entry.op */
+#define MATRIXORBITAL_RING_DAMAGE	1	/* x0, y0, x1 = width, y1 = height */
+#define MATRIXORBITAL_RING_PIXEL	2	/* x0, y0 */
+#define MATRIXORBITAL_RING_LINE		3	/* x0, y0 to x1, y1 */
+#define MATRIXORBITAL_RING_RECT		4	/* corners x0, y0 and x1, y1 */
+#define MATRIXORBITAL_RING_FILLED_RECT	5
+
+/*
+ * Drawing entries are drawn into video memory by the driver. Pixels and
+ * rectangles are sent to the controller as drawing commands, which is much
+ * less bus traffic than uploading the pixels; lines are uploaded as pixels.
+ * Damage entries report changes made through mmap.
+ */
+struct matrixorbital_ring_entry {
+	__u8 op;		/* MATRIXORBITAL_RING_* */
+	__u8 color;		/* drawing: 0 clears pixels, anything else sets them */
+	__u16 reserved;
+	__u32 deadline_us;	/* damage: as for MATRIXORBITAL_IOCTL_DAMAGE_QOS */
+	__u16 x0;
+	__u16 y0;
+	__u16 x1;
+	__u16 y1;
+};
+
+struct matrixorbital_ring {
+	__u32 head;		/* written by the client */
+	__u32 need_wakeup;	/* written by the driver */
+	__u8 pad0[56];
+	__u32 tail;		/* written by the driver */
+	__u32 entries;		/* written by the driver */
+	__u32 invalid;		/* written by the driver: entries rejected */
+	__u8 pad1[52];
+	struct matrixorbital_ring_entry entry[];
+};
+
+/*
+ * Capture log, read from the "capture" debugfs file of a device. Every
+ * record is a header followed by len bytes of payload: the framebuffer
+ * lines covering the damage for MATRIXORBITAL_CAPTURE_DAMAGE, the bytes
+ * sent to the controller for MATRIXORBITAL_CAPTURE_COMMAND.
+ */
+#define MATRIXORBITAL_CAPTURE_DAMAGE	1
+#define MATRIXORBITAL_CAPTURE_COMMAND	2
+
+/* Where damage came from, matrixorbital_capture_record.op */
+#define MATRIXORBITAL_DAMAGE_WRITE	1
+#define MATRIXORBITAL_DAMAGE_FILLRECT	2
+#define MATRIXORBITAL_DAMAGE_COPYAREA	3
+#define MATRIXORBITAL_DAMAGE_IMAGEBLIT	4
+#define MATRIXORBITAL_DAMAGE_MMAP	5
+#define MATRIXORBITAL_DAMAGE_IOCTL	6
+#define MATRIXORBITAL_DAMAGE_PRESENT	7
+#define MATRIXORBITAL_DAMAGE_RING	8
+
+struct matrixorbital_capture_record {
+	__u16 type;		/* MATRIXORBITAL_CAPTURE_* */
+	__u16 op;		/* MATRIXORBITAL_DAMAGE_* */
+	__u32 len;		/* payload bytes following the header */
+	__u64 time_ns;		/* CLOCK_MONOTONIC */
+	__u16 x;
+	__u16 y;
+	__u16 width;
+	__u16 height;
+};
+
+#endif /* _MATRIXORBITAL_H */
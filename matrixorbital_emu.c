@@ -0,0 +1,495 @@
+/*
+ * Virtual I2C adapter emulating the Matrix Orbital GLK19264 LCD controller
+ *
+ * Registers an I2C adapter with a GLK19264 behind it so the matrixorbital
+ * driver can be exercised and timed without hardware. The emulated panel
+ * and the command statistics are exported in debugfs, where faults can be
+ * injected into the transfers as well.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/i2c.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "matrixorbital.h"
+#include "matrixorbital_parse.h"
+
+#define MATRIXORBITAL_EMU_KEYS 16
+#define MATRIXORBITAL_EMU_GPOS 6
+
+static u_int addr = 0x28;
+module_param(addr, uint, 0444);
+MODULE_PARM_DESC(addr, "I2C address of the emulated controller (default 0x28)");
+
+static u_int module_type;
+module_param(module_type, uint, 0644);
+MODULE_PARM_DESC(module_type, "Value returned by the read module type command");
+
+static u_int bus_freq;
+module_param(bus_freq, uint, 0644);
+MODULE_PARM_DESC(bus_freq, "Simulated I2C clock in Hz, 0 completes transfers instantly");
+
+static u_short max_write_len;
+module_param(max_write_len, ushort, 0444);
+MODULE_PARM_DESC(max_write_len, "Adapter quirk: longest write message in bytes, 0 for no limit");
+
+static u_int rx_buffer;
+module_param(rx_buffer, uint, 0644);
+MODULE_PARM_DESC(rx_buffer, "Controller input buffer in bytes, bytes arriving while it is full are lost, 0 for no limit");
+
+static u_int rx_rate = 20000;
+module_param(rx_rate, uint, 0644);
+MODULE_PARM_DESC(rx_rate, "Bytes per second the controller takes from its input buffer (default 20000)");
+
+enum matrixorbital_emu_fault_type {
+	MATRIXORBITAL_EMU_FAULT_NONE = -1,
+	/* Address not acknowledged, nothing reaches the controller */
+	MATRIXORBITAL_EMU_FAULT_NACK,
+	/* Data NACKed halfway, the first half reaches the controller */
+	MATRIXORBITAL_EMU_FAULT_TRUNCATE,
+	/* Reported as sent, nothing reaches the controller */
+	MATRIXORBITAL_EMU_FAULT_DROP,
+	/* Clock stretched by fault_delay_us */
+	MATRIXORBITAL_EMU_FAULT_DELAY,
+	MATRIXORBITAL_EMU_NR_FAULTS
+};
+
+static const char *matrixorbital_emu_fault_names[MATRIXORBITAL_EMU_NR_FAULTS] = {
+	[MATRIXORBITAL_EMU_FAULT_NACK]		= "nack",
+	[MATRIXORBITAL_EMU_FAULT_TRUNCATE]	= "truncate",
+	[MATRIXORBITAL_EMU_FAULT_DROP]		= "drop",
+	[MATRIXORBITAL_EMU_FAULT_DELAY]		= "delay",
+};
+
+struct matrixorbital_emu_fault {
+	/* Chance of hitting a message, in parts per million */
+	u32 probability;
+	/* Hit every interval-th message, 0 for never */
+	u32 interval;
+	u64 injected;
+};
+
+struct matrixorbital_emu {
+	struct i2c_adapter adapter;
+	struct i2c_adapter_quirks quirks;
+	struct i2c_client *client;
+	struct dentry *debugfs;
+	struct debugfs_blob_wrapper panel_blob;
+
+	/* Protects everything below */
+	struct mutex lock;
+
+	/* Command parser and panel, commands may span several I2C messages */
+	struct matrixorbital_parser parser;
+	u8 cursor_x;
+	u8 cursor_y;
+	u8 gpo;
+	bool backlight;
+	u8 brightness;
+	u8 contrast;
+
+	/* Input buffer fill level as of rx_time */
+	u32 rx_fill;
+	u64 rx_time;
+	u64 overruns;
+
+	/* Byte the controller answers the next read with */
+	int response;
+
+	u8 keys[MATRIXORBITAL_EMU_KEYS];
+	int nkeys;
+
+	u64 xfers;
+	u64 bytes_rx;
+	u64 bytes_tx;
+	u64 text_bytes;
+	u64 unknown;
+	u64 cmd_count[256];
+
+	struct matrixorbital_emu_fault faults[MATRIXORBITAL_EMU_NR_FAULTS];
+	u32 fault_delay_us;
+};
+
+static struct matrixorbital_emu *matrixorbital_emu;
+
+/* Commands that don't draw, the parser has drawn the others on the panel */
+static void matrixorbital_emu_execute(struct matrixorbital_emu *emu)
+{
+	const u8 *a = emu->parser.args;
+
+	emu->cmd_count[emu->parser.opcode]++;
+
+	switch (emu->parser.opcode) {
+	case MATRIXORBITAL_POLL_KEY_PRESS:
+		if (!emu->nkeys) {
+			emu->response = 0;
+			break;
+		}
+		emu->response = emu->keys[0] | (emu->nkeys > 1 ? 0x80 : 0);
+		memmove(emu->keys, emu->keys + 1, --emu->nkeys);
+		break;
+	case MATRIXORBITAL_READ_MODULE_TYPE:
+		emu->response = module_type & 0xFF;
+		break;
+	case MATRIXORBITAL_GPO_OFF:
+		if (a[0] >= 1 && a[0] <= MATRIXORBITAL_EMU_GPOS)
+			emu->gpo &= ~BIT(a[0] - 1);
+		break;
+	case MATRIXORBITAL_GPO_ON:
+		if (a[0] >= 1 && a[0] <= MATRIXORBITAL_EMU_GPOS)
+			emu->gpo |= BIT(a[0] - 1);
+		break;
+	case MATRIXORBITAL_BACKLIGHT_ON:
+		emu->backlight = true;
+		break;
+	case MATRIXORBITAL_BACKLIGHT_OFF:
+		emu->backlight = false;
+		break;
+	case MATRIXORBITAL_SET_BRIGHTNESS:
+		emu->brightness = a[0];
+		break;
+	case MATRIXORBITAL_SET_CONTRAST:
+		emu->contrast = a[0];
+		break;
+	case MATRIXORBITAL_CLEAR_SCREEN:
+	case MATRIXORBITAL_GO_HOME:
+		emu->cursor_x = 0;
+		emu->cursor_y = 0;
+		break;
+	case MATRIXORBITAL_SET_CURSOR_POSITION:
+	case MATRIXORBITAL_SET_CURSOR_COORDINATE:
+		emu->cursor_x = a[0];
+		emu->cursor_y = a[1];
+		break;
+	}
+}
+
+static void matrixorbital_emu_byte(struct matrixorbital_emu *emu, u8 byte)
+{
+	switch (matrixorbital_parse_byte(&emu->parser, byte)) {
+	case MATRIXORBITAL_PARSE_TEXT:
+		/* Text isn't rendered, only the cursor advances */
+		emu->text_bytes++;
+		emu->cursor_x++;
+		break;
+	case MATRIXORBITAL_PARSE_UNKNOWN:
+		emu->unknown++;
+		break;
+	case MATRIXORBITAL_PARSE_COMMAND:
+		matrixorbital_emu_execute(emu);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Hold the bus as long as the transfer would take on a real wire */
+static void matrixorbital_emu_delay(u32 len)
+{
+	u32 freq = READ_ONCE(bus_freq);
+	u64 ns;
+
+	if (!freq)
+		return;
+
+	ns = div_u64((2 + 9 * (1 + (u64)len)) * NSEC_PER_SEC, freq);
+	if (ns < 10 * NSEC_PER_USEC)
+		ndelay(ns);
+	else
+		usleep_range(div_u64(ns, NSEC_PER_USEC), div_u64(ns, NSEC_PER_USEC) + 10);
+}
+
+/*
+ * Whether the next received byte fits the input buffer. Each message is
+ * seen as arriving at once, the buffer drains at rx_rate in between.
+ */
+static bool matrixorbital_emu_rx_room(struct matrixorbital_emu *emu)
+{
+	u32 size = READ_ONCE(rx_buffer);
+	u64 now, drained;
+
+	if (!size)
+		return true;
+
+	now = ktime_get_ns();
+	drained = div_u64((now - emu->rx_time) * READ_ONCE(rx_rate), NSEC_PER_SEC);
+	if (drained) {
+		emu->rx_fill -= min_t(u64, drained, emu->rx_fill);
+		emu->rx_time = now;
+	}
+	if (emu->rx_fill >= size) {
+		emu->overruns++;
+		return false;
+	}
+	emu->rx_fill++;
+
+	return true;
+}
+
+/* Pick the fault to inject into the current message, if any */
+static int matrixorbital_emu_pick_fault(struct matrixorbital_emu *emu)
+{
+	u32 rem;
+	int i;
+
+	for (i = 0; i < MATRIXORBITAL_EMU_NR_FAULTS; i++) {
+		struct matrixorbital_emu_fault *fault = &emu->faults[i];
+
+		if (fault->interval)
+			div_u64_rem(emu->xfers, fault->interval, &rem);
+		if ((fault->interval && !rem) ||
+		    (fault->probability && prandom_u32_max(1000000) < fault->probability)) {
+			fault->injected++;
+			return i;
+		}
+	}
+
+	return MATRIXORBITAL_EMU_FAULT_NONE;
+}
+
+static int matrixorbital_emu_xfer(struct i2c_adapter *adapter, struct i2c_msg *msgs, int num)
+{
+	struct matrixorbital_emu *emu = i2c_get_adapdata(adapter);
+	int i, j, fault, len;
+
+	for (i = 0; i < num; i++) {
+		struct i2c_msg *msg = &msgs[i];
+
+		if (msg->addr != addr)
+			return i ? i : -ENXIO;
+
+		mutex_lock(&emu->lock);
+		emu->xfers++;
+		fault = matrixorbital_emu_pick_fault(emu);
+		mutex_unlock(&emu->lock);
+
+		if (fault == MATRIXORBITAL_EMU_FAULT_NACK)
+			return i ? i : -ENXIO;
+		if (fault == MATRIXORBITAL_EMU_FAULT_DELAY)
+			usleep_range(READ_ONCE(emu->fault_delay_us),
+				     READ_ONCE(emu->fault_delay_us) + 10);
+
+		len = msg->len;
+		if (fault == MATRIXORBITAL_EMU_FAULT_TRUNCATE)
+			len /= 2;
+		else if (fault == MATRIXORBITAL_EMU_FAULT_DROP)
+			len = 0;
+
+		matrixorbital_emu_delay(len);
+
+		mutex_lock(&emu->lock);
+		if (msg->flags & I2C_M_RD) {
+			for (j = 0; j < msg->len; j++) {
+				msg->buf[j] = j < len ? emu->response : 0;
+				emu->response = 0;
+			}
+			emu->bytes_tx += len;
+		} else {
+			for (j = 0; j < len; j++)
+				if (matrixorbital_emu_rx_room(emu))
+					matrixorbital_emu_byte(emu, msg->buf[j]);
+			emu->bytes_rx += len;
+		}
+		mutex_unlock(&emu->lock);
+
+		if (fault == MATRIXORBITAL_EMU_FAULT_TRUNCATE)
+			return -EREMOTEIO;
+	}
+
+	return num;
+}
+
+static u32 matrixorbital_emu_functionality(struct i2c_adapter *adapter)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm matrixorbital_emu_algorithm = {
+	.master_xfer	= matrixorbital_emu_xfer,
+	.functionality	= matrixorbital_emu_functionality,
+};
+
+/* The panel as a PBM image, which shares the controller's bit order */
+static int matrixorbital_emu_pbm_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_emu *emu = s->private;
+
+	seq_printf(s, "P4\n%d %d\n", MATRIXORBITAL_PANEL_WIDTH, MATRIXORBITAL_PANEL_HEIGHT);
+	mutex_lock(&emu->lock);
+	seq_write(s, emu->parser.panel, sizeof(emu->parser.panel));
+	mutex_unlock(&emu->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_emu_pbm);
+
+static int matrixorbital_emu_stats_show(struct seq_file *s, void *unused)
+{
+	struct matrixorbital_emu *emu = s->private;
+	int i;
+
+	mutex_lock(&emu->lock);
+	seq_printf(s, "xfers: %llu\n", emu->xfers);
+	seq_printf(s, "bytes_rx: %llu\n", emu->bytes_rx);
+	seq_printf(s, "bytes_tx: %llu\n", emu->bytes_tx);
+	seq_printf(s, "text_bytes: %llu\n", emu->text_bytes);
+	seq_printf(s, "unknown_cmds: %llu\n", emu->unknown);
+	seq_printf(s, "overrun_bytes: %llu\n", emu->overruns);
+	seq_printf(s, "gpo: 0x%02x\n", emu->gpo);
+	seq_printf(s, "backlight: %s brightness %u contrast %u\n",
+		   emu->backlight ? "on" : "off", emu->brightness, emu->contrast);
+	seq_printf(s, "pending_keys: %d\n", emu->nkeys);
+	for (i = 0; i < ARRAY_SIZE(emu->cmd_count); i++)
+		if (emu->cmd_count[i])
+			seq_printf(s, "cmd_0x%02x: %llu\n", i, emu->cmd_count[i]);
+	mutex_unlock(&emu->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(matrixorbital_emu_stats);
+
+/* Queue key presses: controller key codes separated by spaces, e.g. "0x41 0x45" */
+static ssize_t matrixorbital_emu_keys_write(struct file *file, const char __user *ubuf,
+					    size_t count, loff_t *ppos)
+{
+	struct matrixorbital_emu *emu = file->private_data;
+	char buf[64], *p = buf, *tok;
+	int ret = 0;
+	u8 key;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	mutex_lock(&emu->lock);
+	while ((tok = strsep(&p, " \t\n")) != NULL) {
+		if (!*tok)
+			continue;
+		ret = kstrtou8(tok, 0, &key);
+		if (ret)
+			break;
+		if (emu->nkeys == MATRIXORBITAL_EMU_KEYS) {
+			ret = -ENOSPC;
+			break;
+		}
+		emu->keys[emu->nkeys++] = key;
+	}
+	mutex_unlock(&emu->lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations matrixorbital_emu_keys_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= matrixorbital_emu_keys_write,
+	.llseek	= noop_llseek,
+};
+
+/* faults/<type>/{probability,interval,injected} and faults/delay_us */
+static void matrixorbital_emu_debugfs_faults(struct matrixorbital_emu *emu)
+{
+	struct dentry *dir, *sub;
+	int i;
+
+	emu->fault_delay_us = 10000;
+
+	dir = debugfs_create_dir("faults", emu->debugfs);
+	debugfs_create_u32("delay_us", 0644, dir, &emu->fault_delay_us);
+	for (i = 0; i < MATRIXORBITAL_EMU_NR_FAULTS; i++) {
+		sub = debugfs_create_dir(matrixorbital_emu_fault_names[i], dir);
+		debugfs_create_u32("probability", 0644, sub, &emu->faults[i].probability);
+		debugfs_create_u32("interval", 0644, sub, &emu->faults[i].interval);
+		debugfs_create_u64("injected", 0444, sub, &emu->faults[i].injected);
+	}
+}
+
+static int __init matrixorbital_emu_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("matrixorbital", 0),
+	};
+	struct matrixorbital_emu *emu;
+	int ret;
+
+	emu = kzalloc(sizeof(*emu), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	mutex_init(&emu->lock);
+	emu->backlight = true;
+	emu->brightness = 255;
+	emu->contrast = 128;
+
+	emu->quirks.max_write_len = max_write_len;
+	emu->adapter.owner = THIS_MODULE;
+	emu->adapter.algo = &matrixorbital_emu_algorithm;
+	emu->adapter.quirks = max_write_len ? &emu->quirks : NULL;
+	strscpy(emu->adapter.name, "matrixorbital-emu", sizeof(emu->adapter.name));
+	i2c_set_adapdata(&emu->adapter, emu);
+
+	ret = i2c_add_adapter(&emu->adapter);
+	if (ret)
+		goto err_free;
+
+	emu->panel_blob.data = emu->parser.panel;
+	emu->panel_blob.size = sizeof(emu->parser.panel);
+	emu->debugfs = debugfs_create_dir("matrixorbital-emu", NULL);
+	debugfs_create_blob("panel", 0444, emu->debugfs, &emu->panel_blob);
+	debugfs_create_file("panel.pbm", 0444, emu->debugfs, emu,
+			    &matrixorbital_emu_pbm_fops);
+	debugfs_create_file("stats", 0444, emu->debugfs, emu,
+			    &matrixorbital_emu_stats_fops);
+	debugfs_create_file("keys", 0200, emu->debugfs, emu,
+			    &matrixorbital_emu_keys_fops);
+	matrixorbital_emu_debugfs_faults(emu);
+
+	info.addr = addr;
+	emu->client = i2c_new_client_device(&emu->adapter, &info);
+	if (IS_ERR(emu->client)) {
+		ret = PTR_ERR(emu->client);
+		goto err_del;
+	}
+
+	matrixorbital_emu = emu;
+	dev_info(&emu->adapter.dev, "emulating GLK19264 at 0x%02x\n", addr);
+
+	return 0;
+
+err_del:
+	debugfs_remove_recursive(emu->debugfs);
+	i2c_del_adapter(&emu->adapter);
+err_free:
+	kfree(emu);
+	return ret;
+}
+module_init(matrixorbital_emu_init);
+
+static void __exit matrixorbital_emu_exit(void)
+{
+	struct matrixorbital_emu *emu = matrixorbital_emu;
+
+	i2c_unregister_device(emu->client);
+	debugfs_remove_recursive(emu->debugfs);
+	i2c_del_adapter(&emu->adapter);
+	kfree(emu);
+}
+module_exit(matrixorbital_emu_exit);
+
+MODULE_DESCRIPTION("Virtual I2C adapter emulating the Matrix Orbital GLK19264 LCD controller");
+MODULE_LICENSE("GPL");
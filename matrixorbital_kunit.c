@@ -0,0 +1,732 @@
+/*
+ * KUnit tests of the Matrix Orbital GLK19264 LCD controller driver
+ *
+ * Covers the helpers the driver shares through matrixorbital_pack.h and
+ * matrixorbital_queue.h and the packing kernels of matrixorbital_simd.h:
+ * rectangle arithmetic, packing windows of any alignment, bitmap commands
+ * replayed into a reference rasterizer, key code mapping, merging and
+ * ordering pending damage, marking tiles from several threads at once and
+ * the order presented frames are taken in. The benchmark cases report ns
+ * per frame of the packing paths.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/sched/task.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "matrixorbital_queue.h"
+#include "matrixorbital_simd.h"
+
+#define MATRIXORBITAL_TEST_WIDTH 192
+#define MATRIXORBITAL_TEST_HEIGHT 64
+#define MATRIXORBITAL_TEST_LINE_LENGTH (MATRIXORBITAL_TEST_WIDTH / 8)
+#define MATRIXORBITAL_TEST_SIZE (MATRIXORBITAL_TEST_LINE_LENGTH * MATRIXORBITAL_TEST_HEIGHT)
+#define MATRIXORBITAL_TEST_CMD_SIZE (MATRIXORBITAL_BITMAP_HEADER + MATRIXORBITAL_TEST_SIZE)
+#define MATRIXORBITAL_TEST_LOOPS 1000
+
+/* Same frames on every run, so a failure can be reproduced */
+static void matrixorbital_test_fill(u8 *buf, u32 len, u32 seed)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+static u8 matrixorbital_test_pixel(const u8 *buf, u32 x, u32 y)
+{
+	return buf[y * MATRIXORBITAL_TEST_LINE_LENGTH + x / 8] >> (x % 8) & 1;
+}
+
+/* Pixel by pixel, the leftmost pixel of the window in bit 7 of the first byte */
+static u32 matrixorbital_test_pack(u8 *dst, const u8 *src, const struct matrixorbital_rect *r)
+{
+	u32 n, len = matrixorbital_rect_bytes(r);
+
+	memset(dst, 0, len);
+	for (n = 0; n < r->width * r->height; n++)
+		if (matrixorbital_test_pixel(src, r->x + n % r->width, r->y + n / r->width))
+			dst[n / 8] |= 0x80 >> (n % 8);
+
+	return len;
+}
+
+/*
+ * Draw a bitmap command on panel the way the controller does, the bitmap
+ * is a bit stream filling the window line by line. Returns false if cmd is
+ * not a well formed bitmap command.
+ */
+static bool matrixorbital_test_draw(u8 *panel, const u8 *cmd, u32 len,
+				    struct matrixorbital_rect *r)
+{
+	const u8 *data = cmd + MATRIXORBITAL_BITMAP_HEADER;
+	u32 n;
+
+	if (len < MATRIXORBITAL_BITMAP_HEADER || cmd[0] != MATRIXORBITAL_CMD ||
+	    cmd[1] != MATRIXORBITAL_DRAW_BITMAP_DIRECTLY)
+		return false;
+
+	r->x = cmd[2];
+	r->y = cmd[3];
+	r->width = cmd[4];
+	r->height = cmd[5];
+	if (r->x + r->width > MATRIXORBITAL_TEST_WIDTH ||
+	    r->y + r->height > MATRIXORBITAL_TEST_HEIGHT ||
+	    len != MATRIXORBITAL_BITMAP_HEADER + matrixorbital_rect_bytes(r))
+		return false;
+
+	for (n = 0; n < r->width * r->height; n++)
+		matrixorbital_draw_pixel(panel, MATRIXORBITAL_TEST_LINE_LENGTH,
+					 MATRIXORBITAL_TEST_WIDTH, MATRIXORBITAL_TEST_HEIGHT,
+					 r->x + n % r->width, r->y + n / r->width,
+					 data[n / 8] & 0x80 >> (n % 8));
+
+	return true;
+}
+
+static bool matrixorbital_test_rect_eq(const struct matrixorbital_rect *r,
+				       u32 x, u32 y, u32 width, u32 height)
+{
+	return r->x == x && r->y == y && r->width == width && r->height == height;
+}
+
+static void matrixorbital_test_rect_union(struct kunit *test)
+{
+	struct matrixorbital_rect dst = { 0 }, r = { 10, 20, 30, 5 };
+
+	matrixorbital_rect_union(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&dst, 10, 20, 30, 5));
+
+	r = (struct matrixorbital_rect){ 0, 0, 0, 7 };
+	matrixorbital_rect_union(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&dst, 10, 20, 30, 5));
+
+	r = (struct matrixorbital_rect){ 5, 40, 3, 2 };
+	matrixorbital_rect_union(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&dst, 5, 20, 35, 22));
+
+	r = (struct matrixorbital_rect){ 12, 21, 1, 1 };
+	matrixorbital_rect_union(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&dst, 5, 20, 35, 22));
+}
+
+static void matrixorbital_test_rect_intersect(struct kunit *test)
+{
+	struct matrixorbital_rect dst = { 10, 10, 20, 20 }, r = { 25, 0, 100, 15 };
+
+	matrixorbital_rect_intersect(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&dst, 25, 10, 5, 5));
+
+	/* Touching edges don't overlap */
+	dst = (struct matrixorbital_rect){ 10, 10, 20, 20 };
+	r = (struct matrixorbital_rect){ 30, 10, 5, 5 };
+	matrixorbital_rect_intersect(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_rect_empty(&dst));
+
+	dst = (struct matrixorbital_rect){ 10, 10, 20, 20 };
+	r = (struct matrixorbital_rect){ 15, 15, 0, 0 };
+	matrixorbital_rect_intersect(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_rect_empty(&dst));
+
+	dst = (struct matrixorbital_rect){ 10, 10, 20, 20 };
+	r = (struct matrixorbital_rect){ 0, 0, 192, 64 };
+	matrixorbital_rect_intersect(&dst, &r);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&dst, 10, 10, 20, 20));
+}
+
+static void matrixorbital_test_rect_clip(struct kunit *test)
+{
+	struct matrixorbital_rect r = { 180, 60, 50, 50 };
+
+	matrixorbital_rect_clip(&r, MATRIXORBITAL_TEST_WIDTH, MATRIXORBITAL_TEST_HEIGHT);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&r, 180, 60, 12, 4));
+
+	r = (struct matrixorbital_rect){ 192, 0, 8, 8 };
+	matrixorbital_rect_clip(&r, MATRIXORBITAL_TEST_WIDTH, MATRIXORBITAL_TEST_HEIGHT);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_rect_empty(&r));
+
+	r = (struct matrixorbital_rect){ 0, 64, 8, 8 };
+	matrixorbital_rect_clip(&r, MATRIXORBITAL_TEST_WIDTH, MATRIXORBITAL_TEST_HEIGHT);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_rect_empty(&r));
+}
+
+/* Widths around the byte and the 56 pixel chunk boundaries of pack_rect */
+static const u32 matrixorbital_test_widths[] = {
+	1, 2, 7, 8, 9, 15, 16, 17, 55, 56, 57, 63, 64, 65, 120, 191, 192,
+};
+
+/*
+ * Every start bit and every width, at the top and against the end of the
+ * buffer so reading past the frame is caught by KASAN
+ */
+static void matrixorbital_test_pack_rect(struct kunit *test)
+{
+	u8 *src, *got, *want;
+	u32 x, i, len;
+
+	src = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	got = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	want = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, want);
+	matrixorbital_test_fill(src, MATRIXORBITAL_TEST_SIZE, 1);
+
+	for (x = 0; x < MATRIXORBITAL_TEST_WIDTH; x++) {
+		for (i = 0; i < ARRAY_SIZE(matrixorbital_test_widths); i++) {
+			struct matrixorbital_rect r = { x, 0, matrixorbital_test_widths[i], 3 };
+
+			if (x + r.width > MATRIXORBITAL_TEST_WIDTH)
+				break;
+
+			for (r.y = 0; r.y <= MATRIXORBITAL_TEST_HEIGHT - r.height;
+			     r.y += MATRIXORBITAL_TEST_HEIGHT - r.height) {
+				len = matrixorbital_pack_rect(got, src,
+							      MATRIXORBITAL_TEST_LINE_LENGTH, &r);
+				KUNIT_EXPECT_EQ(test, len, matrixorbital_test_pack(want, src, &r));
+				KUNIT_EXPECT_EQ_MSG(test, memcmp(got, want, len), 0,
+						    "%ux%u+%u+%u", r.width, r.height, r.x, r.y);
+			}
+		}
+	}
+}
+
+/* Whole byte windows through pack_bytes and every kernel usable here */
+static void matrixorbital_test_pack_bytes(struct kunit *test)
+{
+	u8 *src, *got, *want;
+	u32 bx, bw, lines, i;
+
+	src = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	got = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	want = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, want);
+	matrixorbital_test_fill(src, MATRIXORBITAL_TEST_SIZE, 2);
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_pack_impls); i++) {
+		struct matrixorbital_pack_impl *impl = &matrixorbital_pack_impls[i];
+
+		if (!impl->usable()) {
+			kunit_info(test, "%s not usable, skipped\n", impl->name);
+			continue;
+		}
+
+		for (bx = 0; bx < MATRIXORBITAL_TEST_LINE_LENGTH; bx++) {
+			for (bw = 1; bx + bw <= MATRIXORBITAL_TEST_LINE_LENGTH; bw++) {
+				struct matrixorbital_rect r;
+
+				lines = bw == MATRIXORBITAL_TEST_LINE_LENGTH ?
+					MATRIXORBITAL_TEST_HEIGHT : 5;
+				r.x = bx * 8;
+				r.y = MATRIXORBITAL_TEST_HEIGHT - lines;
+				r.width = bw * 8;
+				r.height = lines;
+
+				memset(got, 0, MATRIXORBITAL_TEST_SIZE);
+				impl->pack(got, src + r.y * MATRIXORBITAL_TEST_LINE_LENGTH,
+					   MATRIXORBITAL_TEST_LINE_LENGTH, bx, bw, lines);
+				matrixorbital_test_pack(want, src, &r);
+				KUNIT_EXPECT_EQ_MSG(test, memcmp(got, want, bw * lines), 0,
+						    "%s bytes %u..%u of %u lines", impl->name,
+						    bx, bx + bw - 1, lines);
+			}
+		}
+	}
+}
+
+/* Every kernel narrows a damaged span down to the lines that differ */
+static void matrixorbital_test_trim(struct kunit *test)
+{
+	static const u32 spans[][2] = { { 0, 64 }, { 10, 11 }, { 0, 1 }, { 63, 64 }, { 5, 40 } };
+	u8 *a, *b;
+	u32 i, s, y0, y1;
+
+	a = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	b = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, a);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, b);
+	matrixorbital_test_fill(a, MATRIXORBITAL_TEST_SIZE, 3);
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_pack_impls); i++) {
+		struct matrixorbital_pack_impl *impl = &matrixorbital_pack_impls[i];
+
+		if (!impl->usable())
+			continue;
+
+		memcpy(b, a, MATRIXORBITAL_TEST_SIZE);
+		y0 = 0;
+		y1 = MATRIXORBITAL_TEST_HEIGHT;
+		impl->trim(a, b, MATRIXORBITAL_TEST_LINE_LENGTH, &y0, &y1);
+		KUNIT_EXPECT_EQ_MSG(test, y0, y1, "%s on equal frames", impl->name);
+
+		for (s = 0; s < ARRAY_SIZE(spans); s++) {
+			memcpy(b, a, MATRIXORBITAL_TEST_SIZE);
+			/* One pixel each in the last byte of the first and the first of the last line */
+			b[spans[s][0] * MATRIXORBITAL_TEST_LINE_LENGTH +
+			  MATRIXORBITAL_TEST_LINE_LENGTH - 1] ^= 0x80;
+			b[(spans[s][1] - 1) * MATRIXORBITAL_TEST_LINE_LENGTH] ^= 0x01;
+
+			y0 = 0;
+			y1 = MATRIXORBITAL_TEST_HEIGHT;
+			impl->trim(a, b, MATRIXORBITAL_TEST_LINE_LENGTH, &y0, &y1);
+			KUNIT_EXPECT_EQ_MSG(test, y0, spans[s][0], "%s", impl->name);
+			KUNIT_EXPECT_EQ_MSG(test, y1, spans[s][1], "%s", impl->name);
+		}
+	}
+}
+
+/*
+ * Encode windows of a new frame, replay the commands on a panel showing
+ * the old one and check that the window, and only the window, changed
+ */
+static void matrixorbital_test_encode(struct kunit *test)
+{
+	u8 *old, *new, *panel, *cmd;
+	u32 n, len, x, y;
+
+	old = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	new = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	panel = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	cmd = kunit_kmalloc(test, MATRIXORBITAL_TEST_CMD_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, old);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, new);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, panel);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, cmd);
+	matrixorbital_test_fill(old, MATRIXORBITAL_TEST_SIZE, 4);
+	matrixorbital_test_fill(new, MATRIXORBITAL_TEST_SIZE, 5);
+
+	for (n = 0; n < 512; n++) {
+		struct matrixorbital_pack_impl *impl =
+			&matrixorbital_pack_impls[n / 2 % ARRAY_SIZE(matrixorbital_pack_impls)];
+		struct matrixorbital_rect damage, r, drawn;
+		bool aligned = n & 1;
+		u32 seed = n * 2654435761U;
+
+		damage.x = (seed >> 3) % MATRIXORBITAL_TEST_WIDTH;
+		damage.y = (seed >> 11) % MATRIXORBITAL_TEST_HEIGHT;
+		damage.width = 1 + (seed >> 17) % (MATRIXORBITAL_TEST_WIDTH - damage.x);
+		damage.height = 1 + (seed >> 25) % (MATRIXORBITAL_TEST_HEIGHT - damage.y);
+		r = damage;
+		if (!impl->usable())
+			impl = &matrixorbital_pack_impls[0];
+
+		len = matrixorbital_encode_bitmap(cmd, new, MATRIXORBITAL_TEST_LINE_LENGTH, &r,
+						  aligned, impl->pack);
+		memcpy(panel, old, MATRIXORBITAL_TEST_SIZE);
+		KUNIT_ASSERT_TRUE_MSG(test, matrixorbital_test_draw(panel, cmd, len, &drawn),
+				      "%ux%u+%u+%u", damage.width, damage.height,
+				      damage.x, damage.y);
+		KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&drawn, r.x, r.y,
+								   r.width, r.height));
+
+		/* The window drawn covers the damage, rounded out to bytes at most */
+		KUNIT_EXPECT_LE(test, r.x, damage.x);
+		KUNIT_EXPECT_GE(test, r.x + r.width, damage.x + damage.width);
+		KUNIT_EXPECT_EQ(test, r.y, damage.y);
+		KUNIT_EXPECT_EQ(test, r.height, damage.height);
+		if (!aligned)
+			KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&r, damage.x, damage.y,
+									   damage.width,
+									   damage.height));
+
+		for (y = 0; y < MATRIXORBITAL_TEST_HEIGHT; y++) {
+			for (x = 0; x < MATRIXORBITAL_TEST_WIDTH; x++) {
+				bool inside = x >= r.x && x < r.x + r.width &&
+					      y >= r.y && y < r.y + r.height;
+				u8 want = matrixorbital_test_pixel(inside ? new : old, x, y);
+
+				if (matrixorbital_test_pixel(panel, x, y) != want) {
+					KUNIT_FAIL(test, "%s %ux%u+%u+%u: pixel %u,%u wrong",
+						   impl->name, r.width, r.height, r.x, r.y,
+						   x, y);
+					return;
+				}
+			}
+		}
+	}
+}
+
+static void matrixorbital_test_map_key(struct kunit *test)
+{
+	u16 reserved = KEY_RESERVED;
+	u32 raw, i, known = 0;
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_keymap); i++) {
+		u16 keycode = matrixorbital_map_key(matrixorbital_keymap[i].raw);
+
+		KUNIT_EXPECT_EQ(test, keycode, matrixorbital_keymap[i].keycode);
+		KUNIT_EXPECT_NE(test, keycode, reserved);
+	}
+
+	/* No other code maps to a key, the driver drops those */
+	for (raw = 0; raw <= 0xFF; raw++)
+		if (matrixorbital_map_key(raw) != KEY_RESERVED)
+			known++;
+	KUNIT_EXPECT_EQ(test, known, (u32)ARRAY_SIZE(matrixorbital_keymap));
+
+	KUNIT_EXPECT_EQ(test, matrixorbital_map_key(0x42), (u16)KEY_UP);
+	KUNIT_EXPECT_EQ(test, matrixorbital_map_key(0x48), (u16)KEY_DOWN);
+	KUNIT_EXPECT_EQ(test, matrixorbital_map_key(0x46), reserved);
+	KUNIT_EXPECT_EQ(test, matrixorbital_map_key(0x00), reserved);
+}
+
+/* Regions due close together merge, keeping the earlier times */
+static void matrixorbital_test_region_merge(struct kunit *test)
+{
+	struct matrixorbital_rect a = { 0, 0, 16, 8 }, b = { 100, 40, 8, 8 };
+	struct matrixorbital_rect c = { 50, 10, 4, 4 }, far = { 180, 56, 8, 8 };
+	struct matrixorbital_rect empty = { 4, 4, 0, 8 };
+	struct matrixorbital_pending p = { };
+	u32 i;
+
+	matrixorbital_pending_add(&p, &a, ms_to_ktime(5), ms_to_ktime(20), false);
+	matrixorbital_pending_add(&p, &b, ms_to_ktime(2), ms_to_ktime(25), false);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, 1U);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&p.regions[0].rect, 0, 0, 108, 48));
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(p.regions[0].time), 2LL);
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(p.regions[0].deadline), 20LL);
+	KUNIT_EXPECT_FALSE(test, p.regions[0].full);
+
+	/* Merging with a full region makes it full */
+	matrixorbital_pending_add(&p, &c, ms_to_ktime(6), ms_to_ktime(18), true);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, 1U);
+	KUNIT_EXPECT_TRUE(test, p.regions[0].full);
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(p.regions[0].deadline), 18LL);
+
+	/* Further apart gets a slot of its own, empty damage none */
+	matrixorbital_pending_add(&p, &far, ms_to_ktime(6), ms_to_ktime(100), false);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, 2U);
+	matrixorbital_pending_add(&p, &empty, ms_to_ktime(6), ms_to_ktime(500), false);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, 2U);
+
+	/* Once all slots are taken, into the one due closest */
+	for (i = p.nr_regions; i < MATRIXORBITAL_MAX_REGIONS; i++)
+		matrixorbital_pending_add(&p, &a, ms_to_ktime(6), ms_to_ktime(1000 * i), false);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, (u32)MATRIXORBITAL_MAX_REGIONS);
+	matrixorbital_pending_add(&p, &c, ms_to_ktime(1), ms_to_ktime(300), false);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, (u32)MATRIXORBITAL_MAX_REGIONS);
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&p.regions[1].rect, 50, 10, 138, 54));
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(p.regions[1].time), 1LL);
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(p.regions[1].deadline), 100LL);
+}
+
+/* Earliest deadline first, whatever the order damage came in */
+static void matrixorbital_test_region_edf(struct kunit *test)
+{
+	static const u32 deadlines[] = { 50, 10, 90, 30, 70 };
+	struct matrixorbital_pending p = { };
+	struct matrixorbital_region r;
+	u32 i, last = 0;
+
+	for (i = 0; i < ARRAY_SIZE(deadlines); i++) {
+		struct matrixorbital_rect rect = { 8 * i, 0, 8, 8 };
+
+		matrixorbital_pending_add(&p, &rect, 0, ms_to_ktime(deadlines[i]), false);
+	}
+	KUNIT_EXPECT_EQ(test, p.nr_regions, (u32)ARRAY_SIZE(deadlines));
+
+	for (i = 0; i < ARRAY_SIZE(deadlines); i++) {
+		KUNIT_ASSERT_TRUE_MSG(test, matrixorbital_pending_take(&p, &r),
+				      "region %u missing", i);
+		KUNIT_EXPECT_GE(test, (u32)ktime_to_ms(r.deadline), last);
+		last = ktime_to_ms(r.deadline);
+	}
+	KUNIT_EXPECT_EQ(test, last, 90U);
+	KUNIT_EXPECT_FALSE(test, matrixorbital_pending_take(&p, &r));
+}
+
+/* A region put back after a failed upload is taken again first */
+static void matrixorbital_test_region_requeue(struct kunit *test)
+{
+	struct matrixorbital_rect a = { 0, 0, 64, 16 }, b = { 96, 32, 16, 16 };
+	struct matrixorbital_rect later = { 0, 56, 8, 8 };
+	struct matrixorbital_pending p = { };
+	struct matrixorbital_region r, again;
+
+	matrixorbital_pending_add(&p, &a, ms_to_ktime(1), ms_to_ktime(10), true);
+	matrixorbital_pending_add(&p, &later, ms_to_ktime(1), ms_to_ktime(60), false);
+	KUNIT_ASSERT_TRUE_MSG(test, matrixorbital_pending_take(&p, &r), "nothing pending");
+
+	matrixorbital_pending_add(&p, &r.rect, r.time, r.deadline, r.full);
+	KUNIT_ASSERT_TRUE_MSG(test, matrixorbital_pending_take(&p, &again), "lost on requeue");
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&again.rect, 0, 0, 64, 16));
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(again.deadline), 10LL);
+	KUNIT_EXPECT_TRUE(test, again.full);
+
+	/* Damage made meanwhile merges in without pushing the deadline out */
+	matrixorbital_pending_add(&p, &b, ms_to_ktime(4), ms_to_ktime(14), false);
+	matrixorbital_pending_add(&p, &r.rect, r.time, r.deadline, r.full);
+	KUNIT_ASSERT_TRUE_MSG(test, matrixorbital_pending_take(&p, &again), "lost on requeue");
+	KUNIT_EXPECT_TRUE(test, matrixorbital_test_rect_eq(&again.rect, 0, 0, 112, 48));
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(again.time), 1LL);
+	KUNIT_EXPECT_EQ(test, ktime_to_ms(again.deadline), 10LL);
+	KUNIT_EXPECT_TRUE(test, again.full);
+	KUNIT_EXPECT_EQ(test, p.nr_regions, 1U);
+}
+
+struct matrixorbital_test_marker {
+	struct matrixorbital_pending *p;
+	u32 row;
+};
+
+/* Every tile of one row, over and over */
+static int matrixorbital_test_mark_thread(void *data)
+{
+	struct matrixorbital_test_marker *m = data;
+	u32 i;
+
+	for (i = 0; i < MATRIXORBITAL_TEST_LOOPS * MATRIXORBITAL_TEST_WIDTH / 8; i++) {
+		struct matrixorbital_rect r = {
+			(i % (MATRIXORBITAL_TEST_WIDTH / 8)) * 8 + i % 8,
+			m->row * MATRIXORBITAL_TILE_SIZE + i % 8, 1, 1
+		};
+
+		matrixorbital_tiles_time(m->p, ktime_get());
+		matrixorbital_tiles_mark(m->p, &r);
+	}
+
+	return 0;
+}
+
+/*
+ * Threads mark tiles while the tiles are collected: no mark may be lost,
+ * so in the end the regions cover every tile of the rows the threads
+ * marked, and nothing else
+ */
+static void matrixorbital_test_tiles_concurrent(struct kunit *test)
+{
+	struct matrixorbital_test_marker m[MATRIXORBITAL_TILE_ROWS];
+	struct task_struct *task[MATRIXORBITAL_TILE_ROWS];
+	struct matrixorbital_pending p = { };
+	u32 cols[MATRIXORBITAL_TILE_ROWS] = { };
+	struct matrixorbital_region r;
+	int n = min(num_online_cpus(), MATRIXORBITAL_TILE_ROWS);
+	u32 row, last;
+	int i, started;
+
+	for (started = 0; started < n; started++) {
+		m[started].p = &p;
+		m[started].row = started;
+		task[started] = kthread_create(matrixorbital_test_mark_thread, &m[started],
+					       "matrixorbital-test/%d", started);
+		if (IS_ERR(task[started]))
+			break;
+		get_task_struct(task[started]);
+		wake_up_process(task[started]);
+	}
+
+	/* Collect while they mark, one region at a time like the I/O thread */
+	for (i = 0; i < MATRIXORBITAL_TEST_LOOPS; i++) {
+		matrixorbital_tiles_collect(&p, MATRIXORBITAL_TEST_WIDTH,
+					    MATRIXORBITAL_TEST_HEIGHT, 20);
+		if (matrixorbital_pending_take(&p, &r))
+			matrixorbital_pending_add(&p, &r.rect, r.time, r.deadline, r.full);
+	}
+
+	for (i = 0; i < started; i++) {
+		kthread_stop(task[i]);
+		put_task_struct(task[i]);
+	}
+	KUNIT_ASSERT_TRUE_MSG(test, started == n, "couldn't start thread %d", started);
+
+	matrixorbital_tiles_collect(&p, MATRIXORBITAL_TEST_WIDTH, MATRIXORBITAL_TEST_HEIGHT, 20);
+	KUNIT_EXPECT_FALSE(test, matrixorbital_tiles_dirty(&p));
+	KUNIT_EXPECT_EQ(test, atomic64_read(&p.tiles_time), 0LL);
+
+	while (matrixorbital_pending_take(&p, &r)) {
+		KUNIT_EXPECT_NE(test, ktime_to_ns(r.time), 0LL);
+		last = (r.rect.y + r.rect.height - 1) / MATRIXORBITAL_TILE_SIZE;
+		for (row = r.rect.y / MATRIXORBITAL_TILE_SIZE; row <= last; row++)
+			cols[row] |= GENMASK((r.rect.x + r.rect.width - 1) / MATRIXORBITAL_TILE_SIZE,
+					     r.rect.x / MATRIXORBITAL_TILE_SIZE);
+	}
+	for (row = 0; row < MATRIXORBITAL_TILE_ROWS; row++)
+		KUNIT_EXPECT_EQ_MSG(test, cols[row], row < n ?
+				    (u32)GENMASK(MATRIXORBITAL_TEST_WIDTH / 8 - 1, 0) : 0U,
+				    "tile row %u", row);
+}
+
+/*
+ * A full frame takes longer to upload than a small one due before it, so
+ * it has to be taken first although it is presented last
+ */
+static void matrixorbital_test_frame_order(struct kunit *test)
+{
+	struct matrixorbital_frame small = {
+		.rect = { 37, 21, 45, 13 },
+		.target = ms_to_ktime(100),
+		.start = ms_to_ktime(98),
+	};
+	struct matrixorbital_frame full = {
+		.rect = { 0, 0, MATRIXORBITAL_TEST_WIDTH, MATRIXORBITAL_TEST_HEIGHT },
+		.target = ms_to_ktime(120),
+		.start = ms_to_ktime(90),
+	};
+	struct matrixorbital_frame later = {
+		.rect = { 0, 0, 8, 8 },
+		.target = ms_to_ktime(200),
+		.start = ms_to_ktime(199),
+	};
+	LIST_HEAD(frames);
+	LIST_HEAD(due);
+
+	matrixorbital_frame_insert(&frames, &later);
+	matrixorbital_frame_insert(&frames, &small);
+	matrixorbital_frame_insert(&frames, &full);
+
+	/* The timer is armed on the head, the earliest start */
+	KUNIT_EXPECT_PTR_EQ(test, list_first_entry(&frames, struct matrixorbital_frame, node),
+			    &full);
+
+	KUNIT_EXPECT_EQ(test, matrixorbital_frame_take(&frames, ms_to_ktime(89), &due), 0U);
+	KUNIT_EXPECT_EQ(test, matrixorbital_frame_take(&frames, ms_to_ktime(95), &due), 1U);
+	KUNIT_EXPECT_PTR_EQ(test, list_first_entry(&due, struct matrixorbital_frame, node),
+			    &full);
+	KUNIT_EXPECT_PTR_EQ(test, list_first_entry(&frames, struct matrixorbital_frame, node),
+			    &small);
+
+	/* Taken together, due is in target order so later frames cover earlier ones */
+	list_del(&full.node);
+	matrixorbital_frame_insert(&frames, &full);
+	KUNIT_EXPECT_EQ(test, matrixorbital_frame_take(&frames, ms_to_ktime(98), &due), 2U);
+	KUNIT_EXPECT_PTR_EQ(test, list_first_entry(&due, struct matrixorbital_frame, node),
+			    &small);
+	KUNIT_EXPECT_PTR_EQ(test, list_last_entry(&due, struct matrixorbital_frame, node),
+			    &full);
+	KUNIT_EXPECT_PTR_EQ(test, list_first_entry(&frames, struct matrixorbital_frame, node),
+			    &later);
+}
+
+/* Best of three runs of MATRIXORBITAL_TEST_LOOPS, in ns per call */
+#define MATRIXORBITAL_TEST_TIME(ns, call)					\
+	do {									\
+		int __run, __i;							\
+										\
+		(ns) = U64_MAX;							\
+		for (__run = 0; __run < 3; __run++) {				\
+			ktime_t __start = ktime_get();				\
+										\
+			for (__i = 0; __i < MATRIXORBITAL_TEST_LOOPS; __i++)	\
+				call;						\
+			(ns) = min_t(u64, (ns),					\
+				     ktime_to_ns(ktime_sub(ktime_get(), __start)));	\
+		}								\
+		(ns) = div_u64((ns), MATRIXORBITAL_TEST_LOOPS);			\
+	} while (0)
+
+/* Full frames and a small widget through every packing path */
+static void matrixorbital_test_bench_pack(struct kunit *test)
+{
+	struct matrixorbital_rect frame = { 0, 0, MATRIXORBITAL_TEST_WIDTH,
+					    MATRIXORBITAL_TEST_HEIGHT };
+	struct matrixorbital_rect widget = { 37, 21, 45, 13 };
+	u8 *src, *dst;
+	u64 ns;
+	u32 i;
+
+	src = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	dst = kunit_kmalloc(test, MATRIXORBITAL_TEST_CMD_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+	matrixorbital_test_fill(src, MATRIXORBITAL_TEST_SIZE, 6);
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_pack_impls); i++) {
+		struct matrixorbital_pack_impl *impl = &matrixorbital_pack_impls[i];
+
+		if (!impl->usable())
+			continue;
+		MATRIXORBITAL_TEST_TIME(ns, impl->pack(dst, src, MATRIXORBITAL_TEST_LINE_LENGTH,
+						       0, MATRIXORBITAL_TEST_LINE_LENGTH,
+						       MATRIXORBITAL_TEST_HEIGHT));
+		kunit_info(test, "%-8s full frame %llu ns/frame\n", impl->name, ns);
+	}
+
+	MATRIXORBITAL_TEST_TIME(ns, matrixorbital_pack_rect(dst, src,
+							    MATRIXORBITAL_TEST_LINE_LENGTH,
+							    &frame));
+	kunit_info(test, "pack_rect full frame %llu ns/frame\n", ns);
+
+	MATRIXORBITAL_TEST_TIME(ns, matrixorbital_pack_rect(dst, src,
+							    MATRIXORBITAL_TEST_LINE_LENGTH,
+							    &widget));
+	kunit_info(test, "pack_rect %ux%u+%u+%u %llu ns/frame\n", widget.width,
+		   widget.height, widget.x, widget.y, ns);
+
+	MATRIXORBITAL_TEST_TIME(ns, matrixorbital_pack_bytes(dst, src,
+							     MATRIXORBITAL_TEST_LINE_LENGTH,
+							     widget.x / 8,
+							     DIV_ROUND_UP(widget.x + widget.width, 8) -
+							     widget.x / 8, widget.height));
+	kunit_info(test, "pack_bytes %ux%u+%u+%u %llu ns/frame\n", widget.width,
+		   widget.height, widget.x, widget.y, ns);
+}
+
+/* The whole encoder with the kernel the driver would pick */
+static void matrixorbital_test_bench_encode(struct kunit *test)
+{
+	struct matrixorbital_pack_impl *impl = matrixorbital_simd_select(NULL);
+	struct matrixorbital_rect r;
+	u8 *src, *dst;
+	u64 ns;
+
+	src = kunit_kmalloc(test, MATRIXORBITAL_TEST_SIZE, GFP_KERNEL);
+	dst = kunit_kmalloc(test, MATRIXORBITAL_TEST_CMD_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+	matrixorbital_test_fill(src, MATRIXORBITAL_TEST_SIZE, 7);
+
+	MATRIXORBITAL_TEST_TIME(ns, ({
+		r = (struct matrixorbital_rect){ 0, 0, MATRIXORBITAL_TEST_WIDTH,
+						 MATRIXORBITAL_TEST_HEIGHT };
+		matrixorbital_encode_bitmap(dst, src, MATRIXORBITAL_TEST_LINE_LENGTH, &r,
+					    true, impl->pack);
+	}));
+	kunit_info(test, "encode %s full frame %llu ns/frame\n", impl->name, ns);
+
+	MATRIXORBITAL_TEST_TIME(ns, ({
+		r = (struct matrixorbital_rect){ 37, 21, 45, 13 };
+		matrixorbital_encode_bitmap(dst, src, MATRIXORBITAL_TEST_LINE_LENGTH, &r,
+					    false, impl->pack);
+	}));
+	kunit_info(test, "encode bit packed 45x13+37+21 %llu ns/frame\n", ns);
+}
+
+static struct kunit_case matrixorbital_test_cases[] = {
+	KUNIT_CASE(matrixorbital_test_rect_union),
+	KUNIT_CASE(matrixorbital_test_rect_intersect),
+	KUNIT_CASE(matrixorbital_test_rect_clip),
+	KUNIT_CASE(matrixorbital_test_pack_rect),
+	KUNIT_CASE(matrixorbital_test_pack_bytes),
+	KUNIT_CASE(matrixorbital_test_trim),
+	KUNIT_CASE(matrixorbital_test_encode),
+	KUNIT_CASE(matrixorbital_test_map_key),
+	KUNIT_CASE(matrixorbital_test_region_merge),
+	KUNIT_CASE(matrixorbital_test_region_edf),
+	KUNIT_CASE(matrixorbital_test_region_requeue),
+	KUNIT_CASE(matrixorbital_test_tiles_concurrent),
+	KUNIT_CASE(matrixorbital_test_frame_order),
+	KUNIT_CASE(matrixorbital_test_bench_pack),
+	KUNIT_CASE(matrixorbital_test_bench_encode),
+	{}
+};
+
+static struct kunit_suite matrixorbital_test_suite = {
+	.name = "matrixorbital",
+	.test_cases = matrixorbital_test_cases,
+};
+kunit_test_suite(matrixorbital_test_suite);
+
+MODULE_DESCRIPTION("KUnit tests of the Matrix Orbital GLK19264 LCD controller driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,351 @@
+/*
+ * Pure helpers of the Matrix Orbital GLK19264 LCD controller driver
+ *
+ * Damage rectangles, framebuffer to controller packing and key code
+ * mapping. Nothing in here touches the device, so the helpers can be
+ * exercised and benchmarked in isolation.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#ifndef _MATRIXORBITAL_PACK_H
+#define _MATRIXORBITAL_PACK_H
+
+#include <asm/unaligned.h>
+#include <linux/bits.h>
+#include <linux/input.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "matrixorbital.h"
+
+struct matrixorbital_rect {
+	u32 x;
+	u32 y;
+	u32 width;
+	u32 height;
+};
+
+static inline bool matrixorbital_rect_empty(const struct matrixorbital_rect *r)
+{
+	return !r->width || !r->height;
+}
+
+/* Grow dst to the bounding box of dst and r */
+static inline void matrixorbital_rect_union(struct matrixorbital_rect *dst,
+					    const struct matrixorbital_rect *r)
+{
+	u32 x2, y2;
+
+	if (matrixorbital_rect_empty(r))
+		return;
+	if (matrixorbital_rect_empty(dst)) {
+		*dst = *r;
+		return;
+	}
+
+	x2 = max(dst->x + dst->width, r->x + r->width);
+	y2 = max(dst->y + dst->height, r->y + r->height);
+	dst->x = min(dst->x, r->x);
+	dst->y = min(dst->y, r->y);
+	dst->width = x2 - dst->x;
+	dst->height = y2 - dst->y;
+}
+
+/* Shrink dst to its overlap with r, empty if they don't overlap */
+static inline void matrixorbital_rect_intersect(struct matrixorbital_rect *dst,
+						const struct matrixorbital_rect *r)
+{
+	u32 x1 = max(dst->x, r->x), y1 = max(dst->y, r->y);
+	u32 x2 = min(dst->x + dst->width, r->x + r->width);
+	u32 y2 = min(dst->y + dst->height, r->y + r->height);
+
+	if (matrixorbital_rect_empty(dst) || matrixorbital_rect_empty(r) ||
+	    x1 >= x2 || y1 >= y2) {
+		memset(dst, 0, sizeof(*dst));
+		return;
+	}
+
+	dst->x = x1;
+	dst->y = y1;
+	dst->width = x2 - x1;
+	dst->height = y2 - y1;
+}
+
+static inline void matrixorbital_rect_clip(struct matrixorbital_rect *r,
+					   u32 width, u32 height)
+{
+	if (r->x >= width || r->y >= height) {
+		r->width = 0;
+		r->height = 0;
+		return;
+	}
+
+	r->width = min(r->width, width - r->x);
+	r->height = min(r->height, height - r->y);
+}
+
+/* The framebuffer keeps the leftmost pixel in bit 0, the controller in bit 7 */
+static inline u8 matrixorbital_reverse_bits(u8 b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+/*
+ * Pack whole framebuffer lines into the continuous bit stream of the
+ * bitmap command. Full lines of a display whose width is a multiple of 8
+ * map one to one onto controller bytes.
+ */
+static inline void matrixorbital_pack_lines(u8 *dst, const u8 *src,
+					    u32 line_length, u32 lines)
+{
+	u32 i;
+
+	for (i = 0; i < line_length * lines; i++)
+		dst[i] = matrixorbital_reverse_bits(src[i]);
+}
+
+/* Same for a window of bx..bx+bw-1 bytes of every line */
+static inline void matrixorbital_pack_bytes(u8 *dst, const u8 *src, u32 line_length,
+					    u32 bx, u32 bw, u32 lines)
+{
+	u32 i, j;
+
+	for (j = 0; j < lines; j++, src += line_length)
+		for (i = 0; i < bw; i++)
+			*dst++ = matrixorbital_reverse_bits(src[bx + i]);
+}
+
+/* Up to 8 bytes from p as a little endian word, without reading past avail */
+static inline u64 matrixorbital_load_le(const u8 *p, u32 avail)
+{
+	u64 word = 0;
+	u32 i;
+
+	if (avail >= sizeof(u64))
+		return get_unaligned_le64(p);
+
+	for (i = 0; i < avail; i++)
+		word |= (u64)p[i] << (8 * i);
+	return word;
+}
+
+/*
+ * Pack a window of any alignment into the continuous bit stream of the
+ * bitmap command. Every line is read as a little endian bit stream in
+ * chunks of up to 56 pixels, shifted into place next to the bits left over
+ * from the previous chunk, and the accumulator is drained a byte at a time.
+ * Returns the number of bytes written, DIV_ROUND_UP(width * height, 8).
+ */
+static inline u32 matrixorbital_pack_rect(u8 *dst, const u8 *src, u32 line_length,
+					  const struct matrixorbital_rect *r)
+{
+	const u8 *line = src + r->y * line_length;
+	u8 *start = dst;
+	u32 nbits = 0;
+	u64 acc = 0;
+	u32 j, done;
+
+	for (j = 0; j < r->height; j++, line += line_length) {
+		for (done = 0; done < r->width; ) {
+			u32 off = r->x + done;
+			u32 n = min(r->width - done, 56U);
+			u64 word = matrixorbital_load_le(line + off / 8,
+							 line_length - off / 8);
+
+			acc |= ((word >> (off % 8)) & GENMASK_ULL(n - 1, 0)) << nbits;
+			nbits += n;
+			done += n;
+
+			for (; nbits >= 8; nbits -= 8, acc >>= 8)
+				*dst++ = matrixorbital_reverse_bits(acc);
+		}
+	}
+	if (nbits)
+		*dst++ = matrixorbital_reverse_bits(acc);
+
+	return dst - start;
+}
+
+/* Bytes the bitmap data of r takes packed bit by bit and rounded out to whole bytes */
+static inline u32 matrixorbital_rect_bytes(const struct matrixorbital_rect *r)
+{
+	return DIV_ROUND_UP(r->width * r->height, 8);
+}
+
+static inline u32 matrixorbital_rect_bytes_aligned(const struct matrixorbital_rect *r)
+{
+	return (round_up(r->x + r->width, 8) - round_down(r->x, 8)) / 8 * r->height;
+}
+
+/* Bytes of the bitmap command in front of the packed bitmap */
+#define MATRIXORBITAL_BITMAP_HEADER	6
+
+static inline void matrixorbital_bitmap_header(u8 *dst, const struct matrixorbital_rect *r)
+{
+	dst[0] = MATRIXORBITAL_CMD;
+	dst[1] = MATRIXORBITAL_DRAW_BITMAP_DIRECTLY;
+	dst[2] = r->x;
+	dst[3] = r->y;
+	dst[4] = r->width;
+	dst[5] = r->height;
+}
+
+/*
+ * Encode the bitmap command drawing r of the framebuffer src. An aligned
+ * upload rounds r out to whole bytes, packed with pack, and r is updated
+ * to the window actually drawn. Returns the length of the command.
+ */
+static inline u32 matrixorbital_encode_bitmap(u8 *dst, const u8 *src, u32 line_length,
+					      struct matrixorbital_rect *r, bool aligned,
+					      void (*pack)(u8 *dst, const u8 *src,
+							   u32 line_length, u32 bx,
+							   u32 bw, u32 lines))
+{
+	u8 *data = dst + MATRIXORBITAL_BITMAP_HEADER;
+	u32 len;
+
+	if (aligned) {
+		u32 bx = r->x / 8;
+		u32 bw = DIV_ROUND_UP(r->x + r->width, 8) - bx;
+
+		pack(data, src + r->y * line_length, line_length, bx, bw, r->height);
+		r->x = bx * 8;
+		r->width = bw * 8;
+		len = bw * r->height;
+	} else {
+		len = matrixorbital_pack_rect(data, src, line_length, r);
+	}
+	matrixorbital_bitmap_header(dst, r);
+
+	return MATRIXORBITAL_BITMAP_HEADER + len;
+}
+
+/*
+ * Copy exactly the pixels of r, leaving the rest of the edge bytes alone,
+ * between buffers with lines of different lengths
+ */
+static inline void matrixorbital_copy_rect_stride(u8 *dst, u32 dst_line_length,
+						  const u8 *src, u32 src_line_length,
+						  const struct matrixorbital_rect *r)
+{
+	u32 b0 = r->x / 8, b1 = (r->x + r->width - 1) / 8;
+	u8 first = 0xFF << (r->x % 8);
+	u8 last = 0xFF >> (7 - (r->x + r->width - 1) % 8);
+	u8 *d;
+	const u8 *s;
+	u32 j;
+
+	if (matrixorbital_rect_empty(r))
+		return;
+	if (b0 == b1)
+		first &= last;
+
+	for (j = r->y; j < r->y + r->height; j++) {
+		d = dst + j * dst_line_length;
+		s = src + j * src_line_length;
+		d[b0] = (d[b0] & ~first) | (s[b0] & first);
+		if (b1 == b0)
+			continue;
+		memcpy(d + b0 + 1, s + b0 + 1, b1 - b0 - 1);
+		d[b1] = (d[b1] & ~last) | (s[b1] & last);
+	}
+}
+
+static inline void matrixorbital_copy_rect(u8 *dst, const u8 *src, u32 line_length,
+					   const struct matrixorbital_rect *r)
+{
+	matrixorbital_copy_rect_stride(dst, line_length, src, line_length, r);
+}
+
+/*
+ * Drawing into framebuffer layout the way the controller draws on its
+ * panel, so drawing commands can be mirrored into video memory and the
+ * shadow copy. Pixels off the screen are ignored.
+ */
+static inline void matrixorbital_draw_pixel(u8 *buf, u32 line_length, u32 width, u32 height,
+					    int x, int y, u8 color)
+{
+	u8 *byte;
+
+	if (x < 0 || y < 0 || x >= (int)width || y >= (int)height)
+		return;
+
+	byte = &buf[y * line_length + x / 8];
+	if (color)
+		*byte |= BIT(x % 8);
+	else
+		*byte &= ~BIT(x % 8);
+}
+
+static inline void matrixorbital_draw_line(u8 *buf, u32 line_length, u32 width, u32 height,
+					   int x0, int y0, int x1, int y1, u8 color)
+{
+	int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+	int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+	int err = dx + dy;
+
+	for (;;) {
+		matrixorbital_draw_pixel(buf, line_length, width, height, x0, y0, color);
+		if (x0 == x1 && y0 == y1)
+			break;
+		if (2 * err >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (2 * err <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+static inline void matrixorbital_draw_rect(u8 *buf, u32 line_length, u32 width, u32 height,
+					   int x0, int y0, int x1, int y1, u8 color, bool filled)
+{
+	int x, y;
+
+	if (x0 > x1)
+		swap(x0, x1);
+	if (y0 > y1)
+		swap(y0, y1);
+
+	for (y = y0; y <= y1; y++)
+		for (x = x0; x <= x1; x++)
+			if (filled || y == y0 || y == y1 || x == x0 || x == x1)
+				matrixorbital_draw_pixel(buf, line_length, width, height,
+							 x, y, color);
+}
+
+static const struct {
+	u8 raw;
+	u16 keycode;
+	const char *name;
+} matrixorbital_keymap[] = {
+	{ 0x41, KEY_ESC,	"esc" },
+	{ 0x42, KEY_UP,		"up" },
+	{ 0x43, KEY_RIGHT,	"right" },
+	{ 0x44, KEY_LEFT,	"left" },
+	{ 0x45, KEY_ENTER,	"enter" },
+	{ 0x47, KEY_BACKSPACE,	"backspace" },
+	{ 0x48, KEY_DOWN,	"down" },
+};
+
+/* Input key code of a controller key code, KEY_RESERVED if unknown */
+static inline u16 matrixorbital_map_key(u8 raw)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_keymap); i++)
+		if (matrixorbital_keymap[i].raw == raw)
+			return matrixorbital_keymap[i].keycode;
+
+	return KEY_RESERVED;
+}
+
+#endif /* _MATRIXORBITAL_PACK_H */
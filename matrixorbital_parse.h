@@ -0,0 +1,250 @@
+/*
+ * Command stream parser of the Matrix Orbital GLK19264 LCD controller
+ *
+ * Splits the byte stream sent to the controller into commands and draws
+ * the graphics commands on an emulated panel. Shared by the in-kernel
+ * emulator, matrixorbital_emu, and the userspace one, tools/glkemu, so
+ * both read the stream the same way.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#ifndef _MATRIXORBITAL_PARSE_H
+#define _MATRIXORBITAL_PARSE_H
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
+#include <linux/types.h>
+
+#include "matrixorbital.h"
+
+#define MATRIXORBITAL_PANEL_WIDTH 192
+#define MATRIXORBITAL_PANEL_HEIGHT 64
+#define MATRIXORBITAL_PANEL_LINE_LENGTH (MATRIXORBITAL_PANEL_WIDTH / 8)
+#define MATRIXORBITAL_PANEL_SIZE (MATRIXORBITAL_PANEL_LINE_LENGTH * MATRIXORBITAL_PANEL_HEIGHT)
+#define MATRIXORBITAL_PARSE_MAX_ARGS 5
+
+enum matrixorbital_parse_state {
+	MATRIXORBITAL_PARSE_IDLE,
+	MATRIXORBITAL_PARSE_OPCODE,
+	MATRIXORBITAL_PARSE_ARGS,
+	MATRIXORBITAL_PARSE_BITMAP,
+};
+
+/* What a byte completed, see matrixorbital_parse_byte() */
+enum matrixorbital_parse_result {
+	/* Part of a command still being received */
+	MATRIXORBITAL_PARSE_MORE,
+	/* Outside of any command, text for the controller to print */
+	MATRIXORBITAL_PARSE_TEXT,
+	/* Opcode the controller doesn't know, skipped */
+	MATRIXORBITAL_PARSE_UNKNOWN,
+	/* A command with all its arguments, in opcode and args */
+	MATRIXORBITAL_PARSE_COMMAND,
+	/* The last byte of the pixels of a bitmap command */
+	MATRIXORBITAL_PARSE_BITMAP_DONE,
+};
+
+struct matrixorbital_parser {
+	/* Panel in controller order: rows of MSB first bytes, 1 is a lit pixel */
+	__u8 panel[MATRIXORBITAL_PANEL_SIZE];
+	__u8 color;
+	__u8 line_x;
+	__u8 line_y;
+
+	/* Commands may span several reads or I2C messages */
+	enum matrixorbital_parse_state state;
+	__u8 opcode;
+	__u8 args[MATRIXORBITAL_PARSE_MAX_ARGS];
+	int nargs;
+	int need;
+	__u32 bitmap_pos;
+	__u32 bitmap_bits;
+};
+
+/* Number of argument bytes of every command understood, -1 if unknown */
+static inline int matrixorbital_parse_nargs(__u8 opcode)
+{
+	switch (opcode) {
+	case MATRIXORBITAL_POLL_KEY_PRESS:
+	case MATRIXORBITAL_READ_MODULE_TYPE:
+	case MATRIXORBITAL_AUTO_TX_KEY_PRESS_OFF:
+	case MATRIXORBITAL_CLEAR_SCREEN:
+	case MATRIXORBITAL_GO_HOME:
+	case MATRIXORBITAL_BACKLIGHT_OFF:
+		return 0;
+	case MATRIXORBITAL_GPO_OFF:
+	case MATRIXORBITAL_GPO_ON:
+	case MATRIXORBITAL_BACKLIGHT_ON:
+	case MATRIXORBITAL_SET_BRIGHTNESS:
+	case MATRIXORBITAL_SET_CONTRAST:
+	case MATRIXORBITAL_TX_PROTOCOL_SELECT:
+	case MATRIXORBITAL_SET_DRAWING_COLOR:
+		return 1;
+	case MATRIXORBITAL_SET_CURSOR_POSITION:
+	case MATRIXORBITAL_SET_CURSOR_COORDINATE:
+	case MATRIXORBITAL_DRAW_PIXEL:
+	case MATRIXORBITAL_CONTINUE_LINE:
+		return 2;
+	case MATRIXORBITAL_DRAW_BITMAP_DIRECTLY:
+	case MATRIXORBITAL_DRAW_LINE:
+		return 4;
+	case MATRIXORBITAL_DRAW_RECTANGLE:
+	case MATRIXORBITAL_DRAW_FILLED_RECTANGLE:
+		return 5;
+	default:
+		return -1;
+	}
+}
+
+static inline void matrixorbital_parse_pixel(struct matrixorbital_parser *p, int x, int y,
+					     int color)
+{
+	__u8 *byte;
+
+	if (x < 0 || y < 0 || x >= MATRIXORBITAL_PANEL_WIDTH || y >= MATRIXORBITAL_PANEL_HEIGHT)
+		return;
+
+	byte = &p->panel[y * MATRIXORBITAL_PANEL_LINE_LENGTH + x / 8];
+	if (color)
+		*byte |= 0x80 >> (x % 8);
+	else
+		*byte &= ~(0x80 >> (x % 8));
+}
+
+static inline void matrixorbital_parse_line(struct matrixorbital_parser *p, int x0, int y0,
+					    int x1, int y1)
+{
+	int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+	int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+	int err = dx + dy;
+
+	p->line_x = x1;
+	p->line_y = y1;
+
+	for (;;) {
+		matrixorbital_parse_pixel(p, x0, y0, p->color);
+		if (x0 == x1 && y0 == y1)
+			break;
+		if (2 * err >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (2 * err <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+/* a holds color, x0, y0, x1, y1 */
+static inline void matrixorbital_parse_rect(struct matrixorbital_parser *p, const __u8 *a,
+					    int filled)
+{
+	int x0 = a[1] < a[3] ? a[1] : a[3], x1 = a[1] < a[3] ? a[3] : a[1];
+	int y0 = a[2] < a[4] ? a[2] : a[4], y1 = a[2] < a[4] ? a[4] : a[2];
+	int x, y;
+
+	for (y = y0; y <= y1; y++)
+		for (x = x0; x <= x1; x++)
+			if (filled || y == y0 || y == y1 || x == x0 || x == x1)
+				matrixorbital_parse_pixel(p, x, y, a[0]);
+}
+
+/* Draw a completed command if it draws, the caller handles the others */
+static inline void matrixorbital_parse_execute(struct matrixorbital_parser *p)
+{
+	const __u8 *a = p->args;
+
+	p->state = MATRIXORBITAL_PARSE_IDLE;
+
+	switch (p->opcode) {
+	case MATRIXORBITAL_CLEAR_SCREEN:
+		memset(p->panel, 0, sizeof(p->panel));
+		break;
+	case MATRIXORBITAL_SET_DRAWING_COLOR:
+		p->color = a[0];
+		break;
+	case MATRIXORBITAL_DRAW_PIXEL:
+		matrixorbital_parse_pixel(p, a[0], a[1], p->color);
+		break;
+	case MATRIXORBITAL_DRAW_LINE:
+		matrixorbital_parse_line(p, a[0], a[1], a[2], a[3]);
+		break;
+	case MATRIXORBITAL_CONTINUE_LINE:
+		matrixorbital_parse_line(p, p->line_x, p->line_y, a[0], a[1]);
+		break;
+	case MATRIXORBITAL_DRAW_RECTANGLE:
+		matrixorbital_parse_rect(p, a, 0);
+		break;
+	case MATRIXORBITAL_DRAW_FILLED_RECTANGLE:
+		matrixorbital_parse_rect(p, a, 1);
+		break;
+	case MATRIXORBITAL_DRAW_BITMAP_DIRECTLY:
+		/* x, y, width, height followed by a continuous stream of pixels */
+		p->bitmap_pos = 0;
+		p->bitmap_bits = a[2] * a[3];
+		if (p->bitmap_bits)
+			p->state = MATRIXORBITAL_PARSE_BITMAP;
+		break;
+	}
+}
+
+/* Feed one byte of the stream, returns what it completed */
+static inline enum matrixorbital_parse_result
+matrixorbital_parse_byte(struct matrixorbital_parser *p, __u8 byte)
+{
+	const __u8 *a = p->args;
+	int bit;
+
+	switch (p->state) {
+	case MATRIXORBITAL_PARSE_IDLE:
+		if (byte != MATRIXORBITAL_CMD)
+			return MATRIXORBITAL_PARSE_TEXT;
+		p->state = MATRIXORBITAL_PARSE_OPCODE;
+		break;
+	case MATRIXORBITAL_PARSE_OPCODE:
+		p->opcode = byte;
+		p->nargs = 0;
+		p->need = matrixorbital_parse_nargs(byte);
+		if (p->need < 0) {
+			p->state = MATRIXORBITAL_PARSE_IDLE;
+			return MATRIXORBITAL_PARSE_UNKNOWN;
+		}
+		if (!p->need) {
+			matrixorbital_parse_execute(p);
+			return MATRIXORBITAL_PARSE_COMMAND;
+		}
+		p->state = MATRIXORBITAL_PARSE_ARGS;
+		break;
+	case MATRIXORBITAL_PARSE_ARGS:
+		p->args[p->nargs++] = byte;
+		if (p->nargs == p->need) {
+			matrixorbital_parse_execute(p);
+			return MATRIXORBITAL_PARSE_COMMAND;
+		}
+		break;
+	case MATRIXORBITAL_PARSE_BITMAP:
+		for (bit = 0; bit < 8 && p->bitmap_pos < p->bitmap_bits; bit++) {
+			matrixorbital_parse_pixel(p, a[0] + p->bitmap_pos % a[2],
+						  a[1] + p->bitmap_pos / a[2],
+						  byte & (0x80 >> bit));
+			p->bitmap_pos++;
+		}
+		if (p->bitmap_pos >= p->bitmap_bits) {
+			p->state = MATRIXORBITAL_PARSE_IDLE;
+			return MATRIXORBITAL_PARSE_BITMAP_DONE;
+		}
+		break;
+	}
+
+	return MATRIXORBITAL_PARSE_MORE;
+}
+
+#endif /* _MATRIXORBITAL_PARSE_H */
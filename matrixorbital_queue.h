@@ -0,0 +1,235 @@
+/*
+ * Queues of the Matrix Orbital GLK19264 LCD controller driver
+ *
+ * Damage waiting to be uploaded and frames waiting for their presentation
+ * time. The caller serializes access, except for marking tiles which takes
+ * no lock at all, so the queues can be exercised in isolation.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#ifndef _MATRIXORBITAL_QUEUE_H
+#define _MATRIXORBITAL_QUEUE_H
+
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/bits.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/types.h>
+
+#include "matrixorbital_pack.h"
+
+/* Pending damage regions, and regions due this close together are merged */
+#define MATRIXORBITAL_MAX_REGIONS 8
+#define MATRIXORBITAL_REGION_SLACK_MS 10
+
+/* Untagged damage is tracked lock free in tiles of 8x8 pixels, a word per row */
+#define MATRIXORBITAL_TILE_SIZE 8
+#define MATRIXORBITAL_TILE_ROWS 8
+
+struct matrixorbital_region {
+	struct matrixorbital_rect rect;
+	ktime_t time;
+	ktime_t deadline;
+	/* Not known to match the shadow, upload without trimming */
+	bool full;
+};
+
+/* Damage not uploaded yet and how urgent it is */
+struct matrixorbital_pending {
+	struct matrixorbital_region regions[MATRIXORBITAL_MAX_REGIONS];
+	u32 nr_regions;
+
+	/* Damage with the default deadline, marked without the caller's lock */
+	atomic_long_t tiles[MATRIXORBITAL_TILE_ROWS];
+	atomic64_t tiles_time;
+};
+
+/*
+ * Add a pending region. Regions due within a few milliseconds of each other
+ * are merged, and once all slots are taken a region is merged into the one
+ * due closest to it. Merging keeps the earlier deadline, and a region merged
+ * with a full one is full.
+ */
+static inline void matrixorbital_pending_add(struct matrixorbital_pending *p,
+					     const struct matrixorbital_rect *rect,
+					     ktime_t time, ktime_t deadline, bool full)
+{
+	struct matrixorbital_region *r = NULL;
+	s64 d, best = S64_MAX;
+	u32 i;
+
+	if (matrixorbital_rect_empty(rect))
+		return;
+
+	for (i = 0; i < p->nr_regions; i++) {
+		d = ktime_to_ns(ktime_sub(p->regions[i].deadline, deadline));
+		if (d < 0)
+			d = -d;
+		if (d < best) {
+			best = d;
+			r = &p->regions[i];
+		}
+	}
+
+	if (p->nr_regions < MATRIXORBITAL_MAX_REGIONS &&
+	    best > (s64)MATRIXORBITAL_REGION_SLACK_MS * NSEC_PER_MSEC) {
+		r = &p->regions[p->nr_regions++];
+		r->rect = *rect;
+		r->time = time;
+		r->deadline = deadline;
+		r->full = full;
+		return;
+	}
+
+	r->full |= full;
+	matrixorbital_rect_union(&r->rect, rect);
+	if (ktime_before(time, r->time))
+		r->time = time;
+	if (ktime_before(deadline, r->deadline))
+		r->deadline = deadline;
+}
+
+/* Take the region due first, earliest deadline first */
+static inline bool matrixorbital_pending_take(struct matrixorbital_pending *p,
+					      struct matrixorbital_region *region)
+{
+	u32 i, first = 0;
+
+	if (!p->nr_regions)
+		return false;
+	for (i = 1; i < p->nr_regions; i++)
+		if (ktime_before(p->regions[i].deadline, p->regions[first].deadline))
+			first = i;
+	*region = p->regions[first];
+	p->regions[first] = p->regions[--p->nr_regions];
+
+	return true;
+}
+
+/* Start the clock of the tiles unless they have been dirty for a while already */
+static inline void matrixorbital_tiles_time(struct matrixorbital_pending *p, ktime_t time)
+{
+	atomic64_cmpxchg(&p->tiles_time, 0, ktime_to_ns(time));
+}
+
+/*
+ * Mark the tiles r touches dirty. Rows that have them all marked already
+ * are only read, so producers hammering the same area don't bounce the
+ * cache line between them.
+ */
+static inline void matrixorbital_tiles_mark(struct matrixorbital_pending *p,
+					    const struct matrixorbital_rect *r)
+{
+	u32 row = r->y / MATRIXORBITAL_TILE_SIZE;
+	u32 last = (r->y + r->height - 1) / MATRIXORBITAL_TILE_SIZE;
+	unsigned long cols = GENMASK((r->x + r->width - 1) / MATRIXORBITAL_TILE_SIZE,
+				     r->x / MATRIXORBITAL_TILE_SIZE);
+
+	/* Order the pixels before the tiles, pairs with the xchg taking them */
+	smp_mb();
+	for (; row <= last && row < MATRIXORBITAL_TILE_ROWS; row++)
+		if ((atomic_long_read(&p->tiles[row]) & cols) != cols)
+			atomic_long_or(cols, &p->tiles[row]);
+}
+
+/*
+ * Turn the dirty tiles into a region due deadline_ms after the oldest of
+ * the changes. The time is set before the tiles and taken before them, so
+ * tiles caught halfway through being marked are at worst timed from now.
+ */
+static inline void matrixorbital_tiles_collect(struct matrixorbital_pending *p,
+					       u32 width, u32 height, u32 deadline_ms)
+{
+	struct matrixorbital_rect rect = { }, r;
+	unsigned long cols;
+	ktime_t time;
+	u32 row;
+
+	time = ns_to_ktime(atomic64_xchg(&p->tiles_time, 0));
+
+	for (row = 0; row < MATRIXORBITAL_TILE_ROWS; row++) {
+		cols = atomic_long_xchg(&p->tiles[row], 0);
+		if (!cols)
+			continue;
+		r.x = __ffs(cols) * MATRIXORBITAL_TILE_SIZE;
+		r.width = (__fls(cols) + 1) * MATRIXORBITAL_TILE_SIZE - r.x;
+		r.y = row * MATRIXORBITAL_TILE_SIZE;
+		r.height = MATRIXORBITAL_TILE_SIZE;
+		matrixorbital_rect_union(&rect, &r);
+	}
+
+	if (matrixorbital_rect_empty(&rect))
+		return;
+	if (!time)
+		time = ktime_get();
+
+	matrixorbital_rect_clip(&rect, width, height);
+	matrixorbital_pending_add(p, &rect, time, ktime_add_ms(time, deadline_ms), false);
+}
+
+static inline bool matrixorbital_tiles_dirty(struct matrixorbital_pending *p)
+{
+	u32 row;
+
+	for (row = 0; row < MATRIXORBITAL_TILE_ROWS; row++)
+		if (atomic_long_read(&p->tiles[row]))
+			return true;
+
+	return false;
+}
+
+/* Frame waiting for its presentation time */
+struct matrixorbital_frame {
+	struct list_head node;
+	struct matrixorbital_rect rect;
+	ktime_t target;
+	/* When the upload has to start to make the target */
+	ktime_t start;
+	u64 cookie;
+	u8 data[];
+};
+
+/*
+ * Queue f in the order uploads have to start, which isn't the order of the
+ * targets when a larger frame takes longer to upload. The head is the next
+ * frame to wake up for.
+ */
+static inline void matrixorbital_frame_insert(struct list_head *frames,
+					      struct matrixorbital_frame *f)
+{
+	struct matrixorbital_frame *pos;
+
+	list_for_each_entry(pos, frames, node)
+		if (ktime_after(pos->start, f->start))
+			break;
+	list_add_tail(&f->node, &pos->node);
+}
+
+/*
+ * Move the frames whose upload has to start by now to due, in the order of
+ * their targets, so a frame is followed by those meant to replace it.
+ * Returns how many were moved.
+ */
+static inline u32 matrixorbital_frame_take(struct list_head *frames, ktime_t now,
+					   struct list_head *due)
+{
+	struct matrixorbital_frame *f, *tmp, *pos;
+	u32 n = 0;
+
+	list_for_each_entry_safe(f, tmp, frames, node) {
+		if (ktime_after(f->start, now))
+			break;
+		list_for_each_entry(pos, due, node)
+			if (ktime_after(pos->target, f->target))
+				break;
+		list_move_tail(&f->node, &pos->node);
+		n++;
+	}
+
+	return n;
+}
+
+#endif /* _MATRIXORBITAL_QUEUE_H */
@@ -0,0 +1,471 @@
+/*
+ * Packing and diff kernels of the Matrix Orbital GLK19264 LCD controller driver
+ *
+ * Every implementation packs whole bytes of framebuffer lines into the
+ * controller's bit order and finds the lines that differ from the shadow.
+ * The fastest one usable on the running CPU is picked by a short benchmark
+ * at module load, like the raid6 and xor code do.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#ifndef _MATRIXORBITAL_SIMD_H
+#define _MATRIXORBITAL_SIMD_H
+
+#include <asm/simd.h>
+#include <asm/unaligned.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#if defined(CONFIG_X86)
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#define MATRIXORBITAL_SIMD_X86
+#elif defined(CONFIG_KERNEL_MODE_NEON) && (defined(CONFIG_ARM) || defined(CONFIG_ARM64))
+#include <asm/neon.h>
+#define MATRIXORBITAL_SIMD_NEON
+#endif
+
+#include "matrixorbital_pack.h"
+
+struct matrixorbital_pack_impl {
+	const char *name;
+	bool (*usable)(void);
+	/* Reverse the bits of bytes bx..bx+bw-1 of every line, see pack_bytes */
+	void (*pack)(u8 *dst, const u8 *src, u32 line_length, u32 bx, u32 bw, u32 lines);
+	/* Narrow [*y0, *y1) down to the first and last lines where a and b differ */
+	void (*trim)(const u8 *a, const u8 *b, u32 line_length, u32 *y0, u32 *y1);
+
+	/* Filled in by the self benchmark, in MB/s */
+	u32 pack_mbps;
+	u32 trim_mbps;
+};
+
+static void matrixorbital_trim_memcmp(const u8 *a, const u8 *b, u32 line_length,
+				      u32 *y0, u32 *y1)
+{
+	while (*y0 < *y1 && !memcmp(a + *y0 * line_length, b + *y0 * line_length,
+				    line_length))
+		(*y0)++;
+	while (*y1 > *y0 && !memcmp(a + (*y1 - 1) * line_length,
+				    b + (*y1 - 1) * line_length, line_length))
+		(*y1)--;
+}
+
+/* Trim with a line comparison that may only be called inside a SIMD region */
+#define MATRIXORBITAL_TRIM(equal, a, b, line_length, y0, y1)			\
+	do {									\
+		while (*(y0) < *(y1) && equal((a) + *(y0) * (line_length),	\
+					      (b) + *(y0) * (line_length),	\
+					      line_length))			\
+			(*(y0))++;						\
+		while (*(y1) > *(y0) && equal((a) + (*(y1) - 1) * (line_length), \
+					      (b) + (*(y1) - 1) * (line_length), \
+					      line_length))			\
+			(*(y1))--;						\
+	} while (0)
+
+/* Eight bytes at a time in a general purpose register */
+static inline u64 matrixorbital_reverse_bits64(u64 v)
+{
+	v = (v & 0xF0F0F0F0F0F0F0F0ULL) >> 4 | (v & 0x0F0F0F0F0F0F0F0FULL) << 4;
+	v = (v & 0xCCCCCCCCCCCCCCCCULL) >> 2 | (v & 0x3333333333333333ULL) << 2;
+	v = (v & 0xAAAAAAAAAAAAAAAAULL) >> 1 | (v & 0x5555555555555555ULL) << 1;
+	return v;
+}
+
+static void matrixorbital_reverse_swar(u8 *dst, const u8 *src, u32 len)
+{
+	for (; len >= 8; len -= 8, src += 8, dst += 8)
+		put_unaligned_le64(matrixorbital_reverse_bits64(get_unaligned_le64(src)), dst);
+	while (len--)
+		*dst++ = matrixorbital_reverse_bits(*src++);
+}
+
+static void matrixorbital_pack_swar(u8 *dst, const u8 *src, u32 line_length,
+				    u32 bx, u32 bw, u32 lines)
+{
+	u32 j;
+
+	if (bw == line_length) {
+		matrixorbital_reverse_swar(dst, src, bw * lines);
+		return;
+	}
+	for (j = 0; j < lines; j++, src += line_length, dst += bw)
+		matrixorbital_reverse_swar(dst, src + bx, bw);
+}
+
+static bool matrixorbital_equal_swar(const u8 *a, const u8 *b, u32 len)
+{
+	for (; len >= 8; len -= 8, a += 8, b += 8)
+		if (get_unaligned_le64(a) != get_unaligned_le64(b))
+			return false;
+	return !memcmp(a, b, len);
+}
+
+static void matrixorbital_trim_swar(const u8 *a, const u8 *b, u32 line_length,
+				    u32 *y0, u32 *y1)
+{
+	MATRIXORBITAL_TRIM(matrixorbital_equal_swar, a, b, line_length, y0, y1);
+}
+
+static bool matrixorbital_usable_always(void)
+{
+	return true;
+}
+
+/* Controller bit order of the low nibble, in the high nibble, and of the high one */
+static const u8 matrixorbital_nibble_lo[16] __aligned(16) = {
+	0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0,
+	0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
+};
+
+static const u8 matrixorbital_nibble_hi[16] __aligned(16) = {
+	0x00, 0x08, 0x04, 0x0C, 0x02, 0x0A, 0x06, 0x0E,
+	0x01, 0x09, 0x05, 0x0D, 0x03, 0x0B, 0x07, 0x0F,
+};
+
+#ifdef MATRIXORBITAL_SIMD_X86
+static const u8 matrixorbital_nibble_mask[16] __aligned(16) = {
+	0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+	0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+};
+
+static bool matrixorbital_usable_ssse3(void)
+{
+	return boot_cpu_has(X86_FEATURE_SSSE3);
+}
+
+/*
+ * Both nibbles looked up 16 bytes at a time with pshufb. The whole loop is
+ * one asm statement, so the compiler can't use the vector registers it
+ * loads the tables into in between.
+ */
+static void matrixorbital_reverse_ssse3(u8 *dst, const u8 *src, u32 len)
+{
+	u32 blocks = len / 16;
+
+	if (blocks)
+		asm volatile("movdqa %[lo], %%xmm5\n\t"
+			     "movdqa %[hi], %%xmm6\n\t"
+			     "movdqa %[mask], %%xmm7\n\t"
+			     "1:\n\t"
+			     "movdqu (%[src]), %%xmm0\n\t"
+			     "movdqa %%xmm0, %%xmm1\n\t"
+			     "pand %%xmm7, %%xmm0\n\t"
+			     "psrlw $4, %%xmm1\n\t"
+			     "pand %%xmm7, %%xmm1\n\t"
+			     "movdqa %%xmm5, %%xmm2\n\t"
+			     "pshufb %%xmm0, %%xmm2\n\t"
+			     "movdqa %%xmm6, %%xmm3\n\t"
+			     "pshufb %%xmm1, %%xmm3\n\t"
+			     "por %%xmm3, %%xmm2\n\t"
+			     "movdqu %%xmm2, (%[dst])\n\t"
+			     "add $16, %[src]\n\t"
+			     "add $16, %[dst]\n\t"
+			     "dec %[blocks]\n\t"
+			     "jnz 1b\n\t"
+			     : [dst] "+r" (dst), [src] "+r" (src), [blocks] "+r" (blocks)
+			     : [lo] "m" (matrixorbital_nibble_lo), [hi] "m" (matrixorbital_nibble_hi),
+			       [mask] "m" (matrixorbital_nibble_mask)
+			     : "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm6", "xmm7",
+			       "cc", "memory");
+	for (len %= 16; len; len--)
+		*dst++ = matrixorbital_reverse_bits(*src++);
+}
+
+static void matrixorbital_pack_ssse3(u8 *dst, const u8 *src, u32 line_length,
+				     u32 bx, u32 bw, u32 lines)
+{
+	u32 j;
+
+	if (!may_use_simd()) {
+		matrixorbital_pack_swar(dst, src, line_length, bx, bw, lines);
+		return;
+	}
+
+	kernel_fpu_begin();
+	if (bw == line_length)
+		matrixorbital_reverse_ssse3(dst, src, bw * lines);
+	else
+		for (j = 0; j < lines; j++, src += line_length, dst += bw)
+			matrixorbital_reverse_ssse3(dst, src + bx, bw);
+	kernel_fpu_end();
+}
+
+static bool matrixorbital_equal_sse2(const u8 *a, const u8 *b, u32 len)
+{
+	u32 mask;
+
+	for (; len >= 16; len -= 16, a += 16, b += 16) {
+		asm volatile("movdqu %1, %%xmm0\n\t"
+			     "movdqu %2, %%xmm1\n\t"
+			     "pcmpeqb %%xmm1, %%xmm0\n\t"
+			     "pmovmskb %%xmm0, %0\n\t"
+			     : "=r" (mask)
+			     : "m" (*(const u8 (*)[16])a), "m" (*(const u8 (*)[16])b)
+			     : "xmm0", "xmm1");
+		if (mask != 0xFFFF)
+			return false;
+	}
+	return matrixorbital_equal_swar(a, b, len);
+}
+
+static void matrixorbital_trim_sse2(const u8 *a, const u8 *b, u32 line_length,
+				    u32 *y0, u32 *y1)
+{
+	if (!may_use_simd()) {
+		matrixorbital_trim_swar(a, b, line_length, y0, y1);
+		return;
+	}
+
+	kernel_fpu_begin();
+	MATRIXORBITAL_TRIM(matrixorbital_equal_sse2, a, b, line_length, y0, y1);
+	kernel_fpu_end();
+}
+#endif /* MATRIXORBITAL_SIMD_X86 */
+
+#ifdef MATRIXORBITAL_SIMD_NEON
+static bool matrixorbital_usable_neon(void)
+{
+#ifdef CONFIG_ARM64
+	return system_supports_fpsimd();
+#else
+	return cpu_has_neon();
+#endif
+}
+
+#ifdef CONFIG_ARM64
+/* AArch64 reverses the bits of every byte of a vector in one instruction */
+static void matrixorbital_reverse_neon(u8 *dst, const u8 *src, u32 len)
+{
+	for (; len >= 16; len -= 16, src += 16, dst += 16)
+		asm volatile("ld1 {v0.16b}, [%1]\n\t"
+			     "rbit v0.16b, v0.16b\n\t"
+			     "st1 {v0.16b}, [%0]\n\t"
+			     : : "r" (dst), "r" (src) : "v0", "memory");
+	while (len--)
+		*dst++ = matrixorbital_reverse_bits(*src++);
+}
+
+static bool matrixorbital_equal_neon(const u8 *a, const u8 *b, u32 len)
+{
+	u32 equal;
+
+	for (; len >= 16; len -= 16, a += 16, b += 16) {
+		asm volatile("ld1 {v0.16b}, [%1]\n\t"
+			     "ld1 {v1.16b}, [%2]\n\t"
+			     "cmeq v0.16b, v0.16b, v1.16b\n\t"
+			     "uminv b0, v0.16b\n\t"
+			     "umov %w0, v0.b[0]\n\t"
+			     : "=r" (equal) : "r" (a), "r" (b) : "v0", "v1", "memory");
+		if (!equal)
+			return false;
+	}
+	return matrixorbital_equal_swar(a, b, len);
+}
+#else
+/* ARMv7 has no vector bit reverse, both nibbles are looked up with vtbl */
+static void matrixorbital_reverse_neon(u8 *dst, const u8 *src, u32 len)
+{
+	for (; len >= 16; len -= 16, src += 16, dst += 16)
+		asm volatile(".fpu neon\n\t"
+			     "vld1.8 {d0-d1}, [%1]\n\t"
+			     "vld1.8 {d6-d7}, [%2]\n\t"
+			     "vld1.8 {d16-d17}, [%3]\n\t"
+			     "vmov.i8 q1, #0x0f\n\t"
+			     "vand q2, q0, q1\n\t"
+			     "vshr.u8 q0, q0, #4\n\t"
+			     "vtbl.8 d18, {d6-d7}, d4\n\t"
+			     "vtbl.8 d19, {d6-d7}, d5\n\t"
+			     "vtbl.8 d20, {d16-d17}, d0\n\t"
+			     "vtbl.8 d21, {d16-d17}, d1\n\t"
+			     "vorr q9, q9, q10\n\t"
+			     "vst1.8 {d18-d19}, [%0]\n\t"
+			     : : "r" (dst), "r" (src), "r" (matrixorbital_nibble_lo),
+				 "r" (matrixorbital_nibble_hi)
+			     : "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+			       "d16", "d17", "d18", "d19", "d20", "d21", "memory");
+	while (len--)
+		*dst++ = matrixorbital_reverse_bits(*src++);
+}
+
+static bool matrixorbital_equal_neon(const u8 *a, const u8 *b, u32 len)
+{
+	u32 lo, hi;
+
+	for (; len >= 16; len -= 16, a += 16, b += 16) {
+		asm volatile(".fpu neon\n\t"
+			     "vld1.8 {d0-d1}, [%2]\n\t"
+			     "vld1.8 {d2-d3}, [%3]\n\t"
+			     "vceq.i8 q0, q0, q1\n\t"
+			     "vand d0, d0, d1\n\t"
+			     "vmov %0, %1, d0\n\t"
+			     : "=r" (lo), "=r" (hi) : "r" (a), "r" (b)
+			     : "d0", "d1", "d2", "d3", "memory");
+		if ((lo & hi) != 0xFFFFFFFF)
+			return false;
+	}
+	return matrixorbital_equal_swar(a, b, len);
+}
+#endif
+
+static void matrixorbital_pack_neon(u8 *dst, const u8 *src, u32 line_length,
+				    u32 bx, u32 bw, u32 lines)
+{
+	u32 j;
+
+	if (!may_use_simd()) {
+		matrixorbital_pack_swar(dst, src, line_length, bx, bw, lines);
+		return;
+	}
+
+	kernel_neon_begin();
+	if (bw == line_length)
+		matrixorbital_reverse_neon(dst, src, bw * lines);
+	else
+		for (j = 0; j < lines; j++, src += line_length, dst += bw)
+			matrixorbital_reverse_neon(dst, src + bx, bw);
+	kernel_neon_end();
+}
+
+static void matrixorbital_trim_neon(const u8 *a, const u8 *b, u32 line_length,
+				    u32 *y0, u32 *y1)
+{
+	if (!may_use_simd()) {
+		matrixorbital_trim_swar(a, b, line_length, y0, y1);
+		return;
+	}
+
+	kernel_neon_begin();
+	MATRIXORBITAL_TRIM(matrixorbital_equal_neon, a, b, line_length, y0, y1);
+	kernel_neon_end();
+}
+#endif /* MATRIXORBITAL_SIMD_NEON */
+
+static struct matrixorbital_pack_impl matrixorbital_pack_impls[] = {
+	{
+		.name	= "bytewise",
+		.usable	= matrixorbital_usable_always,
+		.pack	= matrixorbital_pack_bytes,
+		.trim	= matrixorbital_trim_memcmp,
+	},
+	{
+		.name	= "swar64",
+		.usable	= matrixorbital_usable_always,
+		.pack	= matrixorbital_pack_swar,
+		.trim	= matrixorbital_trim_swar,
+	},
+#ifdef MATRIXORBITAL_SIMD_X86
+	{
+		.name	= "ssse3",
+		.usable	= matrixorbital_usable_ssse3,
+		.pack	= matrixorbital_pack_ssse3,
+		.trim	= matrixorbital_trim_sse2,
+	},
+#endif
+#ifdef MATRIXORBITAL_SIMD_NEON
+	{
+		.name	= "neon",
+		.usable	= matrixorbital_usable_neon,
+		.pack	= matrixorbital_pack_neon,
+		.trim	= matrixorbital_trim_neon,
+	},
+#endif
+};
+
+/* Frames of the default geometry worth of data per timed run */
+#define MATRIXORBITAL_SIMD_LINE_LENGTH 24
+#define MATRIXORBITAL_SIMD_LINES 64
+#define MATRIXORBITAL_SIMD_LOOPS 256
+
+static u32 matrixorbital_simd_mbps(u64 ns)
+{
+	u64 bytes = (u64)MATRIXORBITAL_SIMD_LINE_LENGTH * MATRIXORBITAL_SIMD_LINES *
+		    MATRIXORBITAL_SIMD_LOOPS;
+
+	/* bytes per ns times 1000 is MB/s */
+	return div64_u64(bytes * 1000, max_t(u64, ns, 1));
+}
+
+/*
+ * Time every usable implementation on a packed full frame and a trim of
+ * two identical frames, the worst case, and return the fastest. A forced
+ * name takes precedence if it is usable, otherwise it is warned about.
+ */
+static struct matrixorbital_pack_impl *matrixorbital_simd_select(const char *force)
+{
+	const u32 size = MATRIXORBITAL_SIMD_LINE_LENGTH * MATRIXORBITAL_SIMD_LINES;
+	struct matrixorbital_pack_impl *best = &matrixorbital_pack_impls[0];
+	struct matrixorbital_pack_impl *forced = NULL;
+	u64 best_ns = U64_MAX;
+	u8 *a, *b, *dst;
+	int i, j, run;
+
+	for (i = 0; force && *force && i < ARRAY_SIZE(matrixorbital_pack_impls); i++)
+		if (!strcmp(force, matrixorbital_pack_impls[i].name))
+			forced = &matrixorbital_pack_impls[i];
+	if (force && *force && !forced)
+		pr_warn("matrixorbital: unknown pack_kernel %s, using the fastest\n", force);
+	else if (forced && !forced->usable())
+		pr_warn("matrixorbital: pack_kernel %s not usable on this CPU, using the fastest\n",
+			force);
+
+	a = kmalloc(3 * size, GFP_KERNEL);
+	if (!a)
+		return best;
+	b = a + size;
+	dst = b + size;
+	for (i = 0; i < size; i++)
+		a[i] = b[i] = i * 37;
+
+	for (i = 0; i < ARRAY_SIZE(matrixorbital_pack_impls); i++) {
+		struct matrixorbital_pack_impl *impl = &matrixorbital_pack_impls[i];
+		u64 pack_ns = U64_MAX, trim_ns = U64_MAX;
+
+		if (!impl->usable())
+			continue;
+
+		/* Best of three, so an interrupt doesn't decide */
+		for (run = 0; run < 3; run++) {
+			ktime_t start = ktime_get();
+			u32 y0, y1;
+
+			for (j = 0; j < MATRIXORBITAL_SIMD_LOOPS; j++)
+				impl->pack(dst, a, MATRIXORBITAL_SIMD_LINE_LENGTH, 0,
+					   MATRIXORBITAL_SIMD_LINE_LENGTH,
+					   MATRIXORBITAL_SIMD_LINES);
+			pack_ns = min_t(u64, pack_ns, ktime_to_ns(ktime_sub(ktime_get(), start)));
+
+			start = ktime_get();
+			for (j = 0; j < MATRIXORBITAL_SIMD_LOOPS; j++) {
+				y0 = 0;
+				y1 = MATRIXORBITAL_SIMD_LINES;
+				impl->trim(a, b, MATRIXORBITAL_SIMD_LINE_LENGTH, &y0, &y1);
+			}
+			trim_ns = min_t(u64, trim_ns, ktime_to_ns(ktime_sub(ktime_get(), start)));
+		}
+
+		impl->pack_mbps = matrixorbital_simd_mbps(pack_ns);
+		impl->trim_mbps = matrixorbital_simd_mbps(trim_ns);
+		pr_info("matrixorbital: %-8s pack %5u MB/s, diff %5u MB/s\n", impl->name,
+			impl->pack_mbps, impl->trim_mbps);
+
+		if (impl == forced) {
+			best = impl;
+			best_ns = 0;
+		} else if (pack_ns + trim_ns < best_ns) {
+			best = impl;
+			best_ns = pack_ns + trim_ns;
+		}
+	}
+	kfree(a);
+
+	pr_info("matrixorbital: using %s packing and diff\n", best->name);
+
+	return best;
+}
+
+#endif /* _MATRIXORBITAL_SIMD_H */
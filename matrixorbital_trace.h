@@ -0,0 +1,170 @@
+/*
+ * Tracepoints for the Matrix Orbital GLK19264 LCD controller driver
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM matrixorbital
+
+#if !defined(_MATRIXORBITAL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MATRIXORBITAL_TRACE_H
+
+#include <linux/i2c.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(matrixorbital_cmd_submit,
+	TP_PROTO(struct i2c_client *client, u8 opcode, u32 len, bool read),
+	TP_ARGS(client, opcode, len, read),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&client->dev))
+		__field(u8, opcode)
+		__field(u32, len)
+		__field(bool, read)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(&client->dev));
+		__entry->opcode = opcode;
+		__entry->len = len;
+		__entry->read = read;
+	),
+
+	TP_printk("%s %s opcode=0x%02x len=%u", __get_str(dev),
+		  __entry->read ? "read" : "write", __entry->opcode, __entry->len)
+);
+
+TRACE_EVENT(matrixorbital_cmd_complete,
+	TP_PROTO(struct i2c_client *client, u8 opcode, u32 len, bool read,
+		 s64 duration_ns, int result),
+	TP_ARGS(client, opcode, len, read, duration_ns, result),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&client->dev))
+		__field(u8, opcode)
+		__field(u32, len)
+		__field(bool, read)
+		__field(s64, duration_ns)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(&client->dev));
+		__entry->opcode = opcode;
+		__entry->len = len;
+		__entry->read = read;
+		__entry->duration_ns = duration_ns;
+		__entry->result = result;
+	),
+
+	TP_printk("%s %s opcode=0x%02x len=%u duration=%lldns result=%d",
+		  __get_str(dev), __entry->read ? "read" : "write",
+		  __entry->opcode, __entry->len, __entry->duration_ns,
+		  __entry->result)
+);
+
+TRACE_EVENT(matrixorbital_damage,
+	TP_PROTO(struct i2c_client *client, const char *op,
+		 u32 x, u32 y, u32 width, u32 height),
+	TP_ARGS(client, op, x, y, width, height),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&client->dev))
+		__string(op, op)
+		__field(u32, x)
+		__field(u32, y)
+		__field(u32, width)
+		__field(u32, height)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(&client->dev));
+		__assign_str(op, op);
+		__entry->x = x;
+		__entry->y = y;
+		__entry->width = width;
+		__entry->height = height;
+	),
+
+	TP_printk("%s %s %ux%u+%u+%u", __get_str(dev), __get_str(op),
+		  __entry->width, __entry->height, __entry->x, __entry->y)
+);
+
+TRACE_EVENT(matrixorbital_flush,
+	TP_PROTO(struct i2c_client *client, u32 rects, u32 bytes, bool skipped),
+	TP_ARGS(client, rects, bytes, skipped),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&client->dev))
+		__field(u32, rects)
+		__field(u32, bytes)
+		__field(bool, skipped)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(&client->dev));
+		__entry->rects = rects;
+		__entry->bytes = bytes;
+		__entry->skipped = skipped;
+	),
+
+	TP_printk("%s rects=%u bytes=%u%s", __get_str(dev), __entry->rects,
+		  __entry->bytes, __entry->skipped ? " skipped" : "")
+);
+
+TRACE_EVENT(matrixorbital_deadline_miss,
+	TP_PROTO(struct i2c_client *client, u32 x, u32 y, u32 width, u32 height,
+		 s64 late_ns),
+	TP_ARGS(client, x, y, width, height, late_ns),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&client->dev))
+		__field(u32, x)
+		__field(u32, y)
+		__field(u32, width)
+		__field(u32, height)
+		__field(s64, late_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(&client->dev));
+		__entry->x = x;
+		__entry->y = y;
+		__entry->width = width;
+		__entry->height = height;
+		__entry->late_ns = late_ns;
+	),
+
+	TP_printk("%s %ux%u+%u+%u late_ns=%lld", __get_str(dev), __entry->width,
+		  __entry->height, __entry->x, __entry->y, __entry->late_ns)
+);
+
+TRACE_EVENT(matrixorbital_key,
+	TP_PROTO(struct i2c_client *client, u8 raw, u16 keycode),
+	TP_ARGS(client, raw, keycode),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(&client->dev))
+		__field(u8, raw)
+		__field(u16, keycode)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(&client->dev));
+		__entry->raw = raw;
+		__entry->keycode = keycode;
+	),
+
+	TP_printk("%s raw=0x%02x keycode=%u", __get_str(dev), __entry->raw,
+		  __entry->keycode)
+);
+
+#endif /* _MATRIXORBITAL_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE matrixorbital_trace
+#include <trace/define_trace.h>
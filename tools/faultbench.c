@@ -0,0 +1,362 @@
+/*
+ * Recovery benchmark for the Matrix Orbital framebuffer under I2C faults
+ *
+ * Configures fault injection in the emulated adapter, then measures how
+ * long it takes from drawing a frame until the emulated panel shows it
+ * exactly, and from a key press on the emulated keypad until the input
+ * event arrives. Frames or keys that never make it within the timeout are
+ * reported as lost.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../matrixorbital.h"
+
+static const char *fault_names[] = { "nack", "truncate", "drop", "delay" };
+
+struct result {
+	double *us;
+	int n;
+	int lost;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int write_file(const char *dir, const char *name, const char *val)
+{
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fputs(val, f);
+	return fclose(f);
+}
+
+static unsigned long long read_injected(const char *dir, const char *fault)
+{
+	unsigned long long v = 0;
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/faults/%s/injected", dir, fault);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &v) != 1)
+		v = 0;
+	fclose(f);
+
+	return v;
+}
+
+/* "name=ppm" sets the probability of a fault, "name@n" hits every n-th message */
+static int set_fault(const char *emu, const char *spec)
+{
+	char name[64], file[128];
+	const char *sep = strpbrk(spec, "=@");
+	size_t i;
+
+	if (!sep || sep - spec >= (int)sizeof(name))
+		return -1;
+	memcpy(name, spec, sep - spec);
+	name[sep - spec] = '\0';
+
+	for (i = 0; i < sizeof(fault_names) / sizeof(fault_names[0]); i++) {
+		if (strcmp(name, fault_names[i]))
+			continue;
+		snprintf(file, sizeof(file), "faults/%s/%s", name,
+			 *sep == '=' ? "probability" : "interval");
+		return write_file(emu, file, sep + 1);
+	}
+
+	return -1;
+}
+
+static void clear_faults(const char *emu)
+{
+	char file[128];
+	size_t i;
+
+	for (i = 0; i < sizeof(fault_names) / sizeof(fault_names[0]); i++) {
+		snprintf(file, sizeof(file), "faults/%s/probability", fault_names[i]);
+		write_file(emu, file, "0");
+		snprintf(file, sizeof(file), "faults/%s/interval", fault_names[i]);
+		write_file(emu, file, "0");
+	}
+}
+
+/* The framebuffer keeps the leftmost pixel in bit 0, the panel in bit 7 */
+static uint8_t reverse_bits(uint8_t b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+static int panel_matches(int panel, const uint8_t *expect, uint8_t *buf, size_t size)
+{
+	if (pread(panel, buf, size, 0) != (ssize_t)size)
+		return 0;
+	return !memcmp(buf, expect, size);
+}
+
+/* Draw random frames and time until the panel shows each of them */
+static int bench_screen(int fd, const char *emu, int n, int timeout_ms, struct result *r)
+{
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+	struct matrixorbital_damage d = { 0 };
+	uint8_t *mem, *expect, *buf;
+	unsigned int seed = 1;
+	char path[4096];
+	size_t size;
+	int panel, i;
+	uint32_t j;
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &var) || ioctl(fd, FBIOGET_FSCREENINFO, &fix)) {
+		perror("FBIOGET_*SCREENINFO");
+		return -1;
+	}
+	size = fix.line_length * var.yres;
+	mem = mmap(NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/panel", emu);
+	panel = open(path, O_RDONLY);
+	if (panel < 0) {
+		perror(path);
+		return -1;
+	}
+
+	expect = malloc(size);
+	buf = malloc(size);
+	r->us = calloc(n, sizeof(double));
+	if (!expect || !buf || !r->us)
+		return -1;
+
+	d.width = var.xres;
+	d.height = var.yres;
+	for (i = 0; i < n; i++) {
+		double start, deadline;
+
+		for (j = 0; j < size; j++) {
+			mem[j] = rand_r(&seed);
+			expect[j] = reverse_bits(mem[j]);
+		}
+
+		start = now_us();
+		deadline = start + timeout_ms * 1000.0;
+		if (ioctl(fd, MATRIXORBITAL_IOCTL_DAMAGE, &d))
+			perror("MATRIXORBITAL_IOCTL_DAMAGE");
+
+		while (!panel_matches(panel, expect, buf, size) && now_us() < deadline)
+			usleep(1000);
+		if (panel_matches(panel, expect, buf, size))
+			r->us[r->n++] = now_us() - start;
+		else
+			r->lost++;
+	}
+
+	free(buf);
+	free(expect);
+	close(panel);
+	munmap(mem, fix.smem_len);
+
+	return 0;
+}
+
+/* Press a key on the emulated keypad and time until the input event arrives */
+static int bench_keys(const char *input, const char *emu, int n, int timeout_ms,
+		      struct result *r)
+{
+	struct input_event ev;
+	struct pollfd pfd;
+	int i;
+
+	pfd.fd = open(input, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd < 0) {
+		perror(input);
+		return -1;
+	}
+	pfd.events = POLLIN;
+
+	r->us = calloc(n, sizeof(double));
+	if (!r->us)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		double start, deadline, left;
+		int seen = 0;
+
+		while (read(pfd.fd, &ev, sizeof(ev)) == sizeof(ev))
+			;
+
+		start = now_us();
+		deadline = start + timeout_ms * 1000.0;
+		if (write_file(emu, "keys", "0x41"))
+			return -1;
+
+		while (!seen && (left = deadline - now_us()) > 0) {
+			if (poll(&pfd, 1, left / 1000 + 1) <= 0)
+				continue;
+			while (read(pfd.fd, &ev, sizeof(ev)) == sizeof(ev))
+				if (ev.type == EV_KEY && ev.code == KEY_ESC && ev.value == 1)
+					seen = 1;
+		}
+		if (seen)
+			r->us[r->n++] = now_us() - start;
+		else
+			r->lost++;
+	}
+
+	close(pfd.fd);
+
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *v, int n, double p)
+{
+	int i = (int)(p / 100.0 * (n - 1) + 0.5);
+
+	return n ? v[i] : 0;
+}
+
+static void report(const char *name, struct result *r)
+{
+	qsort(r->us, r->n, sizeof(double), cmp_double);
+	printf("%-8s %6d %6d %10.0f %10.0f %10.0f %10.0f\n", name, r->n, r->lost,
+	       percentile(r->us, r->n, 50), percentile(r->us, r->n, 90),
+	       percentile(r->us, r->n, 99), r->n ? r->us[r->n - 1] : 0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-f /dev/fbN] [-k /dev/input/eventN] [-e dir] [-n count]\n"
+		"          [-t ms] [fault=ppm | fault@interval ...]\n"
+		"\n"
+		"  -f dev       framebuffer device, default /dev/fb0\n"
+		"  -k dev       keypad input device, keys are skipped without it\n"
+		"  -e dir       emulator debugfs directory,\n"
+		"               default /sys/kernel/debug/matrixorbital-emu\n"
+		"  -n count     frames and key presses to time, default 50\n"
+		"  -t ms        give up on a frame or key after this long, default 5000\n"
+		"\n"
+		"Faults: nack truncate drop delay, e.g. nack=1000 hits one message in\n"
+		"a thousand, truncate@50 every 50th. Faults are cleared on exit.\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/fb0", *input = NULL;
+	const char *emu = "/sys/kernel/debug/matrixorbital-emu";
+	struct result screen = { 0 }, keys = { 0 };
+	unsigned long long injected[4];
+	int n = 50, timeout_ms = 5000;
+	int opt, fd, ret = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "f:k:e:n:t:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			dev = optarg;
+			break;
+		case 'k':
+			input = optarg;
+			break;
+		case 'e':
+			emu = optarg;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 't':
+			timeout_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n <= 0 || timeout_ms <= 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+
+	clear_faults(emu);
+	for (; optind < argc; optind++) {
+		if (set_fault(emu, argv[optind])) {
+			fprintf(stderr, "bad fault %s\n", argv[optind]);
+			clear_faults(emu);
+			usage(argv[0]);
+		}
+	}
+	for (i = 0; i < 4; i++)
+		injected[i] = read_injected(emu, fault_names[i]);
+
+	if (bench_screen(fd, emu, n, timeout_ms, &screen))
+		ret = 1;
+	if (!ret && input && bench_keys(input, emu, n, timeout_ms, &keys))
+		ret = 1;
+
+	clear_faults(emu);
+	close(fd);
+	if (ret)
+		return ret;
+
+	printf("%-8s %6s %6s %10s %10s %10s %10s\n", "test", "ok", "lost",
+	       "p50 us", "p90 us", "p99 us", "max us");
+	report("screen", &screen);
+	if (input)
+		report("keys", &keys);
+
+	printf("injected:");
+	for (i = 0; i < 4; i++)
+		printf(" %s %llu", fault_names[i],
+		       read_injected(emu, fault_names[i]) - injected[i]);
+	printf("\n");
+
+	return 0;
+}
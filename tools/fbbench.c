@@ -0,0 +1,491 @@
+/*
+ * Throughput and latency benchmark for the Matrix Orbital framebuffer
+ *
+ * Drives /dev/fbN through representative workloads and reports achieved
+ * frame rate, damage-to-glass latency percentiles, CPU time per frame and,
+ * given the driver's debugfs directory, bytes on the bus per frame, with
+ * optional CPU hogs running alongside to see the tail latency under load.
+ * Works the same against a real panel and the emulated adapter.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/fb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../matrixorbital.h"
+
+struct bench {
+	int fd;
+	uint8_t *mem;
+	uint32_t width;
+	uint32_t height;
+	uint32_t line_length;
+	uint32_t size;
+	const char *debugfs;
+	int frames;
+	unsigned int seed;
+	struct matrixorbital_ring *ring;
+	int ring_fd;
+	int doorbell;
+};
+
+struct result {
+	int frames;
+	double *latency_us;
+	double elapsed_s;
+	double cpu_s;
+	unsigned long long bus_bytes;
+};
+
+struct workload {
+	const char *name;
+	void (*frame)(struct bench *b, int n);
+	/* Delay between frames in microseconds, 0 runs flat out */
+	unsigned int period_us;
+	/* Cap on the frame count for slow workloads, 0 for none */
+	int max_frames;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double cpu_s(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Sum of the bytes of all controller commands the driver has sent */
+static unsigned long long bus_bytes(struct bench *b)
+{
+	unsigned long long total = 0, bytes;
+	char path[4096], line[256];
+	FILE *f;
+
+	if (!b->debugfs)
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/stats", b->debugfs);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "cmd_%*x: %*u xfers %llu bytes", &bytes) == 1)
+			total += bytes;
+	fclose(f);
+
+	return total;
+}
+
+static void damage(struct bench *b, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+	struct matrixorbital_damage d = { x, y, w, h };
+
+	if (ioctl(b->fd, MATRIXORBITAL_IOCTL_DAMAGE, &d))
+		perror("MATRIXORBITAL_IOCTL_DAMAGE");
+}
+
+static void fill_rect(struct bench *b, uint32_t x, uint32_t y, uint32_t w, uint32_t h, int color)
+{
+	uint32_t i, j;
+
+	for (j = y; j < y + h && j < b->height; j++)
+		for (i = x; i < x + w && i < b->width; i++) {
+			uint8_t *p = &b->mem[j * b->line_length + i / 8];
+
+			/* Leftmost pixel in the least significant bit */
+			if (color)
+				*p |= 1 << (i % 8);
+			else
+				*p &= ~(1 << (i % 8));
+		}
+}
+
+/* Console scrolling: move everything up a text line, draw a new one */
+static void frame_scroll(struct bench *b, int n)
+{
+	uint32_t row = 8 * b->line_length;
+	uint32_t i;
+
+	memmove(b->mem, b->mem + row, b->size - row);
+	memset(b->mem + b->size - row, 0, row);
+	for (i = 0; i < b->width; i += 6)
+		if (rand_r(&b->seed) % 4)
+			fill_rect(b, i, b->height - 7, 5, 7, 1);
+	damage(b, 0, 0, b->width, b->height);
+}
+
+/* Clock: a few digits change once a second */
+static void frame_clock(struct bench *b, int n)
+{
+	uint32_t x = b->width - 40, y = 0;
+
+	fill_rect(b, x, y, 40, 8, 0);
+	fill_rect(b, x + (n % 4) * 10, y, 8, 8, 1);
+	damage(b, x, y, 40, 8);
+}
+
+/* Full screen animation through mmap */
+static void frame_anim(struct bench *b, int n)
+{
+	uint32_t i;
+
+	for (i = 0; i < b->size; i++)
+		b->mem[i] = (uint8_t)(i * 7 + n * 13);
+	damage(b, 0, 0, b->width, b->height);
+}
+
+/* Small widget updates at random places */
+static void frame_widget(struct bench *b, int n)
+{
+	uint32_t x = rand_r(&b->seed) % (b->width - 16);
+	uint32_t y = rand_r(&b->seed) % (b->height - 16);
+
+	fill_rect(b, x, y, 16, 16, n & 1);
+	damage(b, x, y, 16, 16);
+}
+
+/* Full frame written through write() in small chunks */
+static void frame_write(struct bench *b, int n)
+{
+	uint8_t buf[16];
+	uint32_t off;
+	size_t i;
+
+	for (off = 0; off < b->size; off += sizeof(buf)) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = (uint8_t)(off + i + n);
+		if (pwrite(b->fd, buf, sizeof(buf), off) != sizeof(buf)) {
+			perror("write");
+			return;
+		}
+	}
+}
+
+/* mmap without explicit damage, left to deferred I/O */
+static void frame_defio(struct bench *b, int n)
+{
+	uint32_t x = rand_r(&b->seed) % (b->width - 16);
+	uint32_t y = rand_r(&b->seed) % (b->height - 16);
+
+	fill_rect(b, x, y, 16, 16, n & 1);
+}
+
+static int ring_setup(struct bench *b)
+{
+	struct matrixorbital_ring_setup setup = { 0 };
+
+	b->doorbell = eventfd(0, EFD_CLOEXEC);
+	if (b->doorbell < 0) {
+		perror("eventfd");
+		return -1;
+	}
+	setup.eventfd = b->doorbell;
+	if (ioctl(b->fd, MATRIXORBITAL_IOCTL_RING, &setup)) {
+		perror("MATRIXORBITAL_IOCTL_RING");
+		return -1;
+	}
+	b->ring_fd = setup.fd;
+	b->ring = mmap(NULL, setup.size, PROT_READ | PROT_WRITE, MAP_SHARED, b->ring_fd, 0);
+	if (b->ring == MAP_FAILED) {
+		perror("mmap ring");
+		b->ring = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Post an entry, waiting for room if the driver is behind */
+static void ring_post(struct bench *b, const struct matrixorbital_ring_entry *e)
+{
+	struct matrixorbital_ring *ring = b->ring;
+	uint32_t head = ring->head;
+	struct pollfd pfd = { .fd = b->ring_fd, .events = POLLOUT };
+
+	while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->entries)
+		poll(&pfd, 1, 100);
+
+	ring->entry[head & (ring->entries - 1)] = *e;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Ring the doorbell if the driver went idle, then wait until it took everything */
+static void ring_kick(struct bench *b)
+{
+	struct matrixorbital_ring *ring = b->ring;
+	uint64_t one = 1;
+	int i;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->need_wakeup, __ATOMIC_RELAXED) &&
+	    write(b->doorbell, &one, sizeof(one)) != sizeof(one))
+		perror("eventfd write");
+
+	for (i = 0; i < 20000 && __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head; i++)
+		usleep(100);
+}
+
+/* Widget updates drawn by the controller, eight per frame through the command ring */
+static void frame_ring(struct bench *b, int n)
+{
+	struct matrixorbital_ring_entry e = { .op = MATRIXORBITAL_RING_FILLED_RECT };
+	int i;
+
+	if (!b->ring && ring_setup(b))
+		exit(1);
+
+	for (i = 0; i < 8; i++) {
+		e.color = (n + i) & 1;
+		e.x0 = rand_r(&b->seed) % (b->width - 16);
+		e.y0 = rand_r(&b->seed) % (b->height - 16);
+		e.x1 = e.x0 + 15;
+		e.y1 = e.y0 + 15;
+		ring_post(b, &e);
+	}
+	ring_kick(b);
+}
+
+static const struct workload workloads[] = {
+	{ "scroll", frame_scroll, 0 },
+	{ "clock", frame_clock, 1000000, 10 },
+	{ "anim", frame_anim, 0 },
+	{ "widget", frame_widget, 0 },
+	{ "write", frame_write, 0 },
+	{ "defio", frame_defio, 0 },
+	{ "ring", frame_ring, 0 },
+};
+
+/* Busy loops competing with the driver's I/O for the CPUs */
+static pid_t *start_load(int n)
+{
+	pid_t *pids = calloc(n, sizeof(pid_t));
+	int i;
+
+	if (!pids)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		pids[i] = fork();
+		if (!pids[i])
+			for (;;)
+				;
+	}
+
+	return pids;
+}
+
+static void stop_load(pid_t *pids, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (pids[i] <= 0)
+			continue;
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	free(pids);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *v, int n, double p)
+{
+	int i = (int)(p / 100.0 * (n - 1) + 0.5);
+
+	return n ? v[i] : 0;
+}
+
+static int run(struct bench *b, const struct workload *w, struct result *r)
+{
+	struct matrixorbital_flush_wait wait = { .timeout_ms = 2000 };
+	unsigned long long bytes0 = bus_bytes(b);
+	double t0 = now_us(), c0 = cpu_s();
+	int frames = b->frames;
+	int n;
+
+	if (w->max_frames && frames > w->max_frames)
+		frames = w->max_frames;
+
+	r->latency_us = calloc(frames, sizeof(double));
+	if (!r->latency_us)
+		return -1;
+
+	for (n = 0; n < frames; n++) {
+		double start = now_us();
+
+		w->frame(b, n);
+		if (ioctl(b->fd, MATRIXORBITAL_IOCTL_WAIT_FLUSH, &wait)) {
+			perror("MATRIXORBITAL_IOCTL_WAIT_FLUSH");
+			return -1;
+		}
+		if (wait.flags & MATRIXORBITAL_FLUSH_TIMEOUT)
+			fprintf(stderr, "%s: frame %d not flushed in time\n", w->name, n);
+		r->latency_us[n] = now_us() - start;
+
+		if (w->period_us && n + 1 < frames) {
+			double left = w->period_us - (now_us() - start);
+
+			if (left > 0)
+				usleep(left);
+		}
+	}
+
+	r->frames = frames;
+	r->elapsed_s = (now_us() - t0) / 1e6;
+	r->cpu_s = cpu_s() - c0;
+	r->bus_bytes = bus_bytes(b) - bytes0;
+	qsort(r->latency_us, r->frames, sizeof(double), cmp_double);
+
+	return 0;
+}
+
+static void report(struct bench *b, const struct workload *w, struct result *r)
+{
+	printf("%-8s %6d %8.1f %10.0f %8.0f %8.0f %8.0f %8.0f %10.1f\n", w->name,
+	       r->frames, r->frames / r->elapsed_s,
+	       b->debugfs ? (double)r->bus_bytes / r->frames : -1.0,
+	       percentile(r->latency_us, r->frames, 50),
+	       percentile(r->latency_us, r->frames, 90),
+	       percentile(r->latency_us, r->frames, 99),
+	       r->latency_us[r->frames - 1],
+	       r->cpu_s * 1e6 / r->frames);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-f /dev/fbN] [-n frames] [-s debugfs dir] [-L hogs] [workload...]\n"
+		"\n"
+		"  -f dev     framebuffer device, default /dev/fb0\n"
+		"  -n frames  frames per workload, default 100 (clock: at most 10 at 1 fps)\n"
+		"  -s dir     driver debugfs directory for bus byte counts,\n"
+		"             e.g. /sys/kernel/debug/matrixorbital/0-0028\n"
+		"  -L hogs    run this many busy looping processes during the benchmark\n"
+		"\n"
+		"Workloads: scroll clock anim widget write defio ring (default: all)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+	struct bench b = { .frames = 100, .seed = 1 };
+	const char *dev = "/dev/fb0";
+	pid_t *load = NULL;
+	int opt, i, j, hogs = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:s:L:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			dev = optarg;
+			break;
+		case 'n':
+			b.frames = atoi(optarg);
+			break;
+		case 's':
+			b.debugfs = optarg;
+			break;
+		case 'L':
+			hogs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (b.frames <= 0 || hogs < 0)
+		usage(argv[0]);
+
+	b.fd = open(dev, O_RDWR);
+	if (b.fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(b.fd, FBIOGET_VSCREENINFO, &var) || ioctl(b.fd, FBIOGET_FSCREENINFO, &fix)) {
+		perror("FBIOGET_*SCREENINFO");
+		return 1;
+	}
+
+	b.width = var.xres;
+	b.height = var.yres;
+	b.line_length = fix.line_length;
+	b.size = fix.smem_len;
+	b.mem = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+	if (b.mem == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (hogs) {
+		load = start_load(hogs);
+		if (!load)
+			return 1;
+	}
+
+	printf("%s: %ux%u, %u frames per workload, %d CPU hogs\n", dev, b.width, b.height,
+	       b.frames, hogs);
+	printf("%-8s %6s %8s %10s %8s %8s %8s %8s %10s\n", "workload", "frames", "fps",
+	       "bytes/frm", "p50 us", "p90 us", "p99 us", "max us", "cpu us/frm");
+
+	for (i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+		const struct workload *w = &workloads[i];
+		struct result r = { 0 };
+		bool selected = optind >= argc;
+
+		for (j = optind; j < argc; j++)
+			if (!strcmp(argv[j], w->name))
+				selected = true;
+		if (!selected)
+			continue;
+
+		memset(b.mem, 0, b.size);
+		damage(&b, 0, 0, b.width, b.height);
+		if (run(&b, w, &r)) {
+			if (load)
+				stop_load(load, hogs);
+			return 1;
+		}
+		report(&b, w, &r);
+		free(r.latency_us);
+	}
+
+	if (load)
+		stop_load(load, hogs);
+	munmap(b.mem, b.size);
+	close(b.fd);
+
+	return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Replay a capture log of the Matrix Orbital framebuffer driver
+ *
+ * Reads the log recorded through the driver's "capture" debugfs file and
+ * feeds the damage records back through a framebuffer, at the recorded
+ * pace or accelerated, so optimizations can be benchmarked against real
+ * traffic. The command records can be extracted for tools/glkemu.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../matrixorbital.h"
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-f /dev/fbN] [-s speed] [-e commands] [-i] log\n"
+		"\n"
+		"  -f dev       framebuffer to replay into, default /dev/fb0\n"
+		"  -s speed     1 replays at the recorded pace, 10 ten times faster,\n"
+		"               0 as fast as possible (default 1)\n"
+		"  -e file      write the captured command stream to file\n"
+		"  -i           only print a summary of the log\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/fb0", *extract = NULL;
+	struct matrixorbital_capture_record rec;
+	struct matrixorbital_damage damage;
+	unsigned long damages = 0, commands = 0;
+	unsigned long long payload = 0;
+	struct fb_fix_screeninfo fix;
+	double speed = 1, start = 0;
+	uint64_t first_ns = 0;
+	uint8_t *mem = NULL, *buf;
+	FILE *log, *cmds = NULL;
+	int info = 0, fd = -1, opt;
+
+	while ((opt = getopt(argc, argv, "f:s:e:ih")) != -1) {
+		switch (opt) {
+		case 'f':
+			dev = optarg;
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'e':
+			extract = optarg;
+			break;
+		case 'i':
+			info = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc || speed < 0)
+		usage(argv[0]);
+
+	log = fopen(argv[optind], "rb");
+	if (!log) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (extract) {
+		cmds = fopen(extract, "wb");
+		if (!cmds) {
+			perror(extract);
+			return 1;
+		}
+	}
+
+	if (!info && !extract) {
+		fd = open(dev, O_RDWR);
+		if (fd < 0) {
+			perror(dev);
+			return 1;
+		}
+		if (ioctl(fd, FBIOGET_FSCREENINFO, &fix)) {
+			perror("FBIOGET_FSCREENINFO");
+			return 1;
+		}
+		mem = mmap(NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+	}
+
+	buf = malloc(65536);
+	if (!buf)
+		return 1;
+
+	while (fread(&rec, sizeof(rec), 1, log) == 1) {
+		if (rec.len > 65536 || fread(buf, 1, rec.len, log) != rec.len) {
+			fprintf(stderr, "truncated or corrupt log\n");
+			break;
+		}
+		payload += rec.len;
+
+		if (rec.type == MATRIXORBITAL_CAPTURE_COMMAND) {
+			commands++;
+			if (cmds)
+				fwrite(buf, 1, rec.len, cmds);
+			continue;
+		}
+		if (rec.type != MATRIXORBITAL_CAPTURE_DAMAGE)
+			continue;
+
+		damages++;
+		if (!mem)
+			continue;
+
+		if (!first_ns) {
+			first_ns = rec.time_ns;
+			start = now_ns();
+		}
+		if (speed > 0) {
+			double due = start + (rec.time_ns - first_ns) / speed;
+			double left = due - now_ns();
+
+			if (left > 0)
+				usleep(left / 1000);
+		}
+
+		if ((uint32_t)rec.y * fix.line_length + rec.len > fix.smem_len) {
+			fprintf(stderr, "damage outside of the framebuffer, skipped\n");
+			continue;
+		}
+		memcpy(mem + rec.y * fix.line_length, buf, rec.len);
+
+		damage.x = rec.x;
+		damage.y = rec.y;
+		damage.width = rec.width;
+		damage.height = rec.height;
+		if (ioctl(fd, MATRIXORBITAL_IOCTL_DAMAGE, &damage))
+			perror("MATRIXORBITAL_IOCTL_DAMAGE");
+	}
+
+	printf("%lu damage records, %lu command records, %llu payload bytes", damages,
+	       commands, payload);
+	if (mem && damages > 1)
+		printf(", replayed in %.3f s", (now_ns() - start) / 1e9);
+	printf("\n");
+
+	if (cmds)
+		fclose(cmds);
+	fclose(log);
+
+	return 0;
+}
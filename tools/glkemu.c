@@ -0,0 +1,550 @@
+/*
+ * Userspace emulator of the Matrix Orbital GLK19264 command stream
+ *
+ * Parses the controller command stream from a captured trace, stdin or a
+ * pty (the same protocol the module speaks over its serial port), renders
+ * the panel after every frame to PBM or PNG and counts bytes and commands
+ * per frame. Optionally compares every frame against the driver's shadow
+ * framebuffer to validate encoder changes bit-exact.
+ *
+ * Licensed under the GPLv2 or later.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../matrixorbital.h"
+#include "../matrixorbital_parse.h"
+
+#define GLK_WIDTH MATRIXORBITAL_PANEL_WIDTH
+#define GLK_HEIGHT MATRIXORBITAL_PANEL_HEIGHT
+#define GLK_LINE_LENGTH MATRIXORBITAL_PANEL_LINE_LENGTH
+#define GLK_SIZE MATRIXORBITAL_PANEL_SIZE
+
+struct glk {
+	struct matrixorbital_parser parser;
+
+	/* Pixels drawn by bitmaps since the frame started, one bit each */
+	uint8_t drawn[GLK_SIZE];
+
+	/* Per frame and total counters */
+	unsigned long frame;
+	unsigned long cmd_bytes;
+	unsigned long frame_bytes;
+	unsigned long frame_cmds;
+	unsigned long frame_bitmap_pixels;
+	unsigned long total_bytes;
+	unsigned long total_cmds;
+	unsigned long cmd_count[256];
+	unsigned long unknown;
+};
+
+/*
+ * Mark the window of a bitmap command as drawn, returns true if the frame
+ * had already drawn any of it
+ */
+static bool glk_mark_drawn(struct glk *glk, const uint8_t *a)
+{
+	bool overlap = false;
+	int x, y;
+
+	for (y = a[1]; y < a[1] + a[3] && y < GLK_HEIGHT; y++)
+		for (x = a[0]; x < a[0] + a[2] && x < GLK_WIDTH; x++) {
+			uint8_t *byte = &glk->drawn[y * GLK_LINE_LENGTH + x / 8];
+
+			if (*byte & (0x80 >> (x % 8)))
+				overlap = true;
+			*byte |= 0x80 >> (x % 8);
+		}
+
+	return overlap;
+}
+
+struct options;
+static void end_frame(struct glk *glk, struct options *opts);
+
+/*
+ * Returns the byte the controller answers a following read with, or -1.
+ * A bitmap drawing over pixels the frame already drew starts a new frame:
+ * one flush uploads every pixel at most once, in as many bitmaps as it
+ * takes. Other than silence on a pty that is the only frame boundary in
+ * the stream.
+ */
+static int glk_byte(struct glk *glk, struct options *opts, uint8_t byte)
+{
+	struct matrixorbital_parser *p = &glk->parser;
+	bool bitmap = p->state == MATRIXORBITAL_PARSE_BITMAP;
+	uint32_t pos = p->bitmap_pos;
+	int response = -1;
+
+	glk->cmd_bytes++;
+	glk->total_bytes++;
+
+	switch (matrixorbital_parse_byte(p, byte)) {
+	case MATRIXORBITAL_PARSE_UNKNOWN:
+		glk->unknown++;
+		break;
+	case MATRIXORBITAL_PARSE_COMMAND:
+		/* The bitmap's pixels haven't been drawn yet */
+		if (p->opcode == MATRIXORBITAL_DRAW_BITMAP_DIRECTLY &&
+		    glk_mark_drawn(glk, p->args) && glk->frame_bytes) {
+			end_frame(glk, opts);
+			glk_mark_drawn(glk, p->args);
+		}
+		if (p->opcode == MATRIXORBITAL_CLEAR_SCREEN)
+			memset(glk->drawn, 0xFF, sizeof(glk->drawn));
+		if (p->opcode == MATRIXORBITAL_POLL_KEY_PRESS ||
+		    p->opcode == MATRIXORBITAL_READ_MODULE_TYPE)
+			response = 0;
+		glk->cmd_count[p->opcode]++;
+		glk->frame_cmds++;
+		glk->total_cmds++;
+		break;
+	default:
+		break;
+	}
+
+	/* A command counts towards the frame it completes in */
+	if (p->state != MATRIXORBITAL_PARSE_OPCODE && p->state != MATRIXORBITAL_PARSE_ARGS) {
+		glk->frame_bytes += glk->cmd_bytes;
+		glk->cmd_bytes = 0;
+	}
+	if (bitmap)
+		glk->frame_bitmap_pixels += p->bitmap_pos - pos;
+
+	return response;
+}
+
+static uint32_t crc32_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	size_t i;
+	int k;
+
+	if (!crc32_table[1]) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = i;
+
+			for (k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			crc32_table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	for (i = 0; i < len; i++)
+		crc = crc32_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len)
+{
+	uint8_t hdr[8];
+	uint32_t crc;
+
+	put_be32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	crc = crc32(0, hdr + 4, 4);
+	crc = crc32(crc, data, len);
+	fwrite(hdr, 1, 8, f);
+	fwrite(data, 1, len, f);
+	put_be32(hdr, crc);
+	fwrite(hdr, 1, 4, f);
+}
+
+/* 1 bit grayscale PNG, zlib stream made of a single stored block */
+static void write_png(FILE *f, const uint8_t *panel)
+{
+	static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint8_t ihdr[13] = { 0 };
+	uint8_t raw[GLK_HEIGHT * (1 + GLK_LINE_LENGTH)];
+	uint8_t idat[2 + 5 + sizeof(raw) + 4];
+	uint32_t s1 = 1, s2 = 0;
+	size_t i, n = 0;
+	int y;
+
+	put_be32(ihdr, GLK_WIDTH);
+	put_be32(ihdr + 4, GLK_HEIGHT);
+	ihdr[8] = 1;	/* bit depth */
+	ihdr[9] = 0;	/* grayscale */
+
+	/* Lit pixels are dark, PNG grayscale 0 is black */
+	for (y = 0; y < GLK_HEIGHT; y++) {
+		raw[n++] = 0;
+		for (i = 0; i < GLK_LINE_LENGTH; i++)
+			raw[n++] = ~panel[y * GLK_LINE_LENGTH + i];
+	}
+
+	for (i = 0; i < sizeof(raw); i++) {
+		s1 = (s1 + raw[i]) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+
+	n = 0;
+	idat[n++] = 0x78;
+	idat[n++] = 0x01;
+	idat[n++] = 1;
+	idat[n++] = sizeof(raw) & 0xFF;
+	idat[n++] = sizeof(raw) >> 8;
+	idat[n++] = ~sizeof(raw) & 0xFF;
+	idat[n++] = (~sizeof(raw) >> 8) & 0xFF;
+	memcpy(idat + n, raw, sizeof(raw));
+	n += sizeof(raw);
+	put_be32(idat + n, (s2 << 16) | s1);
+	n += 4;
+
+	fwrite(sig, 1, sizeof(sig), f);
+	png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+	png_chunk(f, "IDAT", idat, n);
+	png_chunk(f, "IEND", NULL, 0);
+}
+
+static int write_image(const char *prefix, unsigned long frame, const uint8_t *panel, bool png)
+{
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s-%05lu.%s", prefix, frame, png ? "png" : "pbm");
+	f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	if (png) {
+		write_png(f, panel);
+	} else {
+		fprintf(f, "P4\n%d %d\n", GLK_WIDTH, GLK_HEIGHT);
+		fwrite(panel, 1, GLK_SIZE, f);
+	}
+
+	return fclose(f);
+}
+
+static uint8_t reverse_bits_in_byte(uint8_t b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+static int read_file(const char *path, uint8_t *buf, size_t len)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t n;
+
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	n = read(fd, buf, len);
+	close(fd);
+	if (n != (ssize_t)len) {
+		fprintf(stderr, "%s: short read (%zd of %zu bytes)\n", path, n, len);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Compare the panel with the driver's shadow framebuffer, which keeps the
+ * framebuffer layout with the leftmost pixel in the least significant bit.
+ * Returns the number of differing pixels.
+ */
+static int count_diff(const uint8_t *panel, const uint8_t *shadow, unsigned long frame)
+{
+	int i, bit, diff = 0, first = -1;
+
+	for (i = 0; i < GLK_SIZE; i++) {
+		uint8_t x = panel[i] ^ reverse_bits_in_byte(shadow[i]);
+
+		if (!x)
+			continue;
+		for (bit = 0; bit < 8; bit++)
+			if (x & (0x80 >> bit)) {
+				if (first < 0)
+					first = i * 8 + bit;
+				diff++;
+			}
+	}
+
+	if (diff)
+		printf("frame %lu: MISMATCH %d pixels, first at %d,%d\n", frame, diff,
+		       first % GLK_WIDTH, first / GLK_WIDTH);
+
+	return diff;
+}
+
+static int compare_shadow(const uint8_t *panel, const char *shadow_path, unsigned long frame)
+{
+	uint8_t shadow[GLK_SIZE];
+
+	if (read_file(shadow_path, shadow, sizeof(shadow)))
+		return -1;
+
+	return count_diff(panel, shadow, frame);
+}
+
+/*
+ * Compare a panel dump with the shadow right after the driver has flushed
+ * all damage so far. The shadow is updated before the bitmap is sent, so
+ * the panel is read on both sides of it and the comparison retried if an
+ * upload was under way meanwhile. Returns the number of differing pixels,
+ * or -1 if the display never went quiet.
+ */
+static int compare_flushed(int fb, const char *panel_path, const char *shadow_path,
+			   unsigned long frame)
+{
+	uint8_t panel[GLK_SIZE], shadow[GLK_SIZE], again[GLK_SIZE];
+	struct matrixorbital_flush_wait wait;
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		memset(&wait, 0, sizeof(wait));
+		wait.timeout_ms = 1000;
+		if (ioctl(fb, MATRIXORBITAL_IOCTL_WAIT_FLUSH, &wait)) {
+			perror("MATRIXORBITAL_IOCTL_WAIT_FLUSH");
+			return -1;
+		}
+		if (wait.flags & MATRIXORBITAL_FLUSH_TIMEOUT)
+			continue;
+
+		if (read_file(panel_path, panel, sizeof(panel)) ||
+		    read_file(shadow_path, shadow, sizeof(shadow)) ||
+		    read_file(panel_path, again, sizeof(again)))
+			return -1;
+
+		/* A timeout of 0 only checks that no damage came up meanwhile */
+		wait.timeout_ms = 0;
+		if (ioctl(fb, MATRIXORBITAL_IOCTL_WAIT_FLUSH, &wait)) {
+			perror("MATRIXORBITAL_IOCTL_WAIT_FLUSH");
+			return -1;
+		}
+		if (!(wait.flags & MATRIXORBITAL_FLUSH_TIMEOUT) && !memcmp(panel, again, sizeof(panel)))
+			return count_diff(panel, shadow, frame);
+	}
+
+	fprintf(stderr, "frame %lu: display never quiet after a flush\n", frame);
+	return -1;
+}
+
+static int open_pty(void)
+{
+	struct termios tio;
+	int fd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+		perror("pty");
+		return -1;
+	}
+
+	if (!tcgetattr(fd, &tio)) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+
+	printf("listening on %s\n", ptsname(fd));
+	fflush(stdout);
+
+	return fd;
+}
+
+struct options {
+	const char *prefix;
+	const char *shadow;
+	bool png;
+	bool quiet;
+	unsigned long mismatches;
+};
+
+static void end_frame(struct glk *glk, struct options *opts)
+{
+	if (!opts->quiet)
+		printf("frame %lu: %lu bytes %lu cmds %lu bitmap pixels\n",
+		       glk->frame, glk->frame_bytes, glk->frame_cmds,
+		       glk->frame_bitmap_pixels);
+	if (opts->prefix)
+		write_image(opts->prefix, glk->frame, glk->parser.panel, opts->png);
+	if (opts->shadow && compare_shadow(glk->parser.panel, opts->shadow, glk->frame))
+		opts->mismatches++;
+
+	glk->frame++;
+	glk->frame_bytes = 0;
+	glk->frame_cmds = 0;
+	glk->frame_bitmap_pixels = 0;
+	memset(glk->drawn, 0, sizeof(glk->drawn));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [trace]\n"
+		"       %s -C panel -c shadow -f fbdev [-n interval_ms]\n"
+		"\n"
+		"  trace         command stream to parse, stdin if omitted\n"
+		"  -p            create a pty and parse what is written to it\n"
+		"  -g ms         with -p, a frame also ends after ms of silence (default 20)\n"
+		"  -o prefix     write every frame to prefix-NNNNN.pbm\n"
+		"  -P            write PNG instead of PBM\n"
+		"  -c shadow     compare every frame with the driver shadow framebuffer\n"
+		"  -C panel      compare a panel dump (e.g. from matrixorbital_emu) with -c\n"
+		"                after the driver of fbdev has flushed\n"
+		"  -f fbdev      framebuffer of the driver, for -C\n"
+		"  -n ms         with -C, repeat the comparison after a flush every ms\n"
+		"  -q            don't print per frame statistics\n",
+		prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct options opts = { 0 };
+	const char *panel_path = NULL, *fb_path = NULL;
+	bool use_pty = false;
+	int gap_ms = 20, interval_ms = 0;
+	static struct glk glk;
+	uint8_t buf[4096];
+	int fd = 0, opt;
+
+	while ((opt = getopt(argc, argv, "pg:o:Pc:C:f:n:qh")) != -1) {
+		switch (opt) {
+		case 'p':
+			use_pty = true;
+			break;
+		case 'g':
+			gap_ms = atoi(optarg);
+			break;
+		case 'o':
+			opts.prefix = optarg;
+			break;
+		case 'P':
+			opts.png = true;
+			break;
+		case 'c':
+			opts.shadow = optarg;
+			break;
+		case 'C':
+			panel_path = optarg;
+			break;
+		case 'f':
+			fb_path = optarg;
+			break;
+		case 'n':
+			interval_ms = atoi(optarg);
+			break;
+		case 'q':
+			opts.quiet = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (panel_path) {
+		if (!opts.shadow || !fb_path)
+			usage(argv[0]);
+		fd = open(fb_path, O_RDWR);
+		if (fd < 0) {
+			perror(fb_path);
+			return 1;
+		}
+		do {
+			int diff = compare_flushed(fd, panel_path, opts.shadow, glk.frame++);
+
+			if (diff < 0)
+				return 1;
+			if (diff)
+				opts.mismatches++;
+			if (interval_ms)
+				usleep(interval_ms * 1000);
+		} while (interval_ms);
+		return opts.mismatches ? 1 : 0;
+	}
+
+	if (use_pty) {
+		fd = open_pty();
+		if (fd < 0)
+			return 1;
+	} else if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		ssize_t n, i;
+		int ret;
+
+		ret = poll(&pfd, 1, use_pty ? gap_ms : -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (ret == 0) {
+			/* Silence on the line ends the frame */
+			if (glk.frame_bytes)
+				end_frame(&glk, &opts);
+			continue;
+		}
+
+		n = read(fd, buf, sizeof(buf));
+		/* The pty reports EIO while no client has it open */
+		if (n < 0 && use_pty && errno == EIO) {
+			usleep(100000);
+			continue;
+		}
+		if (n <= 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			int response = glk_byte(&glk, &opts, buf[i]);
+
+			if (response >= 0 && use_pty) {
+				uint8_t r = response;
+
+				if (write(fd, &r, 1) != 1)
+					perror("pty");
+			}
+		}
+	}
+
+	if (glk.frame_bytes)
+		end_frame(&glk, &opts);
+
+	printf("total: %lu frames %lu bytes %lu cmds %lu unknown\n", glk.frame,
+	       glk.total_bytes, glk.total_cmds, glk.unknown);
+	for (opt = 0; opt < 256; opt++)
+		if (glk.cmd_count[opt])
+			printf("cmd_0x%02x: %lu\n", opt, glk.cmd_count[opt]);
+	if (opts.shadow)
+		printf("mismatched frames: %lu\n", opts.mismatches);
+
+	return opts.mismatches ? 1 : 0;
+}